@@ -11,8 +11,23 @@
       'target_name': 'hello',
       "sources": [ 
         "src/webcam_api.cpp",
+        "src/camera.cpp",
+        "src/shm_reader.cpp",
         "src/video.cpp",
-        "src/video_source.cpp"
+        "src/video_source.cpp",
+        "src/v4l2_capture.cpp",
+        "src/device_caps.cpp",
+        "src/frame_pool.cpp",
+        "src/worker_pool.cpp",
+        "src/slice_scaler.cpp",
+        "src/video_output.cpp",
+        "src/pixel_convert.cpp",
+        "src/change_detector.cpp",
+        "src/snapshot_encoder.cpp",
+        "src/video_encoder.cpp",
+        "src/frame_recorder.cpp",
+        "src/shm_frame_ring.cpp",
+        "src/shared_frame_ring.cpp"
       ],
       'include_dirs': [
         "<!@(node -p \"require('node-addon-api').include\")",
@@ -20,21 +35,6 @@
         '../src/ffmpeg_mac/include',
         'src/ffmpeg_mac/'
       ],
-      'link_settings': {
-        'libraries': [
-          '../src/ffmpeg_mac/lib/libavcodec.58.91.100.dylib',
-          '../src/ffmpeg_mac/lib/libavdevice.58.10.100.dylib',
-          '../src/ffmpeg_mac/lib/libavfilter.7.85.100.dylib',
-          '../src/ffmpeg_mac/lib/libavformat.58.45.100.dylib',
-          '../src/ffmpeg_mac/lib/libavutil.56.51.100.dylib',
-          '../src/ffmpeg_mac/lib/libpostproc.55.7.100.dylib',
-          '../src/ffmpeg_mac/lib/libswresample.3.7.100.dylib',
-          '../src/ffmpeg_mac/lib/libswscale.5.7.100.dylib',
-        ],
-        'library_dirs': [
-          '../src/ffmpeg_mac/lib'
-        ]
-      },
       'conditions': [
         [ 'OS=="win"', {
           'sources': [],
@@ -58,6 +58,21 @@
         }], # OS=="win"
         [ 'OS=="mac"', {
           'sources': [],
+          'link_settings': {
+            'libraries': [
+              '../src/ffmpeg_mac/lib/libavcodec.58.91.100.dylib',
+              '../src/ffmpeg_mac/lib/libavdevice.58.10.100.dylib',
+              '../src/ffmpeg_mac/lib/libavfilter.7.85.100.dylib',
+              '../src/ffmpeg_mac/lib/libavformat.58.45.100.dylib',
+              '../src/ffmpeg_mac/lib/libavutil.56.51.100.dylib',
+              '../src/ffmpeg_mac/lib/libpostproc.55.7.100.dylib',
+              '../src/ffmpeg_mac/lib/libswresample.3.7.100.dylib',
+              '../src/ffmpeg_mac/lib/libswscale.5.7.100.dylib',
+            ],
+            'library_dirs': [
+              '../src/ffmpeg_mac/lib'
+            ]
+          },
           'xcode_settings': {
             'OTHER_CPLUSPLUSFLAGS' : [
               '-std=c++11',
@@ -75,7 +90,16 @@
           }
         }], # OS=="mac"
         [ 'OS=="linux"', {
-          'sources': []
+          'sources': [],
+          'cflags_cc': [
+            '<!@(pkg-config --cflags libavcodec libavdevice libavformat libavutil libswscale)'
+          ],
+          'link_settings': {
+            'libraries': [
+              '<!@(pkg-config --libs libavcodec libavdevice libavformat libavutil libswscale)',
+              '-lrt'
+            ]
+          }
         }]
       ],
       'defines': [ 'NAPI_DISABLE_CPP_EXCEPTIONS' ]
@@ -0,0 +1,15 @@
+#ifndef ADDON_DATA_H
+#define ADDON_DATA_H
+
+#include <napi.h>
+
+// What the addon keeps per JS environment, stored with env.SetInstanceData()
+// so that every worker thread loading the module gets its own; freed with
+// the environment.
+struct AddonData {
+    Napi::FunctionReference camera_constructor;
+    // drives the module-level functions
+    Napi::ObjectReference default_camera;
+};
+
+#endif // ADDON_DATA_H
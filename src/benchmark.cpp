@@ -0,0 +1,568 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "video.h"
+#include "pixel_convert.h"
+#include "change_detector.h"
+
+// Headless benchmark of the capture -> convert -> deliver pipeline.
+// Video is driven from a lavfi test pattern (or a file given with -i)
+// across a matrix of source sizes, pixel formats and output settings;
+// the results are written as one JSON document.
+//
+//   web_ffmpeg_cpp_bench [-i clip.mp4] [-d seconds] [-o results.json] [-k]
+//
+// The source is generated as fast as it is consumed and the outputs have
+// no fps gate, so frames/s is the throughput of the whole pipeline. CPU
+// per frame is the process' user+system time, the test pattern included;
+// the per stage latencies tell where it goes.
+//
+// The PixelConvert kernels are also checked against swscale on a synthetic
+// frame and timed against the SWS_BICUBIC conversion they replace, for
+// every SIMD level the CPU has; -k runs only that part. So is the change
+// detector, on a still frame and on one with a single tile changed.
+
+static constexpr const char* const TAG = "Bench";
+static constexpr const int DEFAULT_DURATION_MS = 3000;
+static constexpr const int WARMUP_MS = 500;
+static constexpr const int FIRST_FRAME_TIMEOUT_MS = 5000;
+// output size for file sources, whose size is only known once opened
+static constexpr const int FILE_OUTPUT_WIDTH = 1280;
+static constexpr const int FILE_OUTPUT_HEIGHT = 720;
+static constexpr const int KERNEL_ITERATIONS = 50;
+// kernels share chroma between rows where swscale interpolates (nv12), the
+// test frame's chroma changes slowly enough to keep that within a few levels
+static constexpr const int KERNEL_MAX_DIFF = 4;
+static constexpr const int DETECT_THRESHOLD = 4;
+// tile the detector case changes, in tiles
+static constexpr const int DETECT_TILE_COL = 2;
+static constexpr const int DETECT_TILE_ROW = 1;
+
+struct SourceCase {
+    int width;
+    int height;
+    const char* pix_fmt;
+};
+
+struct OutputCase {
+    const char* name;
+    OutputFormat format;
+    // output size is the source size divided by this
+    int scale_div;
+    // 0 picks the thread count from the cores
+    int threads;
+    int scale_flags;
+    Orientation orientation;
+};
+
+struct CaseResult {
+    std::string source;
+    std::string output;
+    int width;
+    int height;
+    bool ok;
+    uint32_t frames;
+    double seconds;
+    double fps;
+    double cpu_us_per_frame;
+    uint32_t pool_alloc_cnt;
+    uint32_t pool_reuse_cnt;
+    uint32_t err_cnt;
+    LatencySummary interval;
+    LatencySummary stages[(int)Stage::Count];
+};
+
+// the capture formats negotiated with real cameras, see VideoSource
+static const SourceCase SOURCE_CASES[] = {
+    { 640,  480,  "yuyv422" },
+    { 640,  480,  "uyvy422" },
+    { 640,  480,  "nv12" },
+    { 1280, 720,  "yuyv422" },
+    { 1280, 720,  "uyvy422" },
+    { 1280, 720,  "nv12" },
+    { 1920, 1080, "yuyv422" },
+    { 1920, 1080, "uyvy422" },
+    { 1920, 1080, "nv12" },
+};
+
+struct KernelResult {
+    std::string source;
+    std::string output;
+    std::string orientation;
+    int max_diff;
+    double mean_diff;
+    // all SIMD levels gave the same bytes
+    bool levels_match;
+    double swscale_us;
+    std::vector<std::pair<std::string, double>> kernel_us;
+};
+
+struct DetectResult {
+    std::string source;
+    // the changed frame found exactly the changed tile, at every level
+    bool tiles_match;
+    // a still frame, compared and dropped
+    double scalar_us;
+    double simd_us;
+};
+
+static const OutputCase OUTPUT_CASES[] = {
+    { "rgb32_bicubic",               OutputFormat::Rgb32,  1, 1, SWS_BICUBIC,       Orientation::Normal },
+    { "rgb32_bicubic_threads",       OutputFormat::Rgb32,  1, 0, SWS_BICUBIC,       Orientation::Normal },
+    { "rgb32_half_fast_bilinear",    OutputFormat::Rgb32,  2, 1, SWS_FAST_BILINEAR, Orientation::Normal },
+    { "rgb32_mirror",                OutputFormat::Rgb32,  1, 1, SWS_BICUBIC,       Orientation::Mirror },
+    { "rgba_rotate90",               OutputFormat::Rgba,   1, 1, SWS_BICUBIC,       Orientation::Rotate90 },
+    { "i420_bicubic",                OutputFormat::I420,   1, 1, SWS_BICUBIC,       Orientation::Normal },
+    { "native",                      OutputFormat::Native, 1, 1, SWS_BICUBIC,       Orientation::Normal },
+};
+
+static const Orientation KERNEL_ORIENTATIONS[] = {
+    Orientation::Normal, Orientation::Mirror, Orientation::Rotate90, Orientation::Rotate180, Orientation::Rotate270,
+};
+
+static uint64_t cpuTimeUs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static CaseResult runCase(const std::string& format, const std::string& url, const std::string& source_name,
+                          int width, int height, const OutputCase& output, int duration_ms) {
+    CaseResult result = CaseResult();
+    result.source = source_name;
+    result.output = output.name;
+    result.width = width / output.scale_div;
+    result.height = height / output.scale_div;
+
+    std::atomic<uint32_t> frames{0};
+    std::atomic<int64_t> last_frame_us{0};
+    LatencyHistogram interval;
+    auto start = std::chrono::steady_clock::now();
+
+    Video* video = new Video();
+    video->setInput(format, url);
+    video->setTargetFps(0);
+    video->setOutputFormat(output.format);
+    video->setOutputResolution(Video::DEFAULT_OUTPUT_ID, result.width, result.height);
+    video->setOutputScaleFlags(Video::DEFAULT_OUTPUT_ID, output.scale_flags);
+    video->setOutputOrientation(Video::DEFAULT_OUTPUT_ID, output.orientation);
+    video->setScaleThreads(output.threads);
+    video->setFrameCallBack([&](uint32_t output_id, AVFrame* frame, uint32_t size, const FrameTiming& timing,
+                                const ChangeMap* change) {
+        int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        int64_t last_us = last_frame_us.exchange(now_us);
+        if(last_us != 0) {
+            interval.record(now_us - last_us);
+        }
+        frames++;
+    });
+    video->startVideoCamera();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(FIRST_FRAME_TIMEOUT_MS);
+    while(frames == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if(frames == 0) {
+        std::cerr << TAG << ": no frame from " << source_name << std::endl;
+        delete video;
+        return result;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(WARMUP_MS));
+
+    // measured window, counters are taken as deltas and histograms restarted
+    VideStats stats_start = video->getStats();
+    video->getMetrics()->reset();
+    interval.reset();
+    uint32_t frames_start = frames;
+    uint64_t cpu_start = cpuTimeUs();
+    auto window_start = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+
+    uint32_t frames_end = frames;
+    uint64_t cpu_end = cpuTimeUs();
+    auto window_end = std::chrono::steady_clock::now();
+    VideStats stats_end = video->getStats();
+    video->stopVideo();
+    delete video;
+
+    result.ok = true;
+    result.frames = frames_end - frames_start;
+    result.seconds = std::chrono::duration<double>(window_end - window_start).count();
+    result.fps = result.frames / result.seconds;
+    result.cpu_us_per_frame = result.frames > 0 ? (double)(cpu_end - cpu_start) / result.frames : 0;
+    result.pool_alloc_cnt = stats_end.pool_alloc_cnt - stats_start.pool_alloc_cnt;
+    result.pool_reuse_cnt = stats_end.pool_reuse_cnt - stats_start.pool_reuse_cnt;
+    result.err_cnt = stats_end.err_cnt - stats_start.err_cnt;
+    result.interval = interval.summary();
+    for(int i = 0; i < (int)Stage::Count; i++) {
+        result.stages[i] = stats_end.stages[i];
+    }
+    return result;
+}
+
+static const char* orientationName(Orientation orientation) {
+    switch(orientation) {
+    case Orientation::Mirror:
+        return "mirror";
+    case Orientation::Rotate90:
+        return "rotate90";
+    case Orientation::Rotate180:
+        return "rotate180";
+    case Orientation::Rotate270:
+        return "rotate270";
+    default:
+        return "normal";
+    }
+}
+
+// smooth chroma and busy luma: no chroma edges for the interpolation to differ on
+static void fillTestFrame(AVFrame* frame) {
+    AVPixelFormat pix_fmt = (AVPixelFormat)frame->format;
+    bool packed = pix_fmt == AV_PIX_FMT_YUYV422 || pix_fmt == AV_PIX_FMT_UYVY422;
+    int y_offset = pix_fmt == AV_PIX_FMT_UYVY422 ? 1 : 0;
+    int u_offset = pix_fmt == AV_PIX_FMT_UYVY422 ? 0 : 1;
+    int v_offset = pix_fmt == AV_PIX_FMT_UYVY422 ? 2 : 3;
+    for(int y = 0; y < frame->height; y++) {
+        uint8_t* luma = frame->data[0] + y * frame->linesize[0];
+        uint8_t* chroma = packed ? NULL : frame->data[1] + (y / 2) * frame->linesize[1];
+        for(int x = 0; x < frame->width; x += 2) {
+            uint8_t y0 = (uint8_t)((x * 7 + y * 3) & 0xff);
+            uint8_t y1 = (uint8_t)(((x + 1) * 7 + y * 3 + 91) & 0xff);
+            uint8_t u = (uint8_t)(128 + 110 * sin(x / 40.0));
+            uint8_t v = (uint8_t)(128 + 90 * sin(y / 60.0 + x / 90.0));
+            if(packed) {
+                luma[x * 2 + y_offset] = y0;
+                luma[x * 2 + y_offset + 2] = y1;
+                luma[x * 2 + u_offset] = u;
+                luma[x * 2 + v_offset] = v;
+            } else {
+                luma[x] = y0;
+                luma[x + 1] = y1;
+                chroma[x] = u;
+                chroma[x + 1] = v;
+            }
+        }
+    }
+}
+
+static double timeUs(int iterations, const std::function<void()>& job) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++) {
+        job();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static KernelResult runKernelCase(const SourceCase& source, AVPixelFormat out_fmt, Orientation orientation) {
+    KernelResult result = KernelResult();
+    std::ostringstream name;
+    name << source.width << "x" << source.height << "_" << source.pix_fmt;
+    result.source = name.str();
+    result.output = av_get_pix_fmt_name(out_fmt);
+    result.orientation = orientationName(orientation);
+
+    AVFrame* src = av_frame_alloc();
+    AVFrame* upright = av_frame_alloc();
+    AVFrame* dst = av_frame_alloc();
+    src->format = av_get_pix_fmt(source.pix_fmt);
+    src->width = source.width;
+    src->height = source.height;
+    upright->format = out_fmt;
+    upright->width = source.width;
+    upright->height = source.height;
+    dst->format = out_fmt;
+    PixelConvert::getOrientedSize(source.width, source.height, orientation, dst->width, dst->height);
+    SwsContext* sws = sws_getContext(source.width, source.height, (AVPixelFormat)src->format,
+                                     source.width, source.height, out_fmt, SWS_BICUBIC, NULL, NULL, NULL);
+    if(sws == NULL || av_frame_get_buffer(src, 32) < 0 || av_frame_get_buffer(upright, 32) < 0
+            || av_frame_get_buffer(dst, 32) < 0) {
+        std::cerr << TAG << ": cannot set up kernel case " << result.source << std::endl;
+        result.max_diff = 255;
+    } else {
+        fillTestFrame(src);
+        auto swsScale = [&] {
+            sws_scale(sws, src->data, src->linesize, 0, src->height, upright->data, upright->linesize);
+        };
+        // what the output did so far: swscale, then turning the pixels
+        result.swscale_us = timeUs(KERNEL_ITERATIONS, [&] {
+            swsScale();
+            if(orientation != Orientation::Normal) {
+                PixelConvert::orient(upright, dst, orientation);
+            }
+        });
+        swsScale();
+
+        std::vector<uint8_t> first_level;
+        result.levels_match = true;
+        PixelConvert::SimdLevel best = PixelConvert::getSimdLevel();
+        for(int level = 0; level <= (int)best; level++) {
+            PixelConvert::setMaxSimdLevel((PixelConvert::SimdLevel)level);
+            double us = timeUs(KERNEL_ITERATIONS, [&] {
+                PixelConvert::convert(src, dst, orientation);
+            });
+            result.kernel_us.push_back(std::make_pair(PixelConvert::getSimdName((PixelConvert::SimdLevel)level), us));
+            std::vector<uint8_t> bytes;
+            for(int y = 0; y < dst->height; y++) {
+                bytes.insert(bytes.end(), dst->data[0] + y * dst->linesize[0],
+                             dst->data[0] + y * dst->linesize[0] + dst->width * 4);
+            }
+            if(first_level.empty()) {
+                first_level = bytes;
+            } else if(bytes != first_level) {
+                result.levels_match = false;
+            }
+        }
+        PixelConvert::setMaxSimdLevel(best);
+
+        // every output pixel against the swscale pixel it was turned from
+        uint64_t diff_sum = 0;
+        for(int y = 0; y < dst->height; y++) {
+            for(int x = 0; x < dst->width; x++) {
+                int src_x = x, src_y = y;
+                switch(orientation) {
+                case Orientation::Mirror: src_x = source.width - 1 - x; break;
+                case Orientation::Rotate90: src_x = y; src_y = source.height - 1 - x; break;
+                case Orientation::Rotate180: src_x = source.width - 1 - x; src_y = source.height - 1 - y; break;
+                case Orientation::Rotate270: src_x = source.width - 1 - y; src_y = x; break;
+                default: break;
+                }
+                const uint8_t* expected = upright->data[0] + src_y * upright->linesize[0] + src_x * 4;
+                const uint8_t* actual = dst->data[0] + y * dst->linesize[0] + x * 4;
+                for(int c = 0; c < 4; c++) {
+                    int diff = abs(expected[c] - actual[c]);
+                    result.max_diff = std::max(result.max_diff, diff);
+                    diff_sum += diff;
+                }
+            }
+        }
+        result.mean_diff = (double)diff_sum / ((uint64_t)dst->width * dst->height * 4);
+    }
+    sws_freeContext(sws);
+    av_frame_free(&src);
+    av_frame_free(&upright);
+    av_frame_free(&dst);
+    return result;
+}
+
+// ChangeMap of the frame with one tile's luma inverted, with SIMD or without
+static bool detectTile(AVFrame* src, bool simd, double& still_us) {
+    ChangeDetector::setSimdEnabled(simd);
+    ChangeDetector detector;
+    ChangeConfig config = { +DETECT_THRESHOLD, 1, true };
+    detector.setConfig(&config);
+    ChangeMap map;
+    detector.process(src, map);
+    still_us = timeUs(KERNEL_ITERATIONS, [&] {
+        detector.process(src, map);
+    });
+    bool still = map.changed_cnt == 0;
+
+    // the tile goes flat at the far end of the range from its mean
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    int step = desc->comp[0].step;
+    int offset = desc->comp[0].offset;
+    int block = ChangeDetector::TILE * ChangeDetector::DOWNSAMPLE;
+    uint64_t sum = 0;
+    for(int pass = 0; pass < 2; pass++) {
+        uint8_t flat = sum / (block * block) < 128 ? 255 : 0;
+        for(int y = DETECT_TILE_ROW * block; y < (DETECT_TILE_ROW + 1) * block; y++) {
+            uint8_t* row = src->data[0] + y * src->linesize[0] + offset;
+            for(int x = DETECT_TILE_COL * block; x < (DETECT_TILE_COL + 1) * block; x++) {
+                if(pass == 0) {
+                    sum += row[x * step];
+                } else {
+                    row[x * step] = flat;
+                }
+            }
+        }
+    }
+    bool changed = detector.process(src, map);
+    int index = DETECT_TILE_ROW * map.cols + DETECT_TILE_COL;
+    bool tile_set = map.cols > DETECT_TILE_COL && (map.bits[index >> 3] >> (index & 7)) & 1;
+    // back to the still frame for the next run
+    fillTestFrame(src);
+    ChangeDetector::setSimdEnabled(true);
+    return still && changed && map.changed_cnt == 1 && tile_set;
+}
+
+static DetectResult runDetectCase(const SourceCase& source) {
+    DetectResult result = DetectResult();
+    std::ostringstream name;
+    name << source.width << "x" << source.height << "_" << source.pix_fmt;
+    result.source = name.str();
+    AVFrame* src = av_frame_alloc();
+    src->format = av_get_pix_fmt(source.pix_fmt);
+    src->width = source.width;
+    src->height = source.height;
+    if(av_frame_get_buffer(src, 32) < 0) {
+        std::cerr << TAG << ": cannot set up detect case " << result.source << std::endl;
+    } else {
+        fillTestFrame(src);
+        result.tiles_match = detectTile(src, false, result.scalar_us);
+        if(ChangeDetector::hasSimd()) {
+            result.tiles_match = detectTile(src, true, result.simd_us) && result.tiles_match;
+        }
+    }
+    av_frame_free(&src);
+    return result;
+}
+
+static bool isKernelOk(const KernelResult& r) {
+    return r.levels_match && r.max_diff <= KERNEL_MAX_DIFF;
+}
+
+static void writeSummary(std::ostream& out, const LatencySummary& summary) {
+    out << "{\"count\":" << summary.count
+        << ",\"avg_us\":" << summary.avg_us
+        << ",\"p50_us\":" << summary.p50_us
+        << ",\"p99_us\":" << summary.p99_us
+        << ",\"max_us\":" << summary.max_us << "}";
+}
+
+static void writeResults(std::ostream& out, const std::vector<CaseResult>& results,
+                         const std::vector<KernelResult>& kernels, const std::vector<DetectResult>& detects,
+                         int duration_ms) {
+    out << "{\n  \"duration_ms\": " << duration_ms << ",\n  \"cases\": [";
+    for(size_t i = 0; i < results.size(); i++) {
+        const CaseResult& r = results[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"source\":\"" << r.source << "\""
+            << ",\"output\":\"" << r.output << "\""
+            << ",\"width\":" << r.width
+            << ",\"height\":" << r.height
+            << ",\"ok\":" << (r.ok ? "true" : "false")
+            << ",\"frames\":" << r.frames
+            << ",\"fps\":" << r.fps
+            << ",\"cpu_us_per_frame\":" << r.cpu_us_per_frame
+            << ",\"pool_alloc_cnt\":" << r.pool_alloc_cnt
+            << ",\"pool_reuse_cnt\":" << r.pool_reuse_cnt
+            << ",\"err_cnt\":" << r.err_cnt
+            << ",\"frame_interval\":";
+        writeSummary(out, r.interval);
+        out << ",\"stages\":{";
+        for(int s = 0; s < (int)Stage::Count; s++) {
+            out << (s == 0 ? "" : ",") << "\"" << PipelineMetrics::stageName((Stage)s) << "\":";
+            writeSummary(out, r.stages[s]);
+        }
+        out << "}}";
+    }
+    out << "\n  ],\n  \"simd\": \"" << PixelConvert::getSimdName(PixelConvert::getSimdLevel()) << "\","
+        << "\n  \"kernels\": [";
+    for(size_t i = 0; i < kernels.size(); i++) {
+        const KernelResult& r = kernels[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"source\":\"" << r.source << "\""
+            << ",\"output\":\"" << r.output << "\""
+            << ",\"orientation\":\"" << r.orientation << "\""
+            << ",\"ok\":" << (isKernelOk(r) ? "true" : "false")
+            << ",\"max_diff\":" << r.max_diff
+            << ",\"mean_diff\":" << r.mean_diff
+            << ",\"levels_match\":" << (r.levels_match ? "true" : "false")
+            << ",\"swscale_us\":" << r.swscale_us
+            << ",\"kernel_us\":{";
+        for(size_t k = 0; k < r.kernel_us.size(); k++) {
+            out << (k == 0 ? "" : ",") << "\"" << r.kernel_us[k].first << "\":" << r.kernel_us[k].second;
+        }
+        out << "}}";
+    }
+    out << "\n  ],\n  \"detector\": [";
+    for(size_t i = 0; i < detects.size(); i++) {
+        const DetectResult& r = detects[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"source\":\"" << r.source << "\""
+            << ",\"ok\":" << (r.tiles_match ? "true" : "false")
+            << ",\"scalar_us\":" << r.scalar_us;
+        if(ChangeDetector::hasSimd()) {
+            out << ",\"sse2_us\":" << r.simd_us;
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string file;
+    std::string out_path = "bench.json";
+    int duration_ms = DEFAULT_DURATION_MS;
+    bool kernels_only = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            file = argv[++i];
+        } else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            duration_ms = std::max(1, atoi(argv[++i])) * 1000;
+        } else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if(strcmp(argv[i], "-k") == 0) {
+            kernels_only = true;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [-i file] [-d seconds] [-o results.json|-] [-k]" << std::endl;
+            return 2;
+        }
+    }
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::vector<KernelResult> kernels;
+    for(const SourceCase& source : SOURCE_CASES) {
+        for(AVPixelFormat out_fmt : { AV_PIX_FMT_BGRA, AV_PIX_FMT_RGBA }) {
+            for(Orientation orientation : KERNEL_ORIENTATIONS) {
+                kernels.push_back(runKernelCase(source, out_fmt, orientation));
+            }
+        }
+    }
+    std::vector<DetectResult> detects;
+    for(const SourceCase& source : SOURCE_CASES) {
+        detects.push_back(runDetectCase(source));
+    }
+
+    std::vector<CaseResult> results;
+    for(const OutputCase& output : OUTPUT_CASES) {
+        if(kernels_only) {
+            break;
+        }
+        if(!file.empty()) {
+            results.push_back(runCase("", file, file, FILE_OUTPUT_WIDTH, FILE_OUTPUT_HEIGHT, output, duration_ms));
+            continue;
+        }
+        for(const SourceCase& source : SOURCE_CASES) {
+            std::ostringstream graph;
+            graph << "testsrc2=size=" << source.width << "x" << source.height << ":rate=30,format=" << source.pix_fmt;
+            std::ostringstream name;
+            name << source.width << "x" << source.height << "_" << source.pix_fmt;
+            results.push_back(runCase("lavfi", graph.str(), name.str(), source.width, source.height, output, duration_ms));
+        }
+    }
+
+    bool all_ok = true;
+    for(const CaseResult& r : results) {
+        all_ok = all_ok && r.ok;
+    }
+    for(const KernelResult& r : kernels) {
+        all_ok = all_ok && isKernelOk(r);
+    }
+    for(const DetectResult& r : detects) {
+        all_ok = all_ok && r.tiles_match;
+    }
+    // the library logs to stdout, results go to a file unless asked otherwise
+    if(out_path == "-") {
+        writeResults(std::cout, results, kernels, detects, duration_ms);
+    } else {
+        std::ofstream out(out_path);
+        writeResults(out, results, kernels, detects, duration_ms);
+        std::cerr << TAG << ": " << results.size() << " cases written to " << out_path << std::endl;
+    }
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,1373 @@
+#include "camera.h"
+#include "addon_data.h"
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+#define NAPI_EXPERIMENTAL
+#include <node_api.h>
+
+// setCameraEnabled() promises, settled together on the JS thread
+struct StartCtx {
+    Napi::ThreadSafeFunction tsfn;
+    // JS thread, pushed with the camera's start lock held
+    std::vector<Napi::Promise::Deferred> deferreds;
+    std::chrono::steady_clock::time_point issued;
+    uint32_t first_frame_ms;
+    uint32_t open_ms;
+    std::string error;
+};
+
+static void settleStartLater(StartCtx* ctx);
+
+enum class DataItemType { DataStats, DataFrame, DataPacket };
+
+class DataItem {
+public:
+    virtual ~DataItem() {
+        // dropped or never handed to JS, the promise settles without it
+        if(start != NULL) {
+            settleStartLater(start);
+        }
+    }
+    DataItemType type;
+    // when the capture thread queued it, and where to record the delivery time
+    std::chrono::steady_clock::time_point enqueued;
+    std::shared_ptr<PipelineMetrics> metrics;
+    // first frame after setCameraEnabled(), settles the promises on delivery
+    StartCtx* start{NULL};
+};
+
+class DataItemStats : public DataItem {
+public:
+    VideStats* stats;
+    uint32_t dropped_cnt;
+    uint32_t queue_depth;
+};
+
+class DataItemFrame : public DataItem {
+public:
+    ~DataItemFrame() {
+        av_buffer_unref(&frame);
+    }
+    uint32_t output_id;
+    // reference on the pooled slab, released by the ArrayBuffer finalizer
+    AVBufferRef* frame;
+    uint8_t* frame_data;
+    uint32_t frame_buf_size;
+    int width;
+    int height;
+    int format;
+    // planes as offsets into frame_data
+    int plane_cnt;
+    uint32_t plane_offset[4];
+    uint32_t plane_size[4];
+    int stride[4];
+    FrameTiming timing;
+    // 0 cols without change detection
+    ChangeMap change;
+};
+
+class DataItemPacket : public DataItem {
+public:
+    ~DataItemPacket() {
+        av_buffer_unref(&packet);
+    }
+    uint32_t output_id;
+    // reference on the encoder's packet buffer, released by the ArrayBuffer finalizer
+    AVBufferRef* packet;
+    uint8_t* packet_data;
+    uint32_t packet_size;
+    bool keyframe;
+    int64_t pts;
+    const char* codec;
+};
+
+// frames waiting for the JS thread, anything beyond is handled by the overflow policy
+static constexpr const int DELIVERY_QUEUE_DEPTH = 4;
+static constexpr const int DELIVERY_WAIT_MS = 100;
+
+// delivery queue and thread of one video output
+struct OutputCtx {
+    OutputCtx() : m_frames(DELIVERY_QUEUE_DEPTH) {};
+    std::thread nativeThread;
+    // set when the output is removed, the thread is detached then
+    std::atomic_bool toCancel{false};
+    // set by the thread when it ends and by removeOutput(), whichever comes
+    // second frees the context; outputs never removed are freed by the finalizer
+    std::atomic_bool released{false};
+    // carries H.264 packets, a dropped packet is followed by a keyframe request
+    bool encoded{false};
+
+    FrameQueue<DataItem*> m_frames;
+};
+
+// everything tied to one registered callback; replaced when
+// setStatusCb is called again and freed by the frame function's finalizer
+struct ThreadCtx {
+    ThreadCtx(Napi::Env env) {};
+    // frames, at most one call is queued on the JS side
+    Napi::ThreadSafeFunction tsfn;
+    // stats have their own function so they never wait behind frames
+    Napi::ThreadSafeFunction stats_tsfn;
+    std::atomic_bool toCancel{false};
+
+    // keyed by output id, guarded by the camera's delivery lock
+    std::map<uint32_t, OutputCtx*> outputs;
+};
+
+// a ring and the JS arrays it writes to, kept alive while it is attached
+struct SharedRingCtx {
+    std::shared_ptr<SharedFrameRing> ring;
+    Napi::ObjectReference header;
+    Napi::ObjectReference data;
+};
+
+// one takeSnapshot() promise, settled on the JS thread once encoded
+struct SnapshotCtx {
+    SnapshotCtx(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {};
+    Napi::ThreadSafeFunction tsfn;
+    Napi::Promise::Deferred deferred;
+    bool ok;
+    std::vector<uint8_t> data;
+    std::string error;
+};
+
+// getCapabilities() when the device has to be probed; holds the camera's
+// JS object so that the camera outlives the probe
+class CapabilitiesWorker : public Napi::AsyncWorker {
+public:
+    CapabilitiesWorker(Camera* camera, bool refresh)
+        : Napi::AsyncWorker(camera->Env(), "getCapabilities"),
+          m_camera(camera),
+          m_camera_ref(Napi::Persistent(camera->Value())),
+          m_deferred(Napi::Promise::Deferred::New(camera->Env())),
+          m_refresh(refresh) {}
+
+    Napi::Promise getPromise() {
+        return m_deferred.Promise();
+    }
+
+protected:
+    void Execute() override {
+        // no modes is not an error: not a device, or not probed on this platform
+        m_camera->getVideo()->getCapabilities(m_modes, m_refresh);
+    }
+
+    void OnOK() override {
+        m_deferred.Resolve(m_camera->capabilitiesToArray(Env(), m_modes));
+    }
+
+    void OnError(const Napi::Error& error) override {
+        m_deferred.Reject(error.Value());
+    }
+
+private:
+    Camera* m_camera;
+    Napi::ObjectReference m_camera_ref;
+    Napi::Promise::Deferred m_deferred;
+    bool m_refresh;
+    std::vector<CaptureMode> m_modes;
+};
+
+// stopRecording(): joins the writer and flushes the file off the JS thread
+class RecorderStopWorker : public Napi::AsyncWorker {
+public:
+    RecorderStopWorker(Napi::Env env, std::shared_ptr<FrameRecorder> recorder)
+        : Napi::AsyncWorker(env, "stopRecording"),
+          m_recorder(recorder),
+          m_deferred(Napi::Promise::Deferred::New(env)) {}
+
+    Napi::Promise getPromise() {
+        return m_deferred.Promise();
+    }
+
+protected:
+    void Execute() override {
+        m_recorder->stop();
+    }
+
+    void OnOK() override {
+        m_deferred.Resolve(Napi::Boolean::New(Env(), true));
+    }
+
+    void OnError(const Napi::Error& error) override {
+        m_deferred.Reject(error.Value());
+    }
+
+private:
+    std::shared_ptr<FrameRecorder> m_recorder;
+    Napi::Promise::Deferred m_deferred;
+};
+
+static void releaseFrameBuffer(napi_env env, void* data, void* hint) {
+    AVBufferRef* buf = (AVBufferRef*)hint;
+    av_buffer_unref(&buf);
+}
+
+static void fillPlanes(DataItemFrame* data, AVFrame* frame) {
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    data->plane_cnt = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    for(int i = 0; i < data->plane_cnt; i++) {
+        // chroma planes of subsampled formats are shorter
+        int height = frame->height;
+        if(i == 1 || i == 2) {
+            height = -((-frame->height) >> desc->log2_chroma_h);
+        }
+        data->plane_offset[i] = frame->data[i] - data->frame_data;
+        data->plane_size[i] = frame->linesize[i] * height;
+        data->stride[i] = frame->linesize[i];
+    }
+}
+
+static Napi::Object statsToObject(Napi::Env env, const VideStats& stats, uint32_t dropped_cnt, uint32_t queue_depth) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("type", std::string("stats"));
+    obj.Set("is_active", stats.is_active);
+    obj.Set("packet_cnt", stats.packet_cnt);
+    obj.Set("err_cnt", stats.err_cnt);
+    obj.Set("delivered_cnt", stats.delivered_cnt);
+    obj.Set("rate_dropped_cnt", stats.rate_dropped_cnt);
+    obj.Set("unchanged_cnt", stats.unchanged_cnt);
+    obj.Set("start_latency_ms", stats.start_latency_ms);
+    obj.Set("stop_latency_ms", stats.stop_latency_ms);
+    obj.Set("input_format", std::string(stats.input_format));
+    obj.Set("decode_avg_us", stats.decode_avg_us);
+    obj.Set("encode_packet_cnt", stats.encode_packet_cnt);
+    obj.Set("encode_err_cnt", stats.encode_err_cnt);
+    obj.Set("encode_bitrate", (double)stats.encode_bitrate);
+    obj.Set("capture_fps", stats.capture_fps);
+    obj.Set("delivered_fps", stats.delivered_fps);
+    obj.Set("pool_alloc_cnt", stats.pool_alloc_cnt);
+    obj.Set("pool_reuse_cnt", stats.pool_reuse_cnt);
+    obj.Set("record_frame_cnt", stats.record_frame_cnt);
+    obj.Set("record_dropped_cnt", stats.record_dropped_cnt);
+    obj.Set("record_bytes", (double)stats.record_bytes);
+    obj.Set("record_throughput", (double)stats.record_throughput);
+    obj.Set("shm_frame_cnt", stats.shm_frame_cnt);
+    obj.Set("dropped_cnt", dropped_cnt);
+    obj.Set("queue_depth", queue_depth);
+
+    Napi::Object stages = Napi::Object::New(env);
+    for(int i = 0; i < (int)Stage::Count; i++) {
+        const LatencySummary& summary = stats.stages[i];
+        Napi::Object stage = Napi::Object::New(env);
+        stage.Set("count", (double)summary.count);
+        stage.Set("avg_us", summary.avg_us);
+        stage.Set("p50_us", summary.p50_us);
+        stage.Set("p99_us", summary.p99_us);
+        stage.Set("max_us", summary.max_us);
+        stages.Set(PipelineMetrics::stageName((Stage)i), stage);
+    }
+    obj.Set("stages", stages);
+    return obj;
+}
+
+static void callbackStats(Napi::Env env, Napi::Function cb, DataItemStats* data) {
+    if(data == NULL) return;
+
+    cb.Call({statsToObject(env, *data->stats, data->dropped_cnt, data->queue_depth)});
+    delete data->stats;
+    delete data;
+}
+
+// time from the capture thread's push to the JS callback starting
+static void recordDelivery(DataItem* data) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - data->enqueued).count();
+    data->metrics->record(Stage::Deliver, us);
+}
+
+static void settleStart(Napi::Env env, Napi::Function cb, StartCtx* ctx);
+
+// the first frame reached JS, the time to it is taken here
+static void settleStartDelivered(Napi::Env env, DataItem* data) {
+    StartCtx* ctx = data->start;
+    data->start = NULL;
+    ctx->first_frame_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - ctx->issued).count();
+    Napi::ThreadSafeFunction tsfn = ctx->tsfn;
+    settleStart(env, Napi::Function(), ctx);
+    tsfn.Release();
+}
+
+static void callbackFrame(Napi::Env env, Napi::Function cb, DataItemFrame* data) {
+    if(data == NULL) return;
+
+    data->timing.dispatch_us = FrameTiming::nowUs();
+    recordDelivery(data);
+    if(data->start != NULL) {
+        settleStartDelivered(env, data);
+    }
+    napi_value arrayBuffer;
+    // hand the slab to JS without copying, the finalizer returns it to the pool
+    napi_status status = napi_create_external_arraybuffer(env,
+                                                          data->frame_data,
+                                                          data->frame_buf_size,
+                                                          releaseFrameBuffer,
+                                                          data->frame,
+                                                          &arrayBuffer);
+    if(status == napi_ok) {
+        data->frame = NULL;
+    } else {
+        // runtimes with the V8 memory cage (Electron >= 21) refuse external buffers
+        void* arrayBufferData = NULL;
+        napi_create_arraybuffer(env, data->frame_buf_size, &arrayBufferData, &arrayBuffer);
+        memcpy(arrayBufferData, data->frame_data, data->frame_buf_size);
+    }
+
+    Napi::ArrayBuffer buffer(env, arrayBuffer);
+    Napi::Array planes = Napi::Array::New(env, data->plane_cnt);
+    Napi::Array strides = Napi::Array::New(env, data->plane_cnt);
+    for(int i = 0; i < data->plane_cnt; i++) {
+        planes.Set(i, Napi::Uint8Array::New(env, data->plane_size[i], buffer, data->plane_offset[i]));
+        strides.Set(i, data->stride[i]);
+    }
+
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("type", std::string("frame"));
+    obj.Set("output", data->output_id);
+    obj.Set("data", arrayBuffer);
+    obj.Set("width", data->width);
+    obj.Set("height", data->height);
+    obj.Set("format", std::string(av_get_pix_fmt_name((AVPixelFormat)data->format)));
+    obj.Set("planes", planes);
+    obj.Set("strides", strides);
+    // device timestamp and steady clock times in microseconds, see FrameTiming
+    const FrameTiming& timing = data->timing;
+    obj.Set("seq", (double)timing.seq);
+    obj.Set("pts", timing.pts_us != AV_NOPTS_VALUE ? Napi::Number::New(env, (double)timing.pts_us) : env.Null());
+    obj.Set("captureUs", (double)timing.capture_us);
+    obj.Set("convertedUs", (double)timing.convert_us);
+    obj.Set("enqueuedUs", (double)timing.enqueue_us);
+    obj.Set("dispatchedUs", (double)timing.dispatch_us);
+    if(data->change.cols > 0) {
+        const ChangeMap& map = data->change;
+        Napi::Object change = Napi::Object::New(env);
+        change.Set("cols", map.cols);
+        change.Set("rows", map.rows);
+        change.Set("changed", map.changed_cnt);
+        // tile row * cols + col is bit i & 7 of byte i >> 3
+        Napi::Uint8Array tiles = Napi::Uint8Array::New(env, map.bits.size());
+        memcpy(tiles.Data(), map.bits.data(), map.bits.size());
+        change.Set("tiles", tiles);
+        obj.Set("change", change);
+    } else {
+        obj.Set("change", env.Null());
+    }
+    cb.Call({obj});
+    delete data;
+}
+
+static void callbackPacket(Napi::Env env, Napi::Function cb, DataItemPacket* data) {
+    if(data == NULL) return;
+
+    recordDelivery(data);
+    if(data->start != NULL) {
+        settleStartDelivered(env, data);
+    }
+    napi_value arrayBuffer;
+    napi_status status = napi_create_external_arraybuffer(env,
+                                                          data->packet_data,
+                                                          data->packet_size,
+                                                          releaseFrameBuffer,
+                                                          data->packet,
+                                                          &arrayBuffer);
+    if(status == napi_ok) {
+        data->packet = NULL;
+    } else {
+        void* arrayBufferData = NULL;
+        napi_create_arraybuffer(env, data->packet_size, &arrayBufferData, &arrayBuffer);
+        memcpy(arrayBufferData, data->packet_data, data->packet_size);
+    }
+
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("type", std::string("packet"));
+    obj.Set("output", data->output_id);
+    obj.Set("codec", std::string(data->codec));
+    obj.Set("data", arrayBuffer);
+    obj.Set("keyframe", data->keyframe);
+    // microseconds since the encoder was opened
+    obj.Set("pts", (double)data->pts);
+    cb.Call({obj});
+    delete data;
+}
+
+static void callbackItem(Napi::Env env, Napi::Function cb, DataItem* data) {
+    if(data == NULL) return;
+
+    if(data->type == DataItemType::DataPacket) {
+        callbackPacket(env, cb, (DataItemPacket*)data);
+    } else {
+        callbackFrame(env, cb, (DataItemFrame*)data);
+    }
+}
+
+static void settleStart(Napi::Env env, Napi::Function cb, StartCtx* ctx) {
+    if(ctx == NULL) return;
+
+    for(auto& deferred : ctx->deferreds) {
+        if(!ctx->error.empty()) {
+            deferred.Reject(Napi::Error::New(env, ctx->error).Value());
+            continue;
+        }
+        Napi::Object obj = Napi::Object::New(env);
+        obj.Set("timeToFirstFrameMs", ctx->first_frame_ms);
+        obj.Set("openMs", ctx->open_ms);
+        deferred.Resolve(obj);
+    }
+    delete ctx;
+}
+
+static void settleStartLater(StartCtx* ctx) {
+    if(ctx->error.empty()) {
+        ctx->first_frame_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - ctx->issued).count();
+    }
+    // the callback frees ctx, possibly before the call returns
+    Napi::ThreadSafeFunction tsfn = ctx->tsfn;
+    if(tsfn.BlockingCall(ctx, settleStart) != napi_ok) {
+        delete ctx;
+    }
+    tsfn.Release();
+}
+
+// a frame pushed out of a delivery queue hands the pending promises to the
+// one replacing it; pushed is not queued yet while the queue drops
+static void passStart(DataItem* dropped, DataItem* pushed) {
+    if(dropped != pushed && dropped->start != NULL && pushed->start == NULL) {
+        pushed->start = dropped->start;
+        dropped->start = NULL;
+    }
+}
+
+static void settleSnapshot(Napi::Env env, Napi::Function cb, SnapshotCtx* ctx) {
+    if(ctx == NULL) return;
+
+    if(ctx->ok) {
+        ctx->deferred.Resolve(Napi::Buffer<uint8_t>::Copy(env, ctx->data.data(), ctx->data.size()));
+    } else {
+        ctx->deferred.Reject(Napi::Error::New(env, ctx->error).Value());
+    }
+    delete ctx;
+}
+
+static void procOutputThread(ThreadCtx* threadCtx, OutputCtx* ctx, bool is_default) {
+    while(!threadCtx->toCancel && !ctx->toCancel) {
+        DataItem* data_item = NULL;
+        if(!ctx->m_frames.waitPop(data_item, std::chrono::milliseconds(DELIVERY_WAIT_MS))) {
+            continue;
+        }
+        // blocks while the previous frame is still queued for JS,
+        // so any backlog builds up in m_frames where the policy applies
+        napi_status status = threadCtx->tsfn.BlockingCall(data_item, callbackItem);
+        if (status != napi_ok) {
+            // the slab goes back to the pool
+            delete data_item;
+            break;
+        }
+    }
+    DataItem* data_item = NULL;
+    while(ctx->m_frames.waitPop(data_item, std::chrono::milliseconds(0))) {
+        delete data_item;
+    }
+    threadCtx->tsfn.Release();
+    if(is_default) {
+        threadCtx->stats_tsfn.Release();
+    }
+    // the loop may end on its own (callback replaced, failed call) before
+    // the output is removed
+    if(ctx->released.exchange(true)) {
+        delete ctx;
+    }
+}
+
+Camera::Camera(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Camera>(info) {
+    m_delivery = NULL;
+    m_delivery_policy = OverflowPolicy::LatestFrame;
+    m_start = NULL;
+    m_start_pending = false;
+    m_video = new Video();
+    // new Camera("/dev/video2") or new Camera({device: "/dev/video2"})
+    if(info.Length() > 0 && info[0].IsString()) {
+        m_video->setDevice(info[0].As<Napi::String>().Utf8Value());
+    } else if(info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object options = info[0].As<Napi::Object>();
+        if(options.Has("device")) {
+            m_video->setDevice(options.Get("device").As<Napi::String>().Utf8Value());
+        }
+    }
+    m_video->setStatusCallBack([this](VideStats stats) {
+        onStats(stats);
+    });
+    m_video->setFrameCallBack([this](uint32_t output_id, AVFrame* frame, uint32_t bufSize, const FrameTiming& timing,
+                                     const ChangeMap* change) {
+        onFrame(output_id, frame, bufSize, timing, change);
+    });
+    m_video->setPacketCallBack([this](uint32_t output_id, AVPacket* packet) {
+        onPacket(output_id, packet);
+    });
+    m_video->setOpenCallBack([this](bool opened) {
+        if(!opened) {
+            finishStart("camera open failed");
+        }
+    });
+}
+
+Camera::~Camera() {
+    finishStart("camera closed");
+    // joins the capture and dispatcher threads, no callback comes after this
+    delete m_video;
+    while(!m_rings.empty()) {
+        clearSharedRing(m_rings.begin()->first);
+    }
+    std::lock_guard<std::mutex> lk(m_delivery_lock);
+    stopDelivery();
+}
+
+Napi::Function Camera::Init(Napi::Env env) {
+    Napi::Function func = DefineClass(env, "Camera", {
+        InstanceMethod("setStatusCb", &Camera::SetStatusCb),
+        InstanceMethod("setCameraEnabled", &Camera::StartVideo),
+        InstanceMethod("setCameraDisable", &Camera::StopVideo),
+        InstanceMethod("prewarm", &Camera::Prewarm),
+        InstanceMethod("setDimention", &Camera::SetDimention),
+        InstanceMethod("setDeliveryPolicy", &Camera::SetDeliveryPolicy),
+        InstanceMethod("setOutputFormat", &Camera::SetOutputFormat),
+        InstanceMethod("setScaleThreads", &Camera::SetScaleThreads),
+        InstanceMethod("setInputFormat", &Camera::SetInputFormat),
+        InstanceMethod("setTargetFps", &Camera::SetTargetFps),
+        InstanceMethod("setChangeDetection", &Camera::SetChangeDetection),
+        InstanceMethod("takeSnapshot", &Camera::TakeSnapshot),
+        InstanceMethod("setSnapshotResolution", &Camera::SetSnapshotResolution),
+        InstanceMethod("addOutput", &Camera::AddOutput),
+        InstanceMethod("removeOutput", &Camera::RemoveOutput),
+        InstanceMethod("configureOutput", &Camera::ConfigureOutput),
+        InstanceMethod("requestKeyframe", &Camera::RequestKeyframe),
+        InstanceMethod("getStats", &Camera::GetStats),
+        InstanceMethod("getCapabilities", &Camera::GetCapabilities),
+        InstanceMethod("startRecording", &Camera::StartRecording),
+        InstanceMethod("stopRecording", &Camera::StopRecording),
+        InstanceMethod("startSharedMemory", &Camera::StartSharedMemory),
+        InstanceMethod("stopSharedMemory", &Camera::StopSharedMemory),
+        InstanceMethod("setSharedRing", &Camera::SetSharedRing),
+        InstanceMethod("clearSharedRing", &Camera::ClearSharedRing),
+    });
+    // per environment, worker threads load the module each with their own
+    env.GetInstanceData<AddonData>()->camera_constructor = Napi::Persistent(func);
+    return func;
+}
+
+Napi::Object Camera::NewInstance(Napi::Env env) {
+    return env.GetInstanceData<AddonData>()->camera_constructor.New({});
+}
+
+void Camera::onFrame(uint32_t output_id, AVFrame* frame, uint32_t bufSize, const FrameTiming& timing,
+                     const ChangeMap* change) {
+    if(frame == NULL) {
+        std::cout << "frameCallback: frame == null" << std::endl;
+        return;
+    }
+    auto ring = findSharedRing(output_id);
+    if(ring != NULL) {
+        // copied into the JS-owned ring, no callback for this output
+        ring->publish(frame);
+        if(m_start_pending) {
+            finishStart(NULL);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lk(m_delivery_lock);
+    OutputCtx* ctx = findDeliveryOutput(output_id);
+    if(ctx == NULL) {
+        lk.unlock();
+        // no callback gets the frame, it counts as delivered now
+        if(m_start_pending) {
+            finishStart(NULL);
+        }
+        return;
+    }
+    auto data = new DataItemFrame();
+    data->type = DataItemType::DataFrame;
+    data->enqueued = std::chrono::steady_clock::now();
+    data->metrics = m_video->getMetrics();
+    data->output_id = output_id;
+    data->frame = av_buffer_ref(frame->buf[0]);
+    data->frame_data = frame->buf[0]->data;
+    data->frame_buf_size = bufSize;
+    data->width = frame->width;
+    data->height = frame->height;
+    data->format = frame->format;
+    fillPlanes(data, frame);
+    data->timing = timing;
+    data->timing.enqueue_us = FrameTiming::toUs(data->enqueued);
+    data->change.cols = 0;
+    if(change != NULL) {
+        data->change = *change;
+    }
+    if(m_start_pending) {
+        data->start = takeStart();
+    }
+    ctx->m_frames.push(data, [data](DataItem* dropped) {
+        passStart(dropped, data);
+        delete dropped;
+    });
+}
+
+void Camera::onPacket(uint32_t output_id, AVPacket* packet) {
+    std::unique_lock<std::mutex> lk(m_delivery_lock);
+    OutputCtx* ctx = findDeliveryOutput(output_id);
+    if(ctx == NULL) {
+        lk.unlock();
+        if(m_start_pending) {
+            finishStart(NULL);
+        }
+        return;
+    }
+    if(!ctx->encoded) {
+        // a mailbox would throw away most of the stream
+        ctx->encoded = true;
+        ctx->m_frames.setPolicy(OverflowPolicy::DropOldest);
+    }
+    auto data = new DataItemPacket();
+    data->type = DataItemType::DataPacket;
+    data->enqueued = std::chrono::steady_clock::now();
+    data->metrics = m_video->getMetrics();
+    data->output_id = output_id;
+    data->packet = av_buffer_ref(packet->buf);
+    data->packet_data = packet->data;
+    data->packet_size = packet->size;
+    data->keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+    data->pts = packet->pts;
+    data->codec = "h264";
+    if(data->packet == NULL) {
+        delete data;
+        return;
+    }
+    if(m_start_pending) {
+        data->start = takeStart();
+    }
+    size_t dropped_cnt = ctx->m_frames.push(data, [data](DataItem* dropped) {
+        passStart(dropped, data);
+        delete dropped;
+    });
+    if(dropped_cnt > 0) {
+        // the decoder on the other side cannot continue without the lost packets
+        m_video->requestKeyframe(output_id);
+    }
+}
+
+void Camera::onStats(VideStats stats) {
+    std::lock_guard<std::mutex> lk(m_delivery_lock);
+    if(m_delivery == NULL) {
+        return;
+    }
+    auto data = new DataItemStats();
+    data->type = DataItemType::DataStats;
+    data->stats = new VideStats(stats);
+    getDeliveryCounters(data->dropped_cnt, data->queue_depth);
+    if(m_delivery->stats_tsfn.NonBlockingCall(data, callbackStats) != napi_ok) {
+        delete data->stats;
+        delete data;
+    }
+}
+
+OutputCtx* Camera::findDeliveryOutput(uint32_t output_id) {
+    if(m_delivery == NULL) {
+        return NULL;
+    }
+    auto it = m_delivery->outputs.find(output_id);
+    return it != m_delivery->outputs.end() ? it->second : NULL;
+}
+
+void Camera::getDeliveryCounters(uint32_t& dropped_cnt, uint32_t& queue_depth) {
+    dropped_cnt = 0;
+    queue_depth = 0;
+    if(m_delivery == NULL) {
+        return;
+    }
+    for(auto& output : m_delivery->outputs) {
+        dropped_cnt += output.second->m_frames.getDroppedCount();
+        queue_depth += output.second->m_frames.getDepth();
+    }
+}
+
+void Camera::startOutput(uint32_t id) {
+    bool is_default = id == Video::DEFAULT_OUTPUT_ID;
+    auto ctx = new OutputCtx();
+    ctx->m_frames.setPolicy(m_delivery_policy);
+    if(!is_default) {
+        // the default output runs on the count the function was created with
+        m_delivery->tsfn.Acquire();
+    }
+    ctx->nativeThread = std::thread(procOutputThread, m_delivery, ctx, is_default);
+    m_delivery->outputs[id] = ctx;
+}
+
+void Camera::stopDelivery() {
+    if(m_delivery == NULL) {
+        return;
+    }
+    // the threads wind down on their own, the finalizer joins them
+    m_delivery->toCancel = true;
+    m_delivery = NULL;
+}
+
+Napi::Value Camera::SetStatusCb(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if(info.Length() < 1 || !info[0].IsFunction()) {
+        std::cout << "Command: setStatusCb missed arguments\n";
+        return Napi::Boolean::New(env, false);
+    }
+    auto delivery = new ThreadCtx(env);
+    delivery->tsfn = Napi::ThreadSafeFunction::New(
+                            env,
+                            info[0].As<Napi::Function>(),
+                            "CallbackMethod",
+                            1, 1 ,
+                            delivery,
+        []( Napi::Env, void *finalizeData, ThreadCtx *context ) {
+            std::cout << "Thread cleanup-start";
+            for(auto& output : context->outputs) {
+                output.second->nativeThread.join();
+                delete output.second;
+            }
+            delete context;
+            std::cout << "Thread cleanup-end";
+        },
+        (void*)nullptr
+    );
+    delivery->stats_tsfn = Napi::ThreadSafeFunction::New(
+                            env,
+                            info[0].As<Napi::Function>(),
+                            "StatsCallbackMethod",
+                            0, 1);
+
+    std::lock_guard<std::mutex> lk(m_delivery_lock);
+    // a callback registered before is replaced, its threads are released
+    stopDelivery();
+    m_delivery = delivery;
+    for(uint32_t id : m_video->getOutputIds()) {
+        startOutput(id);
+    }
+    return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Camera::StartVideo(const Napi::CallbackInfo& info) {
+    std::cout << "Command: startCamera\n";
+    Napi::Env env = info.Env();
+    // resolves on the next frame with the time it took, rejects when the device does not open
+    auto deferred = Napi::Promise::Deferred::New(env);
+    {
+        std::lock_guard<std::mutex> lk(m_start_lock);
+        if(m_start == NULL) {
+            m_start = new StartCtx();
+            m_start->issued = std::chrono::steady_clock::now();
+            m_start->tsfn = Napi::ThreadSafeFunction::New(
+                        env,
+                        Napi::Function::New(env, [](const Napi::CallbackInfo&) {}),
+                        "StartMethod",
+                        0, 1);
+            m_start_pending = true;
+        }
+        m_start->deferreds.push_back(deferred);
+    }
+    if(!m_video->isStarted()) {
+        m_video->startVideoCamera();
+    }
+    return deferred.Promise();
+}
+
+Napi::Value Camera::StopVideo(const Napi::CallbackInfo& info) {
+    std::cout << "Command: stopCamera\n";
+    // also closes a prewarmed device
+    m_video->stopVideo();
+    finishStart("camera stopped");
+    Napi::Env env = info.Env();
+    return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Camera::Prewarm(const Napi::CallbackInfo& info) {
+    std::cout << "Command: prewarm\n";
+    if(!m_video->isStarted()) {
+        m_video->prewarm();
+    }
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+StartCtx* Camera::takeStart() {
+    StartCtx* ctx = NULL;
+    {
+        std::lock_guard<std::mutex> lk(m_start_lock);
+        ctx = m_start;
+        m_start = NULL;
+        m_start_pending = false;
+    }
+    if(ctx != NULL) {
+        ctx->open_ms = m_video->getStats().start_latency_ms;
+    }
+    return ctx;
+}
+
+void Camera::finishStart(const char* error) {
+    StartCtx* ctx = takeStart();
+    if(ctx == NULL) {
+        return;
+    }
+    ctx->error = error != NULL ? error : "";
+    settleStartLater(ctx);
+}
+
+Napi::Value Camera::SetDimention(const Napi::CallbackInfo& info) {
+    // applied live, or on the next start when stopped
+    if(m_video == NULL) {
+        std::cout << "Command: setDimention -no camera!\n";
+    } else if(info.Length() == 2) {
+        int width = info[0].As<Napi::Value>().ToNumber();
+        int height = info[1].As<Napi::Value>().ToNumber();;
+        std::cout << "Command: setDimention: " << ",width=" << width << ",height=" << height << std::endl;
+        m_video->setResolution(width, height);
+    } else {
+        std::cout << "Command: setDimention missed arguments\n";
+    }
+    return Napi::Number::New(info.Env(), true);
+}
+
+Napi::Value Camera::SetDeliveryPolicy(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsString()) {
+        std::cout << "Command: setDeliveryPolicy missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::string policy = info[0].As<Napi::String>().Utf8Value();
+    if(policy == "latest") {
+        m_delivery_policy = OverflowPolicy::LatestFrame;
+    } else if(policy == "drop-oldest") {
+        m_delivery_policy = OverflowPolicy::DropOldest;
+    } else if(policy == "block") {
+        m_delivery_policy = OverflowPolicy::BlockProducer;
+    } else {
+        std::cout << "Command: setDeliveryPolicy unknown policy: " << policy << std::endl;
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::cout << "Command: setDeliveryPolicy: " << policy << std::endl;
+    std::lock_guard<std::mutex> lk(m_delivery_lock);
+    if(m_delivery != NULL) {
+        for(auto& output : m_delivery->outputs) {
+            if(!output.second->encoded) {
+                output.second->m_frames.setPolicy(m_delivery_policy);
+            }
+        }
+    }
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+static bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    if(name == "rgb32") {
+        format = OutputFormat::Rgb32;
+    } else if(name == "i420") {
+        format = OutputFormat::I420;
+    } else if(name == "nv12") {
+        format = OutputFormat::Nv12;
+    } else if(name == "native") {
+        format = OutputFormat::Native;
+    } else if(name == "rgba") {
+        format = OutputFormat::Rgba;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parseOrientation(const std::string& name, Orientation& orientation) {
+    if(name == "normal") {
+        orientation = Orientation::Normal;
+    } else if(name == "mirror") {
+        orientation = Orientation::Mirror;
+    } else if(name == "rotate90") {
+        orientation = Orientation::Rotate90;
+    } else if(name == "rotate180") {
+        orientation = Orientation::Rotate180;
+    } else if(name == "rotate270") {
+        orientation = Orientation::Rotate270;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Napi::Value Camera::SetOutputFormat(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsString()) {
+        std::cout << "Command: setOutputFormat missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::string format = info[0].As<Napi::String>().Utf8Value();
+    OutputFormat output_format;
+    if(!parseOutputFormat(format, output_format)) {
+        std::cout << "Command: setOutputFormat unknown format: " << format << std::endl;
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::cout << "Command: setOutputFormat: " << format << std::endl;
+    m_video->setOutputFormat(output_format);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+// {width, height, format, fps, encode}, missing fields keep their current value.
+// encode is false or {bitrate (kbit/s), gop, preset}
+bool Camera::applyOutputOptions(uint32_t id, const Napi::Object& options) {
+    if(options.Has("encode")) {
+        Napi::Value encode = options.Get("encode");
+        if(encode.IsObject()) {
+            Napi::Object params = encode.As<Napi::Object>();
+            EncoderConfig config;
+            config.bitrate_kbps = params.Has("bitrate") ? params.Get("bitrate").As<Napi::Number>().Int32Value()
+                                                        : +DEFAULT_ENCODE_BITRATE_KBPS;
+            config.gop = params.Has("gop") ? params.Get("gop").As<Napi::Number>().Int32Value()
+                                           : +DEFAULT_ENCODE_GOP;
+            config.preset = params.Has("preset") ? params.Get("preset").As<Napi::String>().Utf8Value()
+                                                 : std::string(DEFAULT_ENCODE_PRESET);
+            config.fps = 0;
+            if(config.bitrate_kbps <= 0 || config.gop <= 0 || !m_video->setOutputEncoder(id, &config)) {
+                return false;
+            }
+        } else if(!m_video->setOutputEncoder(id, NULL)) {
+            return false;
+        }
+    }
+    if(options.Has("width") && options.Has("height")) {
+        int width = options.Get("width").As<Napi::Number>().Int32Value();
+        int height = options.Get("height").As<Napi::Number>().Int32Value();
+        if(width <= 0 || height <= 0 || !m_video->setOutputResolution(id, width, height)) {
+            return false;
+        }
+    }
+    if(options.Has("format")) {
+        OutputFormat format;
+        if(!parseOutputFormat(options.Get("format").As<Napi::String>().Utf8Value(), format)
+                || !m_video->setOutputFormat(id, format)) {
+            return false;
+        }
+    }
+    if(options.Has("fps")) {
+        if(!m_video->setOutputFps(id, options.Get("fps").As<Napi::Number>().Int32Value())) {
+            return false;
+        }
+    }
+    if(options.Has("orientation")) {
+        Orientation orientation;
+        if(!parseOrientation(options.Get("orientation").As<Napi::String>().Utf8Value(), orientation)
+                || !m_video->setOutputOrientation(id, orientation)) {
+            return false;
+        }
+    }
+    if(options.Has("crop")) {
+        // {x, y, width, height} of the captured frame, null for all of it
+        Napi::Value crop = options.Get("crop");
+        int x = 0, y = 0, width = 0, height = 0;
+        if(crop.IsObject()) {
+            Napi::Object rect = crop.As<Napi::Object>();
+            x = rect.Has("x") ? rect.Get("x").As<Napi::Number>().Int32Value() : 0;
+            y = rect.Has("y") ? rect.Get("y").As<Napi::Number>().Int32Value() : 0;
+            width = rect.Get("width").As<Napi::Number>().Int32Value();
+            height = rect.Get("height").As<Napi::Number>().Int32Value();
+            if(x < 0 || y < 0 || width <= 0 || height <= 0) {
+                return false;
+            }
+        }
+        if(!m_video->setOutputCrop(id, x, y, width, height)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Napi::Value Camera::AddOutput(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsObject()) {
+        std::cout << "Command: addOutput missed arguments\n";
+        return Napi::Number::New(info.Env(), -1);
+    }
+    Napi::Object options = info[0].As<Napi::Object>();
+    uint32_t id = 0;
+    {
+        // the queue exists before the first frame for the new id is produced
+        std::lock_guard<std::mutex> lk(m_delivery_lock);
+        id = m_video->addOutput(+DEFAULT_OUTPUT_WIDTH, +DEFAULT_OUTPUT_HEIGHT, OutputFormat::Rgb32, 0);
+        if(m_delivery != NULL) {
+            startOutput(id);
+        }
+    }
+    if(!applyOutputOptions(id, options)) {
+        std::cout << "Command: addOutput invalid options\n";
+    }
+    std::cout << "Command: addOutput: " << id << std::endl;
+    return Napi::Number::New(info.Env(), id);
+}
+
+Napi::Value Camera::RemoveOutput(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsNumber()) {
+        std::cout << "Command: removeOutput missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    uint32_t id = info[0].As<Napi::Number>().Uint32Value();
+    std::lock_guard<std::mutex> lk(m_delivery_lock);
+    if(!m_video->removeOutput(id)) {
+        std::cout << "Command: removeOutput unknown output: " << id << std::endl;
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    if(m_delivery != NULL) {
+        auto it = m_delivery->outputs.find(id);
+        if(it != m_delivery->outputs.end()) {
+            OutputCtx* ctx = it->second;
+            ctx->toCancel = true;
+            m_delivery->outputs.erase(it);
+            // it may be blocked on the JS thread, so it is not joined here
+            ctx->nativeThread.detach();
+            if(ctx->released.exchange(true)) {
+                // the thread is already gone
+                delete ctx;
+            }
+        }
+    }
+    std::cout << "Command: removeOutput: " << id << std::endl;
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::RequestKeyframe(const Napi::CallbackInfo& info) {
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    if(info.Length() > 0 && info[0].IsNumber()) {
+        id = info[0].As<Napi::Number>().Uint32Value();
+    }
+    return Napi::Boolean::New(info.Env(), m_video->requestKeyframe(id));
+}
+
+Napi::Value Camera::StartRecording(const Napi::CallbackInfo& info) {
+    // startRecording(path, {format: "y4m" | "raw", output: id})
+    if(info.Length() < 1 || !info[0].IsString()) {
+        std::cout << "Command: startRecording missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::string path = info[0].As<Napi::String>().Utf8Value();
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    RecordFormat format = RecordFormat::Y4m;
+    if(info.Length() > 1 && info[1].IsObject()) {
+        Napi::Object options = info[1].As<Napi::Object>();
+        if(options.Has("output")) {
+            id = options.Get("output").As<Napi::Number>().Uint32Value();
+        }
+        if(options.Has("format")) {
+            std::string name = options.Get("format").As<Napi::String>().Utf8Value();
+            if(name == "raw") {
+                format = RecordFormat::Raw;
+            } else if(name != "y4m") {
+                std::cout << "Command: startRecording unknown format: " << name << std::endl;
+                return Napi::Boolean::New(info.Env(), false);
+            }
+        }
+    }
+    bool res = m_video->startRecording(id, path, format);
+    std::cout << "Command: startRecording: " << path << (res ? "" : " failed") << std::endl;
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value Camera::StopRecording(const Napi::CallbackInfo& info) {
+    // stopRecording(id) -> Promise, true once the file is complete, false when not recording
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    if(info.Length() > 0 && info[0].IsNumber()) {
+        id = info[0].As<Napi::Number>().Uint32Value();
+    }
+    auto recorder = m_video->detachRecorder(id);
+    if(recorder == NULL) {
+        auto deferred = Napi::Promise::Deferred::New(info.Env());
+        deferred.Resolve(Napi::Boolean::New(info.Env(), false));
+        return deferred.Promise();
+    }
+    // draining the backlog to disk can take a while, it runs on a libuv worker
+    auto worker = new RecorderStopWorker(info.Env(), recorder);
+    worker->Queue();
+    return worker->getPromise();
+}
+
+Napi::Value Camera::StartSharedMemory(const Napi::CallbackInfo& info) {
+    // startSharedMemory(name, {output: id, slots: n}), read with new ShmReader(name)
+    if(info.Length() < 1 || !info[0].IsString()) {
+        std::cout << "Command: startSharedMemory missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::string name = info[0].As<Napi::String>().Utf8Value();
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    int slot_cnt = DEFAULT_SHM_SLOTS;
+    if(info.Length() > 1 && info[1].IsObject()) {
+        Napi::Object options = info[1].As<Napi::Object>();
+        if(options.Has("output")) {
+            id = options.Get("output").As<Napi::Number>().Uint32Value();
+        }
+        if(options.Has("slots")) {
+            slot_cnt = options.Get("slots").As<Napi::Number>().Int32Value();
+        }
+    }
+    bool res = m_video->startSharedMemory(id, name, slot_cnt);
+    std::cout << "Command: startSharedMemory: " << name << (res ? "" : " failed") << std::endl;
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value Camera::StopSharedMemory(const Napi::CallbackInfo& info) {
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    if(info.Length() > 0 && info[0].IsNumber()) {
+        id = info[0].As<Napi::Number>().Uint32Value();
+    }
+    return Napi::Boolean::New(info.Env(), m_video->stopSharedMemory(id));
+}
+
+std::shared_ptr<SharedFrameRing> Camera::findSharedRing(uint32_t output_id) {
+    std::lock_guard<std::mutex> lk(m_rings_lock);
+    auto it = m_rings.find(output_id);
+    return it != m_rings.end() ? it->second->ring : NULL;
+}
+
+void Camera::clearSharedRing(uint32_t output_id) {
+    SharedRingCtx* ctx = NULL;
+    {
+        std::lock_guard<std::mutex> lk(m_rings_lock);
+        auto it = m_rings.find(output_id);
+        if(it == m_rings.end()) {
+            return;
+        }
+        ctx = it->second;
+        m_rings.erase(it);
+    }
+    // a frame being copied finishes first, later ones are refused
+    ctx->ring->close();
+    delete ctx;
+}
+
+Napi::Value Camera::SetSharedRing(const Napi::CallbackInfo& info) {
+    // setSharedRing(header: Int32Array, data: Uint8Array, {output: id, slots: n}),
+    // both usually views on SharedArrayBuffers; see SharedFrameRing for the layout
+    auto env = info.Env();
+    if(info.Length() < 2 || !info[0].IsTypedArray() || !info[1].IsTypedArray()
+            || info[0].As<Napi::TypedArray>().TypedArrayType() != napi_int32_array
+            || info[1].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array) {
+        std::cout << "Command: setSharedRing needs an Int32Array and a Uint8Array\n";
+        return Napi::Boolean::New(env, false);
+    }
+    Napi::Int32Array header = info[0].As<Napi::Int32Array>();
+    Napi::Uint8Array data = info[1].As<Napi::Uint8Array>();
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    int slot_cnt = DEFAULT_SHARED_RING_SLOTS;
+    if(info.Length() > 2 && info[2].IsObject()) {
+        Napi::Object options = info[2].As<Napi::Object>();
+        if(options.Has("output")) {
+            id = options.Get("output").As<Napi::Number>().Uint32Value();
+        }
+        if(options.Has("slots")) {
+            slot_cnt = options.Get("slots").As<Napi::Number>().Int32Value();
+        }
+    }
+    // the old ring stops publishing first, the new one zeroes the header
+    // and the arrays may be the same ones
+    clearSharedRing(id);
+    auto ring = std::make_shared<SharedFrameRing>(header.Data(), header.ElementLength(),
+                                                  data.Data(), data.ElementLength(), slot_cnt);
+    if(!ring->isUsable()) {
+        return Napi::Boolean::New(env, false);
+    }
+    auto ctx = new SharedRingCtx();
+    ctx->ring = ring;
+    ctx->header = Napi::Persistent(header.As<Napi::Object>());
+    ctx->data = Napi::Persistent(data.As<Napi::Object>());
+    {
+        std::lock_guard<std::mutex> lk(m_rings_lock);
+        m_rings[id] = ctx;
+    }
+    std::cout << "Command: setSharedRing: output " << id << std::endl;
+    return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Camera::ClearSharedRing(const Napi::CallbackInfo& info) {
+    uint32_t id = Video::DEFAULT_OUTPUT_ID;
+    if(info.Length() > 0 && info[0].IsNumber()) {
+        id = info[0].As<Napi::Number>().Uint32Value();
+    }
+    clearSharedRing(id);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::ConfigureOutput(const Napi::CallbackInfo& info) {
+    if(info.Length() < 2 || !info[0].IsNumber() || !info[1].IsObject()) {
+        std::cout << "Command: configureOutput missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    uint32_t id = info[0].As<Napi::Number>().Uint32Value();
+    bool res = applyOutputOptions(id, info[1].As<Napi::Object>());
+    std::cout << "Command: configureOutput: " << id << (res ? "" : " failed") << std::endl;
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value Camera::SetInputFormat(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsString()) {
+        std::cout << "Command: setInputFormat missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::string format = info[0].As<Napi::String>().Utf8Value();
+    if(format == "auto") {
+        m_video->setInputFormat(InputFormat::Auto);
+    } else if(format == "raw") {
+        m_video->setInputFormat(InputFormat::Raw);
+    } else if(format == "mjpeg") {
+        m_video->setInputFormat(InputFormat::Mjpeg);
+    } else if(format == "h264") {
+        m_video->setInputFormat(InputFormat::H264);
+    } else {
+        std::cout << "Command: setInputFormat unknown format: " << format << std::endl;
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::cout << "Command: setInputFormat: " << format << std::endl;
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::SetTargetFps(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsNumber()) {
+        std::cout << "Command: setTargetFps missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    int fps = info[0].As<Napi::Number>().Int32Value();
+    std::cout << "Command: setTargetFps: " << fps << std::endl;
+    m_video->setTargetFps(fps);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::SetChangeDetection(const Napi::CallbackInfo& info) {
+    // setChangeDetection({threshold, minTiles, skip}), null or false turns it off
+    if(info.Length() < 1 || !info[0].IsObject()) {
+        std::cout << "Command: setChangeDetection: off" << std::endl;
+        m_video->setChangeDetection(NULL);
+        return Napi::Boolean::New(info.Env(), true);
+    }
+    Napi::Object options = info[0].As<Napi::Object>();
+    ChangeConfig config;
+    config.threshold = options.Has("threshold") ? options.Get("threshold").As<Napi::Number>().Int32Value()
+                                                : +DEFAULT_CHANGE_THRESHOLD;
+    config.min_tiles = options.Has("minTiles") ? options.Get("minTiles").As<Napi::Number>().Int32Value()
+                                               : +DEFAULT_CHANGE_MIN_TILES;
+    config.skip = options.Has("skip") ? options.Get("skip").ToBoolean().Value() : true;
+    if(config.threshold < 0 || config.min_tiles < 1) {
+        std::cout << "Command: setChangeDetection invalid options\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    std::cout << "Command: setChangeDetection: threshold " << config.threshold << ", min tiles " << config.min_tiles
+              << (config.skip ? ", skip" : "") << std::endl;
+    m_video->setChangeDetection(&config);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::TakeSnapshot(const Napi::CallbackInfo& info) {
+    // takeSnapshot({format: "jpeg" | "png", quality: 1..100}), resolves with a Buffer holding the file
+    Napi::Env env = info.Env();
+    SnapshotFormat format = SnapshotFormat::Jpeg;
+    int quality = SnapshotEncoder::DEFAULT_QUALITY;
+    if(info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object options = info[0].As<Napi::Object>();
+        if(options.Has("format")) {
+            std::string name = options.Get("format").As<Napi::String>().Utf8Value();
+            if(name == "png") {
+                format = SnapshotFormat::Png;
+            } else if(name != "jpeg" && name != "jpg") {
+                auto deferred = Napi::Promise::Deferred::New(env);
+                deferred.Reject(Napi::Error::New(env, "unknown snapshot format: " + name).Value());
+                return deferred.Promise();
+            }
+        }
+        if(options.Has("quality")) {
+            quality = options.Get("quality").As<Napi::Number>().Int32Value();
+        }
+    }
+    std::cout << "Command: takeSnapshot: " << (format == SnapshotFormat::Png ? "png" : "jpeg") << std::endl;
+    SnapshotCtx* ctx = new SnapshotCtx(env);
+    ctx->tsfn = Napi::ThreadSafeFunction::New(
+                env,
+                Napi::Function::New(env, [](const Napi::CallbackInfo&) {}),
+                "SnapshotMethod",
+                0, 1);
+    Napi::Promise promise = ctx->deferred.Promise();
+    // from a snapshot worker, or right here when the camera is not started
+    m_video->takeSnapshot(format, quality, [ctx](bool ok, std::vector<uint8_t>& data, const char* error) {
+        ctx->ok = ok;
+        ctx->data.swap(data);
+        ctx->error = error != NULL ? error : "";
+        // the callback frees ctx, possibly before the call returns
+        Napi::ThreadSafeFunction tsfn = ctx->tsfn;
+        if(tsfn.BlockingCall(ctx, settleSnapshot) != napi_ok) {
+            delete ctx;
+        }
+        tsfn.Release();
+    });
+    return promise;
+}
+
+Napi::Value Camera::SetSnapshotResolution(const Napi::CallbackInfo& info) {
+    if(info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber()) {
+        std::cout << "Command: setSnapshotResolution missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    int width = info[0].As<Napi::Number>().Int32Value();
+    int height = info[1].As<Napi::Number>().Int32Value();
+    std::cout << "Command: setSnapshotResolution: " << width << "x" << height << std::endl;
+    m_video->setSnapshotResolution(width, height);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::SetScaleThreads(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsNumber()) {
+        std::cout << "Command: setScaleThreads missed arguments\n";
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    int thread_cnt = info[0].As<Napi::Number>().Int32Value();
+    std::cout << "Command: setScaleThreads: " << thread_cnt << std::endl;
+    m_video->setScaleThreads(thread_cnt);
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value Camera::GetStats(const Napi::CallbackInfo& info) {
+    // same shape as the periodic stats callback, without waiting for it
+    VideStats stats = m_video->getStats();
+    uint32_t dropped_cnt = 0;
+    uint32_t queue_depth = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_delivery_lock);
+        getDeliveryCounters(dropped_cnt, queue_depth);
+    }
+    return statsToObject(info.Env(), stats, dropped_cnt, queue_depth);
+}
+
+Napi::Value Camera::GetCapabilities(const Napi::CallbackInfo& info) {
+    // getCapabilities(refresh) -> Promise: cached after the first probe, true probes again
+    Napi::Env env = info.Env();
+    bool refresh = info.Length() > 0 && info[0].IsBoolean() && info[0].As<Napi::Boolean>().Value();
+    std::vector<CaptureMode> modes;
+    if(!refresh && m_video->getCachedCapabilities(modes)) {
+        auto deferred = Napi::Promise::Deferred::New(env);
+        deferred.Resolve(capabilitiesToArray(env, modes));
+        return deferred.Promise();
+    }
+    // the probe opens the device, it runs on a libuv worker
+    auto worker = new CapabilitiesWorker(this, refresh);
+    worker->Queue();
+    return worker->getPromise();
+}
+
+Napi::Array Camera::capabilitiesToArray(Napi::Env env, const std::vector<CaptureMode>& modes) {
+    CaptureMode active;
+    bool has_active = m_video->getCaptureMode(active);
+    Napi::Array res = Napi::Array::New(env);
+    for(size_t i = 0; i < modes.size(); i++) {
+        const CaptureMode& mode = modes[i];
+        Napi::Object obj = Napi::Object::New(env);
+        obj.Set("format", mode.format);
+        obj.Set("compressed", mode.compressed);
+        obj.Set("width", mode.width);
+        obj.Set("height", mode.height);
+        obj.Set("minFps", mode.min_fps);
+        obj.Set("maxFps", mode.max_fps);
+        obj.Set("active", has_active && mode.format == active.format
+                && mode.width == active.width && mode.height == active.height);
+        res.Set((uint32_t)i, obj);
+    }
+    return res;
+}
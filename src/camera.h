@@ -0,0 +1,120 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <napi.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+#include "video.h"
+#include "frame_queue.h"
+#include "shared_frame_ring.h"
+
+struct OutputCtx;
+struct ThreadCtx;
+struct SharedRingCtx;
+struct StartCtx;
+
+// One capture device exposed to JS as `new Camera(device)`.
+// Every instance owns its Video (capture and dispatcher threads), its
+// delivery threads and thread-safe functions, so cameras running side by
+// side never share a lock.
+class Camera : public Napi::ObjectWrap<Camera>
+{
+public:
+    // the constructor is kept in env's AddonData, set before Init
+    static Napi::Function Init(Napi::Env env);
+    static Napi::Object NewInstance(Napi::Env env);
+
+    explicit Camera(const Napi::CallbackInfo& info);
+    ~Camera();
+
+    Napi::Value SetStatusCb(const Napi::CallbackInfo& info);
+    Napi::Value StartVideo(const Napi::CallbackInfo& info);
+    Napi::Value StopVideo(const Napi::CallbackInfo& info);
+    Napi::Value Prewarm(const Napi::CallbackInfo& info);
+    Napi::Value SetDimention(const Napi::CallbackInfo& info);
+    Napi::Value SetDeliveryPolicy(const Napi::CallbackInfo& info);
+    Napi::Value SetOutputFormat(const Napi::CallbackInfo& info);
+    Napi::Value SetScaleThreads(const Napi::CallbackInfo& info);
+    Napi::Value SetInputFormat(const Napi::CallbackInfo& info);
+    Napi::Value SetTargetFps(const Napi::CallbackInfo& info);
+    Napi::Value SetChangeDetection(const Napi::CallbackInfo& info);
+    Napi::Value TakeSnapshot(const Napi::CallbackInfo& info);
+    Napi::Value SetSnapshotResolution(const Napi::CallbackInfo& info);
+    Napi::Value AddOutput(const Napi::CallbackInfo& info);
+    Napi::Value RemoveOutput(const Napi::CallbackInfo& info);
+    Napi::Value ConfigureOutput(const Napi::CallbackInfo& info);
+    Napi::Value RequestKeyframe(const Napi::CallbackInfo& info);
+    Napi::Value GetStats(const Napi::CallbackInfo& info);
+    Napi::Value GetCapabilities(const Napi::CallbackInfo& info);
+    Napi::Value StartRecording(const Napi::CallbackInfo& info);
+    Napi::Value StopRecording(const Napi::CallbackInfo& info);
+    Napi::Value StartSharedMemory(const Napi::CallbackInfo& info);
+    Napi::Value StopSharedMemory(const Napi::CallbackInfo& info);
+    Napi::Value SetSharedRing(const Napi::CallbackInfo& info);
+    Napi::Value ClearSharedRing(const Napi::CallbackInfo& info);
+
+    // for the async workers, the calls they make are thread safe
+    Video* getVideo() { return m_video; }
+    // JS thread
+    Napi::Array capabilitiesToArray(Napi::Env env, const std::vector<CaptureMode>& modes);
+
+private:
+    // called from the capture and dispatcher threads
+    void onFrame(uint32_t output_id, AVFrame* frame, uint32_t bufSize, const FrameTiming& timing,
+                 const ChangeMap* change);
+    void onPacket(uint32_t output_id, AVPacket* packet);
+    void onStats(VideStats stats);
+    // the setCameraEnabled() promises, the first delivered frame carries
+    // them to the JS thread which settles them; NULL when none are waiting
+    StartCtx* takeStart();
+    // settles them right away, error NULL resolves them
+    void finishStart(const char* error);
+
+    // caller holds m_delivery_lock, NULL when nothing is delivered for the output
+    OutputCtx* findDeliveryOutput(uint32_t output_id);
+    // summed over all outputs, caller holds m_delivery_lock
+    void getDeliveryCounters(uint32_t& dropped_cnt, uint32_t& queue_depth);
+    // both with m_delivery_lock held
+    void startOutput(uint32_t id);
+    void stopDelivery();
+
+    bool applyOutputOptions(uint32_t id, const Napi::Object& options);
+    std::shared_ptr<SharedFrameRing> findSharedRing(uint32_t output_id);
+    // JS thread, waits for a publish in progress before the arrays are released
+    void clearSharedRing(uint32_t output_id);
+
+    Video* m_video;
+    // guards m_delivery and its outputs, taken once per delivered frame
+    std::mutex m_delivery_lock;
+    ThreadCtx* m_delivery;
+    OverflowPolicy m_delivery_policy;
+
+    // setCameraEnabled() promises waiting for the first frame; the flag
+    // spares the capture thread the lock on every frame
+    std::mutex m_start_lock;
+    StartCtx* m_start;
+    std::atomic_bool m_start_pending;
+
+    // outputs delivered through a JS-owned ring instead of callbacks, keyed by output id
+    std::mutex m_rings_lock;
+    std::map<uint32_t, SharedRingCtx*> m_rings;
+
+    // extra outputs until configured otherwise, thumbnail sized
+    static constexpr const int DEFAULT_OUTPUT_WIDTH = 320;
+    static constexpr const int DEFAULT_OUTPUT_HEIGHT = 180;
+    // a 720p call
+    static constexpr const int DEFAULT_ENCODE_BITRATE_KBPS = 2000;
+    static constexpr const int DEFAULT_ENCODE_GOP = 60;
+    static constexpr const char* const DEFAULT_ENCODE_PRESET = "veryfast";
+    // mean luma levels per tile; sensor noise mostly averages out below it in the 4x4 blocks
+    static constexpr const int DEFAULT_CHANGE_THRESHOLD = 4;
+    static constexpr const int DEFAULT_CHANGE_MIN_TILES = 1;
+    // a reader that holds a frame view has two more frame times before its slot is reused
+    static constexpr const int DEFAULT_SHM_SLOTS = 3;
+    static constexpr const int DEFAULT_SHARED_RING_SLOTS = 3;
+};
+
+#endif // CAMERA_H
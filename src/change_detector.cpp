@@ -0,0 +1,287 @@
+#include "change_detector.h"
+#include <algorithm>
+#include <string.h>
+
+// part of the x86-64 baseline, no runtime check needed
+#if defined(__SSE2__)
+#define CHANGE_DETECTOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static std::atomic<bool> s_simd_enabled(true);
+
+// rows point at DOWNSAMPLE source rows; writes the averages of dst_width
+// blocks, the last block repeats the last column when width falls short
+typedef void (*DownsampleFunc)(const uint8_t* const* rows, int step, int offset, int width,
+                               uint8_t* dst, int dst_width);
+// adds the SAD of each TILE wide segment of a row to sums, cols segments
+typedef void (*SadRowFunc)(const uint8_t* a, const uint8_t* b, int cols, uint32_t* sums);
+
+static void downsampleFrom(const uint8_t* const* rows, int step, int offset, int width,
+                           uint8_t* dst, int dst_x, int dst_width) {
+    const int n = ChangeDetector::DOWNSAMPLE;
+    for(int dx = dst_x; dx < dst_width; dx++) {
+        uint32_t sum = 0;
+        for(int r = 0; r < n; r++) {
+            for(int k = 0; k < n; k++) {
+                int x = std::min(dx * n + k, width - 1);
+                sum += rows[r][x * step + offset];
+            }
+        }
+        dst[dx] = (sum + n * n / 2) / (n * n);
+    }
+}
+
+static void downsampleScalar(const uint8_t* const* rows, int step, int offset, int width,
+                             uint8_t* dst, int dst_width) {
+    downsampleFrom(rows, step, offset, width, dst, 0, dst_width);
+}
+
+static void sadRowScalar(const uint8_t* a, const uint8_t* b, int cols, uint32_t* sums) {
+    for(int col = 0; col < cols; col++) {
+        uint32_t sad = 0;
+        for(int x = 0; x < ChangeDetector::TILE; x++) {
+            sad += a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+        }
+        sums[col] += sad;
+        a += ChangeDetector::TILE;
+        b += ChangeDetector::TILE;
+    }
+}
+
+#ifdef CHANGE_DETECTOR_SSE2
+static_assert(ChangeDetector::DOWNSAMPLE == 4 && ChangeDetector::TILE == 16, "kernels are written for 4x4 blocks and 16 byte tiles");
+
+// 16 frame pixels -> 4 averages per step: the rows are summed as 16 bit
+// words, pmaddwd adds neighbouring columns twice
+static void downsampleSse2(const uint8_t* const* rows, int step, int offset, int width,
+                           uint8_t* dst, int dst_width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(8);
+    const __m128i luma_mask = _mm_set1_epi16(0x00ff);
+    // whole blocks inside the row, the rest is done by the scalar loop
+    int full = std::min(dst_width, width / 4);
+    int dx = 0;
+    for(; dx + 4 <= full; dx += 4) {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for(int r = 0; r < 4; r++) {
+            if(step == 1) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(rows[r] + offset + dx * 4));
+                lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+                hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+            } else {
+                // packed 4:2:2, luma is the low (yuyv) or high (uyvy) byte of each word
+                __m128i v0 = _mm_loadu_si128((const __m128i*)(rows[r] + dx * 8));
+                __m128i v1 = _mm_loadu_si128((const __m128i*)(rows[r] + dx * 8 + 16));
+                if(offset == 0) {
+                    v0 = _mm_and_si128(v0, luma_mask);
+                    v1 = _mm_and_si128(v1, luma_mask);
+                } else {
+                    v0 = _mm_srli_epi16(v0, 8);
+                    v1 = _mm_srli_epi16(v1, 8);
+                }
+                lo = _mm_add_epi16(lo, v0);
+                hi = _mm_add_epi16(hi, v1);
+            }
+        }
+        // column pairs, then blocks of 4 columns, at most 16 * 255
+        __m128i pairs = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+        __m128i blocks = _mm_madd_epi16(pairs, ones);
+        blocks = _mm_srli_epi32(_mm_add_epi32(blocks, round), 4);
+        blocks = _mm_packs_epi32(blocks, blocks);
+        blocks = _mm_packus_epi16(blocks, blocks);
+        int32_t out = _mm_cvtsi128_si32(blocks);
+        memcpy(dst + dx, &out, 4);
+    }
+    downsampleFrom(rows, step, offset, width, dst, dx, dst_width);
+}
+
+static void sadRowSse2(const uint8_t* a, const uint8_t* b, int cols, uint32_t* sums) {
+    for(int col = 0; col < cols; col++) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + col * 16));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + col * 16));
+        // two 16 bit sums, one per 8 bytes
+        __m128i sad = _mm_sad_epu8(va, vb);
+        sums[col] += _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+    }
+}
+#endif
+
+ChangeDetector::ChangeDetector() {
+    m_enabled = false;
+    m_config = ChangeConfig();
+    m_reset = false;
+    m_has_ref = false;
+    m_src_width = 0;
+    m_src_height = 0;
+    m_src_format = AV_PIX_FMT_NONE;
+    m_width = 0;
+    m_height = 0;
+    m_stride = 0;
+    m_skipped_cnt = 0;
+}
+
+void ChangeDetector::setConfig(const ChangeConfig* config) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_enabled = config != NULL;
+    if(config != NULL) {
+        m_config = *config;
+    }
+}
+
+bool ChangeDetector::isEnabled() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_enabled;
+}
+
+void ChangeDetector::reset() {
+    m_reset = true;
+}
+
+uint32_t ChangeDetector::getSkippedCount() {
+    return m_skipped_cnt;
+}
+
+void ChangeDetector::resetCounters() {
+    m_skipped_cnt = 0;
+}
+
+void ChangeDetector::setSimdEnabled(bool enabled) {
+    s_simd_enabled = enabled;
+}
+
+bool ChangeDetector::hasSimd() {
+#ifdef CHANGE_DETECTOR_SSE2
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ChangeDetector::isSupported(AVPixelFormat format) {
+    auto desc = av_pix_fmt_desc_get(format);
+    if(desc == NULL || desc->nb_components == 0
+            || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM))) {
+        return false;
+    }
+    // 8 bit luma on its own plane, or every other byte of packed 4:2:2
+    const AVComponentDescriptor& luma = desc->comp[0];
+    return luma.plane == 0 && luma.depth == 8 && luma.shift == 0
+            && ((luma.step == 1 && luma.offset == 0) || (luma.step == 2 && luma.offset <= 1));
+}
+
+bool ChangeDetector::getLuma(const AVFrame* frame, Luma& luma) {
+    if(frame->width <= 0 || frame->height <= 0 || frame->data[0] == NULL
+            || !isSupported((AVPixelFormat)frame->format)) {
+        return false;
+    }
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    luma.data = frame->data[0];
+    luma.linesize = frame->linesize[0];
+    luma.step = desc->comp[0].step;
+    luma.offset = desc->comp[0].offset;
+    return true;
+}
+
+void ChangeDetector::downsample(const AVFrame* frame, const Luma& luma) {
+    DownsampleFunc func = downsampleScalar;
+#ifdef CHANGE_DETECTOR_SSE2
+    if(s_simd_enabled) {
+        func = downsampleSse2;
+    }
+#endif
+    const uint8_t* rows[DOWNSAMPLE];
+    for(int y = 0; y < m_height; y++) {
+        // the last block repeats the last row when the height falls short
+        for(int r = 0; r < DOWNSAMPLE; r++) {
+            int src_y = std::min(y * DOWNSAMPLE + r, frame->height - 1);
+            rows[r] = luma.data + (ptrdiff_t)src_y * luma.linesize;
+        }
+        func(rows, luma.step, luma.offset, frame->width, m_plane.data() + y * m_stride, m_width);
+    }
+}
+
+void ChangeDetector::compare(const ChangeConfig& config, ChangeMap& map) {
+    SadRowFunc func = sadRowScalar;
+#ifdef CHANGE_DETECTOR_SSE2
+    if(s_simd_enabled) {
+        func = sadRowSse2;
+    }
+#endif
+    for(int row = 0; row < map.rows; row++) {
+        int top = row * TILE;
+        int tile_height = std::min(+TILE, m_height - top);
+        std::fill(m_tile_sad.begin(), m_tile_sad.end(), 0);
+        for(int y = top; y < top + tile_height; y++) {
+            func(m_plane.data() + y * m_stride, m_ref.data() + y * m_stride, map.cols, m_tile_sad.data());
+        }
+        for(int col = 0; col < map.cols; col++) {
+            // the padding of the last column is 0 in both planes and adds nothing
+            int tile_width = std::min(+TILE, m_width - col * TILE);
+            if(m_tile_sad[col] > (uint32_t)std::max(0, config.threshold) * tile_width * tile_height) {
+                int index = row * map.cols + col;
+                map.bits[index >> 3] |= 1 << (index & 7);
+                map.changed_cnt++;
+            }
+        }
+    }
+}
+
+bool ChangeDetector::process(const AVFrame* frame, ChangeMap& map) {
+    map.cols = 0;
+    map.rows = 0;
+    map.changed_cnt = 0;
+    map.bits.clear();
+    ChangeConfig config;
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        if(!m_enabled) {
+            return true;
+        }
+        config = m_config;
+    }
+    Luma luma;
+    if(!getLuma(frame, luma)) {
+        return true;
+    }
+    if(m_reset.exchange(false) || frame->width != m_src_width || frame->height != m_src_height
+            || frame->format != m_src_format) {
+        m_src_width = frame->width;
+        m_src_height = frame->height;
+        m_src_format = frame->format;
+        m_width = (frame->width + DOWNSAMPLE - 1) / DOWNSAMPLE;
+        m_height = (frame->height + DOWNSAMPLE - 1) / DOWNSAMPLE;
+        m_stride = (m_width + TILE - 1) / TILE * TILE;
+        m_plane.assign((size_t)m_stride * m_height, 0);
+        m_ref.assign((size_t)m_stride * m_height, 0);
+        m_tile_sad.assign(m_stride / TILE, 0);
+        m_has_ref = false;
+    }
+    downsample(frame, luma);
+
+    map.cols = m_stride / TILE;
+    map.rows = (m_height + TILE - 1) / TILE;
+    map.bits.assign((map.cols * map.rows + 7) / 8, 0);
+    bool changed;
+    if(!m_has_ref) {
+        // nothing to compare with, all of it is new
+        for(int i = 0; i < map.cols * map.rows; i++) {
+            map.bits[i >> 3] |= 1 << (i & 7);
+        }
+        map.changed_cnt = map.cols * map.rows;
+        changed = true;
+    } else {
+        compare(config, map);
+        changed = map.changed_cnt >= std::max(1, config.min_tiles);
+    }
+    if(changed) {
+        m_plane.swap(m_ref);
+        m_has_ref = true;
+    } else if(config.skip) {
+        m_skipped_cnt++;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+}
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+struct ChangeConfig {
+    // mean absolute luma difference of a tile's pixels, in levels, above
+    // which the tile counts as changed
+    int threshold;
+    // changed tiles a frame needs to count as changed
+    int min_tiles;
+    // unchanged frames are dropped before any conversion; false only reports
+    bool skip;
+};
+
+// Tiles of a frame that changed, row by row. Tile i = row * cols + col is
+// bit i & 7 of bits[i >> 3]. Empty (0 cols) when the frame was not analysed.
+struct ChangeMap {
+    int cols;
+    int rows;
+    int changed_cnt;
+    std::vector<uint8_t> bits;
+};
+
+// Change detection on the decoded frame, before any output converts it.
+// The luma is box-filtered down by DOWNSAMPLE into a small plane, compared
+// in tiles of TILE x TILE of its pixels (64 x 64 of the frame) by the sum
+// of absolute differences against the last frame found changed, so a slow
+// drift still adds up. SSE2 psadbw where the compiler targets it, plain
+// C++ elsewhere, both give the same tiles.
+// setConfig() is called from the JS thread, process() from the capture thread.
+class ChangeDetector
+{
+public:
+    explicit ChangeDetector();
+
+    // NULL turns detection off
+    void setConfig(const ChangeConfig* config);
+    bool isEnabled();
+    // the next frame is compared with nothing and counts as changed
+    void reset();
+
+    // Fills map with the tiles of frame that changed and makes frame the
+    // reference when enough did. False when the frame is unchanged and
+    // skipping is on. Frames without an 8 bit luma (rgb, hardware) always
+    // pass with an empty map.
+    bool process(const AVFrame* frame, ChangeMap& map);
+
+    // frames dropped as unchanged
+    uint32_t getSkippedCount();
+    void resetCounters();
+
+    static bool isSupported(AVPixelFormat format);
+    // lets the benchmark compare the kernels, on by default
+    static void setSimdEnabled(bool enabled);
+    static bool hasSimd();
+
+    static constexpr const int DOWNSAMPLE = 4;
+    static constexpr const int TILE = 16;
+
+private:
+    // luma samples of row y are data + y * linesize + x * step + offset
+    struct Luma {
+        const uint8_t* data;
+        int linesize;
+        int step;
+        int offset;
+    };
+
+    static bool getLuma(const AVFrame* frame, Luma& luma);
+    void downsample(const AVFrame* frame, const Luma& luma);
+    void compare(const ChangeConfig& config, ChangeMap& map);
+
+    std::mutex      m_lock;
+    bool            m_enabled;
+    ChangeConfig    m_config;
+    std::atomic_bool m_reset;
+
+    // capture thread only: the plane of this frame and of the reference,
+    // m_stride wide with zero padding so that every tile is TILE wide
+    std::vector<uint8_t> m_plane;
+    std::vector<uint8_t> m_ref;
+    bool        m_has_ref;
+    int         m_src_width;
+    int         m_src_height;
+    int         m_src_format;
+    int         m_width;
+    int         m_height;
+    int         m_stride;
+    std::vector<uint32_t> m_tile_sad;
+
+    std::atomic<uint32_t> m_skipped_cnt;
+};
+
+#endif // CHANGE_DETECTOR_H
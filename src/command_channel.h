@@ -0,0 +1,40 @@
+#ifndef COMMAND_CHANNEL_H
+#define COMMAND_CHANNEL_H
+
+#include <queue>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// Thread-safe FIFO that wakes the consumer as soon as something is pushed,
+// so commands are picked up immediately instead of on the next poll tick.
+template <typename T>
+class CommandChannel
+{
+public:
+    void push(const T& item) {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_queue.push(item);
+        }
+        m_cv.notify_one();
+    }
+
+    // Blocks until an item is available or the timeout expires
+    bool waitPop(T& item, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lk(m_lock);
+        if(!m_cv.wait_for(lk, timeout, [&] { return !m_queue.empty(); })) {
+            return false;
+        }
+        item = m_queue.front();
+        m_queue.pop();
+        return true;
+    }
+
+private:
+    std::queue<T>           m_queue;
+    std::mutex              m_lock;
+    std::condition_variable m_cv;
+};
+
+#endif // COMMAND_CHANNEL_H
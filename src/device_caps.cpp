@@ -0,0 +1,296 @@
+#include "device_caps.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavdevice/avdevice.h"
+}
+
+#ifdef __linux__
+#include "v4l2_capture.h"
+#endif
+
+static constexpr const char* const CACHE_MAGIC = "webcam-caps 1";
+
+// probed modes by device id, loaded from the cache file on first use
+static std::mutex s_cache_lock;
+static bool s_cache_loaded = false;
+static std::map<std::string, std::vector<CaptureMode>> s_cache;
+
+// avfoundation only tells its modes through av_log; the lines logged for
+// the probing context are collected, every other one goes on to the
+// callback installed before. FFmpeg has no getter for it, so the one set
+// through DeviceCaps::setLogCallback() is it, the default one otherwise.
+typedef void (*LogCallback)(void*, int, const char*, va_list);
+static std::mutex s_probe_lock;
+static std::atomic<void*> s_probe_ctx(NULL);
+static std::vector<std::string> s_probe_lines;
+static std::atomic<LogCallback> s_log_callback(av_log_default_callback);
+
+static void probeLogCallback(void* avcl, int level, const char* fmt, va_list args) {
+    if(avcl == NULL || avcl != s_probe_ctx) {
+        s_log_callback.load()(avcl, level, fmt, args);
+        return;
+    }
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, args);
+    s_probe_lines.push_back(line);
+}
+
+static void loadCache(const std::string& path) {
+    // once per process, later probes only add to what was read
+    if(s_cache_loaded) {
+        return;
+    }
+    s_cache_loaded = true;
+    std::ifstream file(path);
+    std::string line;
+    if(!std::getline(file, line) || line != CACHE_MAGIC) {
+        return;
+    }
+    // id <tab> format <tab> compressed <tab> width <tab> height <tab> min fps <tab> max fps
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string id;
+        CaptureMode mode;
+        int compressed = 0;
+        if(!std::getline(fields, id, '\t') || !std::getline(fields, mode.format, '\t')
+                || !(fields >> compressed >> mode.width >> mode.height >> mode.min_fps >> mode.max_fps)) {
+            continue;
+        }
+        mode.compressed = compressed != 0;
+        s_cache[id].push_back(mode);
+    }
+}
+
+static void saveCache(const std::string& path) {
+    // written aside and renamed, a concurrent reader never sees half a file
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        // rates like 30.000030 have to come back exactly, avfoundation compares them to a few ppm
+        file.precision(std::numeric_limits<double>::max_digits10);
+        file << CACHE_MAGIC << "\n";
+        for(auto& entry : s_cache) {
+            for(auto& mode : entry.second) {
+                file << entry.first << "\t" << mode.format << "\t" << (mode.compressed ? 1 : 0)
+                     << "\t" << mode.width << "\t" << mode.height
+                     << "\t" << mode.min_fps << "\t" << mode.max_fps << "\n";
+            }
+        }
+        if(!file) {
+            return;
+        }
+    }
+    rename(tmp_path.c_str(), path.c_str());
+}
+
+// tabs and newlines would break the cache lines
+static std::string sanitize(std::string id) {
+    std::replace(id.begin(), id.end(), '\t', ' ');
+    std::replace(id.begin(), id.end(), '\n', ' ');
+    return id;
+}
+
+static int getFormatRank(const CaptureMode& mode, InputFormat preferred, bool large) {
+    bool mjpeg = mode.format == "mjpeg";
+    bool h264 = mode.format == "h264";
+    if(preferred == InputFormat::Auto) {
+        // same rule as the capture: raw up to VGA, compressed above
+        preferred = large ? InputFormat::Mjpeg : InputFormat::Raw;
+    }
+    switch(preferred) {
+    case InputFormat::Mjpeg:
+        return mjpeg ? 0 : h264 ? 1 : 2;
+    case InputFormat::H264:
+        return h264 ? 0 : mjpeg ? 1 : 2;
+    default:
+        return !mode.compressed ? 0 : mjpeg ? 1 : 2;
+    }
+}
+
+static bool findCached(const std::string& id, const std::string& path, std::vector<CaptureMode>& modes) {
+    std::lock_guard<std::mutex> lk(s_cache_lock);
+    loadCache(path);
+    auto it = s_cache.find(id);
+    if(it == s_cache.end() || it->second.empty()) {
+        return false;
+    }
+    modes = it->second;
+    return true;
+}
+
+bool DeviceCaps::get(const std::string& device, std::vector<CaptureMode>& modes, bool refresh) {
+    std::string id = getDeviceId(device);
+    std::string path = getCachePath();
+    if(!refresh && findCached(id, path, modes)) {
+        return true;
+    }
+    std::vector<CaptureMode> probed;
+    if(!probe(device, probed)) {
+        return false;
+    }
+    std::cout << TAG << ": " << id << " has " << probed.size() << " modes" << std::endl;
+    std::lock_guard<std::mutex> lk(s_cache_lock);
+    loadCache(path);
+    s_cache[id] = probed;
+    saveCache(path);
+    modes = probed;
+    return true;
+}
+
+bool DeviceCaps::getCached(const std::string& device, std::vector<CaptureMode>& modes) {
+    return findCached(getDeviceId(device), getCachePath(), modes);
+}
+
+bool DeviceCaps::pickMode(const std::vector<CaptureMode>& modes, int width, int height, int fps,
+                          InputFormat preferred, CaptureMode& mode) {
+    bool large = width * height > 640 * 480;
+    const CaptureMode* best = NULL;
+    int best_covers = 0, best_reaches = 0, best_rank = 0;
+    int64_t best_area = 0;
+    for(auto& candidate : modes) {
+        // no upscaling first, then the frame rate, then the least pixels to scale away
+        int covers = candidate.width >= width && candidate.height >= height;
+        int reaches = candidate.max_fps <= 0 || candidate.max_fps + 0.5 >= fps;
+        int64_t area = (int64_t)candidate.width * candidate.height;
+        int rank = getFormatRank(candidate, preferred, large);
+        bool better = best == NULL;
+        if(!better && covers != best_covers) {
+            better = covers > best_covers;
+        } else if(!better && reaches != best_reaches) {
+            better = reaches > best_reaches;
+        } else if(!better && area != best_area) {
+            better = covers ? area < best_area : area > best_area;
+        } else if(!better) {
+            better = rank < best_rank;
+        }
+        if(better) {
+            best = &candidate;
+            best_covers = covers;
+            best_reaches = reaches;
+            best_area = area;
+            best_rank = rank;
+        }
+    }
+    if(best == NULL) {
+        return false;
+    }
+    mode = *best;
+    return true;
+}
+
+std::string DeviceCaps::getDefaultDevice() {
+#ifdef __linux__
+    // lets a v4l2loopback or vivid node be picked without code changes
+    const char* env_device = getenv("V4L2_DEVICE");
+    return env_device != NULL ? env_device : "/dev/video0";
+#else
+    return "0";
+#endif
+}
+
+std::string DeviceCaps::getDeviceId(const std::string& device) {
+#ifdef __linux__
+    return sanitize(V4l2Capture::getDeviceId(device));
+#else
+    // avfoundation names devices by index or name, nothing more stable to go by
+    return sanitize("avfoundation:" + device);
+#endif
+}
+
+bool DeviceCaps::probe(const std::string& device, std::vector<CaptureMode>& modes) {
+#ifdef __linux__
+    return V4l2Capture::enumModes(device, modes);
+#elif __APPLE__
+    return probeAvfoundation(device, modes);
+#else
+    return false;
+#endif
+}
+
+void DeviceCaps::setLogCallback(void (*callback)(void*, int, const char*, va_list)) {
+    // waits for a running probe, which puts back the callback it saw
+    std::lock_guard<std::mutex> lk(s_probe_lock);
+    s_log_callback = callback != NULL ? callback : av_log_default_callback;
+    av_log_set_callback(s_log_callback.load());
+}
+
+bool DeviceCaps::probeAvfoundation(const std::string& device, std::vector<CaptureMode>& modes) {
+    const AVInputFormat* iformat = av_find_input_format("avfoundation");
+    if(iformat == NULL) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(s_probe_lock);
+    AVFormatContext* ctx = avformat_alloc_context();
+    AVDictionary* options = NULL;
+    // no device has this size, the open fails listing the modes it has
+    av_dict_set(&options, "video_size", "1x1", 0);
+    s_probe_lines.clear();
+    s_probe_ctx = ctx;
+    av_log_set_callback(probeLogCallback);
+    int err = avformat_open_input(&ctx, device.c_str(), (AVInputFormat*)iformat, &options);
+    av_log_set_callback(s_log_callback.load());
+    s_probe_ctx = NULL;
+    av_dict_free(&options);
+    if(err >= 0) {
+        avformat_close_input(&ctx);
+    }
+    for(auto& line : s_probe_lines) {
+        // "  1280x720@[1.000000 30.000000]fps"
+        CaptureMode mode;
+        if(sscanf(line.c_str(), " %dx%d@[%lf %lf]fps", &mode.width, &mode.height, &mode.min_fps, &mode.max_fps) != 4) {
+            continue;
+        }
+        mode.format = ANY_RAW_FORMAT;
+        mode.compressed = false;
+        // one line per device format, the OS converts between them
+        auto same = std::find_if(modes.begin(), modes.end(), [&](const CaptureMode& other) {
+            return other.width == mode.width && other.height == mode.height;
+        });
+        if(same == modes.end()) {
+            modes.push_back(mode);
+        } else {
+            same->min_fps = std::min(same->min_fps, mode.min_fps);
+            same->max_fps = std::max(same->max_fps, mode.max_fps);
+        }
+    }
+    s_probe_lines.clear();
+    return !modes.empty();
+}
+
+std::string DeviceCaps::getCachePath() {
+    const char* env_path = getenv("WEBCAM_CAPS_CACHE");
+    if(env_path != NULL) {
+        return env_path;
+    }
+    std::string dir;
+    const char* home = getenv("HOME");
+#ifdef __APPLE__
+    if(home != NULL) {
+        dir = std::string(home) + "/Library/Caches";
+    }
+#else
+    const char* xdg_cache = getenv("XDG_CACHE_HOME");
+    if(xdg_cache != NULL && xdg_cache[0] != '\0') {
+        dir = xdg_cache;
+    } else if(home != NULL) {
+        dir = std::string(home) + "/.cache";
+    }
+#endif
+    if(dir.empty()) {
+        dir = "/tmp";
+    }
+    mkdir(dir.c_str(), 0700);
+    return dir + "/webcam-capabilities.txt";
+}
@@ -0,0 +1,63 @@
+#ifndef DEVICE_CAPS_H
+#define DEVICE_CAPS_H
+
+#include <string>
+#include <vector>
+#include <stdarg.h>
+
+#include "input_format.h"
+
+// One size a device captures in, for one format
+struct CaptureMode {
+    // pixel format name for raw modes ("yuyv422"), codec name for compressed
+    // ones ("mjpeg"); "raw" where the OS converts into any raw format (avfoundation)
+    std::string format;
+    bool compressed;
+    int width;
+    int height;
+    // 0 when the device does not tell
+    double min_fps;
+    double max_fps;
+};
+
+// Capture modes of the devices, probed once and kept in memory and in a
+// small file in the user's cache directory, keyed by device id, so later
+// opens do not touch the device for it. V4L2 devices are enumerated with
+// VIDIOC_ENUM_FMT / ENUM_FRAMESIZES / ENUM_FRAMEINTERVALS, avfoundation
+// ones from the mode list it logs when asked for an unsupported size.
+class DeviceCaps
+{
+public:
+    // Modes of device, from the cache if it has them; refresh probes anyway.
+    // False when the device cannot be probed on this platform or is missing.
+    static bool get(const std::string& device, std::vector<CaptureMode>& modes, bool refresh = false);
+    // Only what is already cached, never opens the device
+    static bool getCached(const std::string& device, std::vector<CaptureMode>& modes);
+
+    // The mode needing the least scaling for a width x height output at fps:
+    // the smallest one covering the size, else the largest one; among those
+    // the ones reaching fps win, then the preferred format
+    static bool pickMode(const std::vector<CaptureMode>& modes, int width, int height, int fps,
+                         InputFormat preferred, CaptureMode& mode);
+
+    // the device opened when none is set
+    static std::string getDefaultDevice();
+
+    // av_log_set_callback() for code sharing the process with the probe:
+    // the avfoundation probe swaps in its own callback while it runs and
+    // puts this one back after, forwarding every other context's lines to it
+    static void setLogCallback(void (*callback)(void*, int, const char*, va_list));
+
+    static constexpr const char* const ANY_RAW_FORMAT = "raw";
+
+private:
+    static std::string getDeviceId(const std::string& device);
+    static bool probe(const std::string& device, std::vector<CaptureMode>& modes);
+    static bool probeAvfoundation(const std::string& device, std::vector<CaptureMode>& modes);
+
+    static std::string getCachePath();
+
+    static constexpr const char* const TAG = "DeviceCaps";
+};
+
+#endif // DEVICE_CAPS_H
@@ -0,0 +1,85 @@
+#include "frame_pool.h"
+#include <iostream>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+FramePool::FramePool() {
+    m_alloc_cnt = 0;
+    m_get_cnt = 0;
+}
+
+FramePool::~FramePool() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    for(auto& sized : m_pools) {
+        av_buffer_pool_uninit(&sized.pool);
+    }
+}
+
+AVBufferRef* FramePool::get(int size) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    auto it = m_pools.begin();
+    while(it != m_pools.end() && it->size != size) {
+        ++it;
+    }
+    SizedPool sized;
+    if(it != m_pools.end()) {
+        sized = *it;
+        m_pools.erase(it);
+    } else {
+        sized.size = size;
+        sized.pool = av_buffer_pool_init2(size, this, allocSlab, NULL);
+        if(sized.pool == NULL) {
+            return NULL;
+        }
+        if(m_pools.size() >= MAX_SIZES) {
+            av_buffer_pool_uninit(&m_pools.back().pool);
+            m_pools.pop_back();
+        }
+    }
+    m_pools.insert(m_pools.begin(), sized);
+    m_get_cnt++;
+    return av_buffer_pool_get(sized.pool);
+}
+
+uint32_t FramePool::getAllocCount() {
+    return m_alloc_cnt;
+}
+
+uint32_t FramePool::getReuseCount() {
+    uint32_t gets = m_get_cnt;
+    uint32_t allocs = m_alloc_cnt;
+    return gets > allocs ? gets - allocs : 0;
+}
+
+AVBufferRef* FramePool::allocSlab(void* opaque, int size) {
+    auto pool = (FramePool*)opaque;
+    void* data = NULL;
+#ifdef _WIN32
+    data = _aligned_malloc(size, SLAB_ALIGN);
+#else
+    if(posix_memalign(&data, SLAB_ALIGN, size) != 0) {
+        data = NULL;
+    }
+#endif
+    if(data == NULL) {
+        std::cout << TAG << ": slab allocation failed, size:" << size << std::endl;
+        return NULL;
+    }
+    AVBufferRef* buf = av_buffer_create((uint8_t*)data, size, freeSlab, NULL, 0);
+    if(buf == NULL) {
+        freeSlab(NULL, (uint8_t*)data);
+        return NULL;
+    }
+    pool->m_alloc_cnt++;
+    return buf;
+}
+
+void FramePool::freeSlab(void* opaque, uint8_t* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
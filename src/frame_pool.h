@@ -0,0 +1,53 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+extern "C" {
+#include "libavutil/buffer.h"
+}
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+// Pool of reusable, 64-byte aligned frame slabs.
+// Slabs are handed out as refcounted AVBufferRefs: whoever holds the last
+// reference (the capture thread, the JS garbage collector...) returns the
+// slab to the pool by calling av_buffer_unref().
+class FramePool
+{
+public:
+    explicit FramePool();
+    ~FramePool();
+
+    // Returns a slab of exactly size bytes, or NULL on allocation failure.
+    // Slabs of the last few sizes are kept, going back to one of them
+    // allocates nothing; older sizes are retired, outstanding slabs of
+    // those are freed once their last reference is dropped.
+    AVBufferRef* get(int size);
+
+    uint32_t getAllocCount();
+    uint32_t getReuseCount();
+
+private:
+    static AVBufferRef* allocSlab(void* opaque, int size);
+    static void freeSlab(void* opaque, uint8_t* data);
+
+    struct SizedPool {
+        int size;
+        AVBufferPool* pool;
+    };
+
+    // most recently used first
+    std::vector<SizedPool> m_pools;
+    std::mutex      m_lock;
+
+    std::atomic<uint32_t> m_alloc_cnt;
+    std::atomic<uint32_t> m_get_cnt;
+
+    static constexpr const size_t SLAB_ALIGN = 64;
+    static constexpr const size_t MAX_SIZES = 4;
+    static constexpr const char* const TAG = "FramePool";
+};
+
+#endif // FRAME_POOL_H
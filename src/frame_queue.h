@@ -0,0 +1,166 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+
+// What happens when the consumer falls behind and the queue is full
+enum class OverflowPolicy {
+    LatestFrame,    // mailbox, only the newest frame is kept
+    DropOldest,     // the oldest queued frame makes room for the new one
+    BlockProducer   // the producer waits for room, up to a timeout
+};
+
+// Bounded lock-free single-producer/single-consumer ring of trivially
+// copyable items (pointers). The producer may also pop, to evict the
+// oldest item: the slot is read before the tail is claimed with a CAS,
+// so a pop that loses the race simply retries.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : m_slots(new std::atomic<T>[capacity]), m_capacity(capacity), m_head(0), m_tail(0) {}
+
+    // producer only
+    bool tryPush(T item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head - m_tail.load(std::memory_order_acquire) >= m_capacity) {
+            return false;
+        }
+        m_slots[head % m_capacity].store(item, std::memory_order_relaxed);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer, or producer when evicting
+    bool tryPop(T& item) {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        while(tail != m_head.load(std::memory_order_acquire)) {
+            T value = m_slots[tail % m_capacity].load(std::memory_order_relaxed);
+            if(m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel)) {
+                item = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() {
+        return m_capacity;
+    }
+
+private:
+    static constexpr const size_t CACHE_LINE = 64;
+
+    std::unique_ptr<std::atomic<T>[]> m_slots;
+    const size_t m_capacity;
+    // padded apart so producer and consumer do not share a cache line;
+    // padding rather than alignas, heap objects are not over-aligned before C++17
+    char m_pad0[CACHE_LINE];
+    std::atomic<size_t> m_head;
+    char m_pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;
+    char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+};
+
+// SpscRing plus an overflow policy and parking for both sides.
+// The mutex is only taken to sleep and to wake the other side,
+// items never pass through it.
+template <typename T>
+class FrameQueue
+{
+public:
+    explicit FrameQueue(size_t capacity)
+        : m_ring(capacity), m_policy(OverflowPolicy::LatestFrame), m_dropped(0) {}
+
+    void setPolicy(OverflowPolicy policy) {
+        m_policy = policy;
+    }
+
+    // Producer side. Items that did not make it (evicted or rejected) are
+    // passed to release so the caller can free them; returns how many.
+    template <typename Release>
+    size_t push(T item, Release release) {
+        size_t dropped_cnt = 0;
+        OverflowPolicy policy = m_policy;
+        T old;
+        if(policy == OverflowPolicy::LatestFrame) {
+            // whatever is still queued is stale now
+            while(m_ring.tryPop(old)) {
+                release(old);
+                dropped_cnt++;
+            }
+        }
+        while(!m_ring.tryPush(item)) {
+            if(policy == OverflowPolicy::BlockProducer) {
+                std::unique_lock<std::mutex> lk(m_lock);
+                bool has_room = m_cv_not_full.wait_for(lk, std::chrono::milliseconds(+BLOCK_TIMEOUT_MS), [&] {
+                    return m_ring.size() < m_ring.capacity();
+                });
+                if(has_room) {
+                    continue;
+                }
+                // the consumer is stuck, do not stall capture forever
+                release(item);
+                dropped_cnt++;
+                break;
+            }
+            if(m_ring.tryPop(old)) {
+                release(old);
+                dropped_cnt++;
+            }
+        }
+        m_dropped += dropped_cnt;
+        wake(m_cv_not_empty);
+        return dropped_cnt;
+    }
+
+    // Consumer side, waits up to timeout for an item
+    bool waitPop(T& item, std::chrono::milliseconds timeout) {
+        if(!m_ring.tryPop(item)) {
+            std::unique_lock<std::mutex> lk(m_lock);
+            if(!m_cv_not_empty.wait_for(lk, timeout, [&] { return m_ring.tryPop(item); })) {
+                return false;
+            }
+        }
+        wake(m_cv_not_full);
+        return true;
+    }
+
+    uint32_t getDroppedCount() {
+        return m_dropped;
+    }
+
+    uint32_t getDepth() {
+        return m_ring.size();
+    }
+
+private:
+    void wake(std::condition_variable& cv) {
+        // an empty critical section orders us after a waiter's predicate check
+        { std::lock_guard<std::mutex> lk(m_lock); }
+        cv.notify_one();
+    }
+
+    SpscRing<T>                 m_ring;
+    std::atomic<OverflowPolicy> m_policy;
+    std::atomic<uint32_t>       m_dropped;
+    std::mutex                  m_lock;
+    std::condition_variable     m_cv_not_empty;
+    std::condition_variable     m_cv_not_full;
+
+    static constexpr const int BLOCK_TIMEOUT_MS = 1000;
+};
+
+#endif // FRAME_QUEUE_H
@@ -0,0 +1,316 @@
+#include "frame_recorder.h"
+
+#ifndef _WIN32
+#include <iostream>
+#include <stdlib.h>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+FrameRecorder::FrameRecorder() : m_backlog(BACKLOG_DEPTH) {
+    m_fd = -1;
+    m_direct = false;
+    m_format = RecordFormat::Y4m;
+    m_fps = 0;
+    m_header_written = false;
+    m_width = 0;
+    m_height = 0;
+    m_pix_fmt = AV_PIX_FMT_NONE;
+    m_block = NULL;
+    m_block_used = 0;
+    m_writer_thread = NULL;
+    m_running = false;
+    m_frame_cnt = 0;
+    m_error_cnt = 0;
+    m_bytes = 0;
+    // the disk is the slow side, keep the newest frames
+    m_backlog.setPolicy(OverflowPolicy::DropOldest);
+}
+
+FrameRecorder::~FrameRecorder() {
+    stop();
+    // pushed while stop() was draining
+    AVFrame* frame = NULL;
+    while(m_backlog.waitPop(frame, std::chrono::milliseconds(0))) {
+        av_frame_free(&frame);
+    }
+}
+
+bool FrameRecorder::start(const std::string& path, RecordFormat format, int fps) {
+    if(m_writer_thread != NULL) {
+        return false;
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    m_direct = false;
+#ifdef __linux__
+    m_fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    if(m_fd >= 0) {
+        m_direct = true;
+    } else if(errno == EINVAL) {
+        // tmpfs and some network file systems refuse O_DIRECT
+        m_fd = open(path.c_str(), flags, 0644);
+    }
+#else
+    m_fd = open(path.c_str(), flags, 0644);
+#endif
+    if(m_fd < 0) {
+        std::cout << TAG << ": cannot open " << path << ", errno:" << errno << std::endl;
+        return false;
+    }
+#ifdef __APPLE__
+    // no O_DIRECT, keep the recording out of the page cache instead
+    fcntl(m_fd, F_NOCACHE, 1);
+#endif
+    void* block = NULL;
+    if(posix_memalign(&block, BLOCK_ALIGN, BLOCK_SIZE) != 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_block = (uint8_t*)block;
+    m_block_used = 0;
+    m_path = path;
+    m_format = format;
+    m_fps = fps > 0 ? fps : 30;
+    m_header_written = false;
+    m_frame_cnt = 0;
+    m_error_cnt = 0;
+    m_bytes = 0;
+    m_running = true;
+    m_writer_thread = new std::thread(&FrameRecorder::procWriterThread, this);
+    std::cout << TAG << ": recording to " << path << (m_direct ? " (direct I/O)" : "") << std::endl;
+    return true;
+}
+
+void FrameRecorder::stop() {
+    if(m_writer_thread == NULL) {
+        return;
+    }
+    m_running = false;
+    m_writer_thread->join();
+    delete m_writer_thread;
+    m_writer_thread = NULL;
+
+    flush(true);
+    ::close(m_fd);
+    m_fd = -1;
+    free(m_block);
+    m_block = NULL;
+    std::cout << TAG << ": " << m_path << " closed, frames:" << m_frame_cnt
+              << " dropped:" << getDroppedCount() << " bytes:" << m_bytes << std::endl;
+}
+
+void FrameRecorder::push(const AVFrame* frame) {
+    if(!m_running) {
+        return;
+    }
+    // a reference on the pooled slab, the writer copies the pixels
+    AVFrame* ref = av_frame_alloc();
+    if(ref == NULL || av_frame_ref(ref, frame) < 0) {
+        av_frame_free(&ref);
+        m_error_cnt++;
+        return;
+    }
+    m_backlog.push(ref, [](AVFrame* dropped) {
+        av_frame_free(&dropped);
+    });
+}
+
+uint32_t FrameRecorder::getFrameCount() {
+    return m_frame_cnt;
+}
+
+uint32_t FrameRecorder::getDroppedCount() {
+    return m_backlog.getDroppedCount();
+}
+
+uint32_t FrameRecorder::getErrorCount() {
+    return m_error_cnt;
+}
+
+uint64_t FrameRecorder::getWrittenBytes() {
+    return m_bytes;
+}
+
+void FrameRecorder::procWriterThread() {
+    AVFrame* frame = NULL;
+    // once stopped, what is already queued is still written
+    while(m_running || m_backlog.getDepth() > 0) {
+        if(!m_backlog.waitPop(frame, std::chrono::milliseconds(+WRITER_WAIT_MS))) {
+            continue;
+        }
+        if(writeFrame(frame)) {
+            m_frame_cnt++;
+        } else {
+            m_error_cnt++;
+        }
+        av_frame_free(&frame);
+    }
+}
+
+bool FrameRecorder::writeFrame(const AVFrame* frame) {
+    if(!m_header_written) {
+        m_header_written = true;
+        if(!writeHeader(frame)) {
+            // the following frames are refused too, without a log line each
+            m_pix_fmt = AV_PIX_FMT_NONE;
+            return false;
+        }
+    }
+    if(frame->width != m_width || frame->height != m_height || frame->format != m_pix_fmt) {
+        // neither container can describe a change of size or layout
+        return false;
+    }
+    if(m_format == RecordFormat::Y4m && !append((const uint8_t*)"FRAME\n", 6)) {
+        return false;
+    }
+    // rows without their linesize padding
+    AVPixelFormat pix_fmt = (AVPixelFormat)frame->format;
+    auto desc = av_pix_fmt_desc_get(pix_fmt);
+    int plane_cnt = av_pix_fmt_count_planes(pix_fmt);
+    for(int i = 0; i < plane_cnt; i++) {
+        int row_size = av_image_get_linesize(pix_fmt, frame->width, i);
+        int rows = frame->height;
+        if(i == 1 || i == 2) {
+            rows = -((-frame->height) >> desc->log2_chroma_h);
+        }
+        const uint8_t* row = frame->data[i];
+        for(int y = 0; y < rows; y++) {
+            if(!append(row, row_size)) {
+                return false;
+            }
+            row += frame->linesize[i];
+        }
+    }
+    return true;
+}
+
+bool FrameRecorder::writeHeader(const AVFrame* frame) {
+    m_width = frame->width;
+    m_height = frame->height;
+    m_pix_fmt = frame->format;
+    if(m_format == RecordFormat::Raw) {
+        std::cout << TAG << ": raw " << av_get_pix_fmt_name((AVPixelFormat)m_pix_fmt)
+                  << " " << m_width << "x" << m_height << std::endl;
+        return true;
+    }
+    const char* colorspace = getY4mColorspace((AVPixelFormat)frame->format);
+    if(colorspace == NULL) {
+        std::cout << TAG << ": y4m cannot hold " << av_get_pix_fmt_name((AVPixelFormat)frame->format)
+                  << ", record an i420 output or use raw" << std::endl;
+        return false;
+    }
+    std::string header = "YUV4MPEG2 W" + std::to_string(m_width) + " H" + std::to_string(m_height)
+            + " F" + std::to_string(m_fps) + ":1 Ip A1:1 " + colorspace + "\n";
+    return append((const uint8_t*)header.data(), header.size());
+}
+
+bool FrameRecorder::append(const uint8_t* data, size_t size) {
+    while(size > 0) {
+        size_t chunk = std::min(size, BLOCK_SIZE - m_block_used);
+        memcpy(m_block + m_block_used, data, chunk);
+        m_block_used += chunk;
+        data += chunk;
+        size -= chunk;
+        if(m_block_used == BLOCK_SIZE && !flush(false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameRecorder::flush(bool final) {
+    if(m_block_used == 0) {
+        return true;
+    }
+#ifdef __linux__
+    if(final && m_direct && m_block_used % BLOCK_ALIGN != 0) {
+        // O_DIRECT only takes whole blocks, the tail goes through the page cache
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+        m_direct = false;
+    }
+#endif
+    const uint8_t* data = m_block;
+    size_t left = m_block_used;
+    while(left > 0) {
+        ssize_t written = write(m_fd, data, left);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << TAG << ": write failed, errno:" << errno << std::endl;
+            m_block_used = 0;
+            return false;
+        }
+        data += written;
+        left -= written;
+        m_bytes += written;
+    }
+    m_block_used = 0;
+    return true;
+}
+
+const char* FrameRecorder::getY4mColorspace(AVPixelFormat format) {
+    switch(format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        return "C420jpeg";
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+        return "C422";
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        return "C444";
+    case AV_PIX_FMT_GRAY8:
+        return "Cmono";
+    default:
+        return NULL;
+    }
+}
+
+#else // _WIN32
+
+// POSIX file I/O only, recording is not available on Windows
+#include <iostream>
+
+FrameRecorder::FrameRecorder() : m_backlog(BACKLOG_DEPTH) {
+    m_fd = -1;
+    m_writer_thread = NULL;
+    m_running = false;
+    m_frame_cnt = 0;
+    m_error_cnt = 0;
+    m_bytes = 0;
+}
+
+FrameRecorder::~FrameRecorder() {
+}
+
+bool FrameRecorder::start(const std::string& path, RecordFormat format, int fps) {
+    std::cout << TAG << ": recording is not supported on Windows" << std::endl;
+    return false;
+}
+
+void FrameRecorder::stop() {
+}
+
+void FrameRecorder::push(const AVFrame* frame) {
+}
+
+uint32_t FrameRecorder::getFrameCount() {
+    return 0;
+}
+
+uint32_t FrameRecorder::getDroppedCount() {
+    return 0;
+}
+
+uint32_t FrameRecorder::getErrorCount() {
+    return 0;
+}
+
+uint64_t FrameRecorder::getWrittenBytes() {
+    return 0;
+}
+#endif // _WIN32
@@ -0,0 +1,89 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+#include "frame_queue.h"
+
+// Container written by FrameRecorder
+enum class RecordFormat {
+    Y4m,    // YUV4MPEG2, planar yuv only: record an i420 output
+    Raw     // planes back to back without padding or header, any pixel format
+};
+
+// Records one output's frames to disk for replay.
+// push() runs on the capture thread and only takes a reference on the
+// frame; a writer thread packs the planes into large aligned blocks and
+// writes them with O_DIRECT on Linux (F_NOCACHE on macOS) when the file
+// system allows it. A backlog beyond BACKLOG_DEPTH frames drops the oldest
+// ones, the capture thread never waits on the disk. POSIX only, start()
+// fails on Windows.
+class FrameRecorder
+{
+public:
+    explicit FrameRecorder();
+    ~FrameRecorder();
+
+    // fps only goes into the Y4M header
+    bool start(const std::string& path, RecordFormat format, int fps);
+    // writes what is still queued, then closes the file
+    void stop();
+
+    // capture thread; frames must keep the size and format of the first one
+    void push(const AVFrame* frame);
+
+    uint32_t getFrameCount();
+    uint32_t getDroppedCount();
+    uint32_t getErrorCount();
+    uint64_t getWrittenBytes();
+
+private:
+    void procWriterThread();
+    bool writeFrame(const AVFrame* frame);
+    bool writeHeader(const AVFrame* frame);
+    bool append(const uint8_t* data, size_t size);
+    // final allows a tail that is not a multiple of the block alignment
+    bool flush(bool final);
+    static const char* getY4mColorspace(AVPixelFormat format);
+
+    std::string     m_path;
+    int             m_fd;
+    bool            m_direct;
+    RecordFormat    m_format;
+    int             m_fps;
+
+    // writer thread only
+    bool            m_header_written;
+    int             m_width;
+    int             m_height;
+    int             m_pix_fmt;
+    uint8_t*        m_block;
+    size_t          m_block_used;
+
+    std::thread*            m_writer_thread;
+    std::atomic_bool        m_running;
+    FrameQueue<AVFrame*>    m_backlog;
+
+    std::atomic<uint32_t>   m_frame_cnt;
+    std::atomic<uint32_t>   m_error_cnt;
+    std::atomic<uint64_t>   m_bytes;
+
+    // one write() per block, aligned for O_DIRECT
+    static constexpr const size_t BLOCK_SIZE = 4 << 20;
+    static constexpr const size_t BLOCK_ALIGN = 4096;
+    // about half a second of capture
+    static constexpr const int BACKLOG_DEPTH = 16;
+    static constexpr const int WRITER_WAIT_MS = 100;
+    static constexpr const char* const TAG = "FrameRecorder";
+};
+
+#endif // FRAME_RECORDER_H
@@ -0,0 +1,35 @@
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <chrono>
+#include <stdint.h>
+
+// Where a delivered frame comes from and when it passed each step. Times
+// are microseconds of steady_clock (CLOCK_MONOTONIC on Linux, the clock
+// behind process.hrtime), so they line up with other streams of the machine.
+struct FrameTiming {
+    // frames read from the device since the start, from 1; numbers an
+    // output skips are frames it did not get (fps gate, full queue)
+    uint64_t seq;
+    // device timestamp in microseconds of the device's clock (V4L2 buffers
+    // mostly use CLOCK_MONOTONIC), AV_NOPTS_VALUE when it has none
+    int64_t pts_us;
+    // read from the device, converted for the output, queued for JS, and
+    // picked up by the JS thread. The read is done when the device returned
+    // the buffer, before decoding, so capture_us to convert_us covers the
+    // decoder too.
+    int64_t capture_us;
+    int64_t convert_us;
+    int64_t enqueue_us;
+    int64_t dispatch_us;
+
+    static int64_t toUs(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+
+    static int64_t nowUs() {
+        return toUs(std::chrono::steady_clock::now());
+    }
+};
+
+#endif // FRAME_TIMING_H
@@ -0,0 +1,10 @@
+#ifndef INPUT_FORMAT_H
+#define INPUT_FORMAT_H
+
+// Capture format asked from the camera.
+// Auto prefers raw formats up to VGA and compressed ones above, where raw
+// usually cannot reach 30 fps over USB 2. Formats the device does not offer
+// fall back to the next best one.
+enum class InputFormat { Auto, Raw, Mjpeg, H264 };
+
+#endif // INPUT_FORMAT_H
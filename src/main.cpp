@@ -4,6 +4,7 @@
 #include <mutex>
 #include <iostream>
 #include <functional>
+#include <fstream>
 
 #include "video.h"
 #include <QImage>
@@ -13,7 +14,8 @@ enum class Command {
     StopCamera = 2,
     Enable_resolution_640x240 = 3,
     Enable_resolution_800x600 = 4,
-    Enable_resolution_1280x1024 = 5
+    Enable_resolution_1280x1024 = 5,
+    TakeSnapshot = 6
 };
 
 int main()
@@ -27,23 +29,11 @@ int main()
             << "pkt:" << stats.packet_cnt
             << "err:" << stats.err_cnt << std::endl;
     });
-    auto frameCallback = ([&](AVFrame* frame) {
+    auto frameCallback = ([&](uint32_t output_id, AVFrame* frame, uint32_t size, const FrameTiming& timing, const ChangeMap* change) {
         if(frame != NULL) {
-             QImage image(frame->width, frame->height, QImage::Format_RGB32);
-             int x, y;
-             int *src = (int*)frame->data[0];
-             for (y = 0; y < frame->height; y++) {
-                 for (x = 0; x < frame->width; x++) {
-                     image.setPixel(x, y, src[x] & 0x00ffffff);
-                 }
-                 src += frame->width;
-             }
-             image.save("/Users/khomin/Desktop/out.png");
-
-            // std::cout << "frameCallback: frame\n"
-            // << "width," << frame->width
-            // << "height" << frame->height
-            // << std::endl;
+            // the default output is rgb32, the pixels map straight onto a QImage
+            QImage image(frame->data[0], frame->width, frame->height, frame->linesize[0], QImage::Format_RGB32);
+            image.save("out.png");
         } else {
             std::cout << "frameCallback: frame == null" << std::endl;
         }
@@ -111,6 +101,20 @@ int main()
                     }
                 }
                 break;
+                case Command::TakeSnapshot: {
+                    std::cout << "Command: takeSnapshot\n";
+                    // encoded off the capture thread at the capture size, written from the worker
+                    video->takeSnapshot(SnapshotFormat::Jpeg, SnapshotEncoder::DEFAULT_QUALITY,
+                                        [](bool ok, std::vector<uint8_t>& data, const char* error) {
+                        if(!ok) {
+                            std::cout << "Command: takeSnapshot failed: " << error << std::endl;
+                            return;
+                        }
+                        std::ofstream("snapshot.jpg", std::ios::binary).write((const char*)data.data(), data.size());
+                        std::cout << "Command: takeSnapshot -done, " << data.size() << " bytes\n";
+                    });
+                }
+                break;
                 default:
                     std::cout << "Command: unknown\n";
                 break;
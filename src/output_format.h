@@ -0,0 +1,13 @@
+#ifndef OUTPUT_FORMAT_H
+#define OUTPUT_FORMAT_H
+
+// Pixel layout of the frames handed to the frame callback.
+// Rgb32 is AV_PIX_FMT_RGB32 (bgra bytes on little endian), Rgba rgba bytes.
+// Native keeps whatever the camera delivers (uyvy422, yuyv422, nv12...).
+enum class OutputFormat { Rgb32, I420, Nv12, Native, Rgba };
+
+// Turns the picture of an rgb output, rotations are clockwise and swap
+// the width and height of the delivered frames
+enum class Orientation { Normal, Mirror, Rotate90, Rotate180, Rotate270 };
+
+#endif // OUTPUT_FORMAT_H
@@ -0,0 +1,132 @@
+#ifndef PIPELINE_METRICS_H
+#define PIPELINE_METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+
+struct LatencySummary {
+    uint32_t count;
+    uint32_t avg_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+};
+
+// Fixed-bucket latency histogram in microseconds, recorded lock-free from
+// the hot path with relaxed atomics. Buckets are exponential with four
+// steps per power of two, so a percentile is off by less than 25%.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(uint32_t us) {
+        m_buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(us, std::memory_order_relaxed);
+        uint32_t max = m_max.load(std::memory_order_relaxed);
+        while(us > max && !m_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+    }
+
+    // Not an atomic snapshot, records racing with it may be half counted
+    LatencySummary summary() {
+        LatencySummary res;
+        res.count = m_count.load(std::memory_order_relaxed);
+        res.max_us = m_max.load(std::memory_order_relaxed);
+        res.avg_us = res.count > 0 ? m_sum.load(std::memory_order_relaxed) / res.count : 0;
+        res.p50_us = percentile(res.count, 50, res.max_us);
+        res.p99_us = percentile(res.count, 99, res.max_us);
+        return res;
+    }
+
+    void reset() {
+        for(int i = 0; i < BUCKET_CNT; i++) {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static int bucketOf(uint32_t us) {
+        if(us < SUB_BUCKETS) {
+            return us;
+        }
+        int msb = 0;
+        for(uint32_t v = us; v > 1; v >>= 1) {
+            msb++;
+        }
+        return (msb - 1) * SUB_BUCKETS + ((us >> (msb - 2)) & (SUB_BUCKETS - 1));
+    }
+
+    // largest value that lands in the bucket
+    static uint32_t bucketTop(int index) {
+        if(index < SUB_BUCKETS) {
+            return index;
+        }
+        int msb = index / SUB_BUCKETS + 1;
+        uint64_t next = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS + 1) << (msb - 2);
+        return next > UINT32_MAX ? UINT32_MAX : (uint32_t)(next - 1);
+    }
+
+    uint32_t percentile(uint32_t count, uint32_t pct, uint32_t max) {
+        if(count == 0) {
+            return 0;
+        }
+        uint64_t rank = ((uint64_t)count * pct + 99) / 100;
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKET_CNT; i++) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if(seen >= rank) {
+                uint32_t top = bucketTop(i);
+                return top < max ? top : max;
+            }
+        }
+        return max;
+    }
+
+    static constexpr const int SUB_BUCKETS = 4;
+    // enough for any uint32_t
+    static constexpr const int BUCKET_CNT = 31 * SUB_BUCKETS;
+
+    std::atomic<uint32_t> m_buckets[BUCKET_CNT];
+    std::atomic<uint32_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint32_t> m_max;
+};
+
+// Where a frame spends its time, in pipeline order
+enum class Stage { Read, Decode, Detect, Scale, Encode, Enqueue, Deliver, Count };
+
+struct PipelineMetrics
+{
+    static const char* stageName(Stage stage) {
+        switch(stage) {
+        case Stage::Read:       return "read";
+        case Stage::Decode:     return "decode";
+        case Stage::Detect:     return "detect";
+        case Stage::Scale:      return "scale";
+        case Stage::Encode:     return "encode";
+        case Stage::Enqueue:    return "enqueue";
+        case Stage::Deliver:    return "deliver";
+        default:                return "unknown";
+        }
+    }
+
+    void record(Stage stage, uint32_t us) {
+        stages[(int)stage].record(us);
+    }
+
+    void reset() {
+        for(auto& stage : stages) {
+            stage.reset();
+        }
+    }
+
+    LatencyHistogram stages[(int)Stage::Count];
+};
+
+#endif // PIPELINE_METRICS_H
@@ -0,0 +1,516 @@
+#include "pixel_convert.h"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PIXEL_CONVERT_X86 1
+#include <immintrin.h>
+// the file is built without -m flags, each kernel enables its own instruction set
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// rotated frames go through tiles this size, small enough for L1
+static constexpr const int TILE_ROWS = 16;
+static constexpr const int TILE_COLS = 64;
+
+// BT.601 limited range with 6 fraction bits, as pmulhrsw factors for
+// Y taken as (Y - 16) << 7 and U / V as (C - 128) << 8
+static constexpr const int16_t COEF_Y = 19077;      // 1.164384 * 64 * 256
+static constexpr const int16_t COEF_RV = 13075;     // 1.596027 * 64 * 128
+static constexpr const int16_t COEF_GU = 3209;      // 0.391762 * 64 * 128
+static constexpr const int16_t COEF_GV = 6660;      // 0.812968 * 64 * 128
+static constexpr const int16_t COEF_BU = 16525;     // 2.017232 * 64 * 128
+
+// where the samples of a pixel pair are
+struct Layout {
+    // nv12 / nv21: a luma plane and a plane of interleaved chroma
+    bool semi_planar;
+    // byte offsets within the 4 bytes of a packed pair, or of a chroma pair
+    int y_offset;
+    int u_offset;
+    int v_offset;
+    bool rgba;
+    // pixels are written right to left
+    bool reverse;
+};
+
+// converts width pixels of a row, width is even
+typedef void (*RowFunc)(const uint8_t* luma, const uint8_t* chroma, uint8_t* dst, int width, const Layout& layout);
+// dst row j gets column j of the src rows, row k at src + k * src_stride
+typedef void (*TransposeFunc)(const uint8_t* src, ptrdiff_t src_stride, int rows, int cols,
+                              uint8_t* dst, ptrdiff_t dst_stride);
+// 32 bit pixels of a row in the opposite order
+typedef void (*ReverseFunc)(const uint8_t* src, uint8_t* dst, int width);
+
+static std::atomic<int> s_max_level((int)PixelConvert::SimdLevel::Avx2);
+
+static bool getLayout(AVPixelFormat src_fmt, AVPixelFormat dst_fmt, Layout& layout) {
+    switch(dst_fmt) {
+    case AV_PIX_FMT_RGBA:
+        layout.rgba = true;
+        break;
+    case AV_PIX_FMT_BGRA:
+        layout.rgba = false;
+        break;
+    default:
+        return false;
+    }
+    switch(src_fmt) {
+    case AV_PIX_FMT_YUYV422:
+        layout.semi_planar = false;
+        layout.y_offset = 0;
+        layout.u_offset = 1;
+        layout.v_offset = 3;
+        break;
+    case AV_PIX_FMT_UYVY422:
+        layout.semi_planar = false;
+        layout.y_offset = 1;
+        layout.u_offset = 0;
+        layout.v_offset = 2;
+        break;
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+        layout.semi_planar = true;
+        layout.y_offset = 0;
+        layout.u_offset = src_fmt == AV_PIX_FMT_NV12 ? 0 : 1;
+        layout.v_offset = src_fmt == AV_PIX_FMT_NV12 ? 1 : 0;
+        break;
+    default:
+        return false;
+    }
+    layout.reverse = false;
+    return true;
+}
+
+// scalar twins of pmulhrsw and of the saturating adds, every kernel rounds the same way
+static inline int mulhrs(int a, int b) {
+    return ((a * b >> 14) + 1) >> 1;
+}
+
+static inline int saturate16(int value) {
+    return std::max(-32768, std::min(32767, value));
+}
+
+static inline uint8_t toByte(int value) {
+    return (uint8_t)std::max(0, std::min(255, value >> 6));
+}
+
+static void convertRowScalarFrom(const uint8_t* luma, const uint8_t* chroma, uint8_t* dst, int start, int width,
+                                 const Layout& layout) {
+    for(int i = start; i < width; i += 2) {
+        int y[2], u, v;
+        if(layout.semi_planar) {
+            y[0] = luma[i];
+            y[1] = luma[i + 1];
+            u = chroma[i + layout.u_offset];
+            v = chroma[i + layout.v_offset];
+        } else {
+            const uint8_t* pair = luma + i * 2;
+            y[0] = pair[layout.y_offset];
+            y[1] = pair[layout.y_offset + 2];
+            u = pair[layout.u_offset];
+            v = pair[layout.v_offset];
+        }
+        int rv = mulhrs((v - 128) * 256, COEF_RV);
+        int gu = mulhrs((u - 128) * 256, COEF_GU);
+        int gv = mulhrs((v - 128) * 256, COEF_GV);
+        int bu = mulhrs((u - 128) * 256, COEF_BU);
+        for(int n = 0; n < 2; n++) {
+            int luma_term = mulhrs(y[n] * 128 - (16 << 7), COEF_Y) + 32;
+            uint8_t r = toByte(saturate16(luma_term + rv));
+            uint8_t g = toByte(saturate16(saturate16(luma_term - gu) - gv));
+            uint8_t b = toByte(saturate16(luma_term + bu));
+            uint8_t* out = dst + (layout.reverse ? width - 1 - (i + n) : i + n) * 4;
+            out[0] = layout.rgba ? r : b;
+            out[1] = g;
+            out[2] = layout.rgba ? b : r;
+            out[3] = 255;
+        }
+    }
+}
+
+static void convertRowScalar(const uint8_t* luma, const uint8_t* chroma, uint8_t* dst, int width, const Layout& layout) {
+    convertRowScalarFrom(luma, chroma, dst, 0, width, layout);
+}
+
+// rows first_row..end_row, columns first_col..end_col of a transpose
+static void transposeRange(const uint8_t* src, ptrdiff_t src_stride, int first_row, int end_row, int first_col,
+                           int end_col, uint8_t* dst, ptrdiff_t dst_stride) {
+    for(int j = first_col; j < end_col; j++) {
+        uint8_t* out = dst + j * dst_stride;
+        for(int k = first_row; k < end_row; k++) {
+            memcpy(out + k * 4, src + k * src_stride + j * 4, 4);
+        }
+    }
+}
+
+static void transposeScalar(const uint8_t* src, ptrdiff_t src_stride, int rows, int cols,
+                            uint8_t* dst, ptrdiff_t dst_stride) {
+    transposeRange(src, src_stride, 0, rows, 0, cols, dst, dst_stride);
+}
+
+static void reverseScalarFrom(const uint8_t* src, uint8_t* dst, int start, int width) {
+    for(int i = start; i < width; i++) {
+        memcpy(dst + (width - 1 - i) * 4, src + i * 4, 4);
+    }
+}
+
+static void reverseScalar(const uint8_t* src, uint8_t* dst, int width) {
+    reverseScalarFrom(src, dst, 0, width);
+}
+
+#ifdef PIXEL_CONVERT_X86
+// pshufb mask putting byte first + pair * pair_step + pixel * pixel_step into
+// the high byte of 16 bit lane n (pair n / 2, pixel n % 2), low bytes zero
+static inline TARGET_SSE4 __m128i highByteMask(int first, int pair_step, int pixel_step) {
+    alignas(16) int8_t mask[16];
+    for(int n = 0; n < 8; n++) {
+        mask[n * 2] = -128;
+        mask[n * 2 + 1] = (int8_t)(first + (n / 2) * pair_step + (n % 2) * pixel_step);
+    }
+    return _mm_load_si128((const __m128i*)mask);
+}
+
+// 8 pixels from Y, U and V held in the high byte of 16 bit lanes
+static inline TARGET_SSE4 void convert8Sse4(__m128i y, __m128i u, __m128i v, uint8_t* dst, const Layout& layout) {
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    y = _mm_sub_epi16(_mm_srli_epi16(y, 1), _mm_set1_epi16(16 << 7));
+    y = _mm_add_epi16(_mm_mulhrs_epi16(y, _mm_set1_epi16(COEF_Y)), _mm_set1_epi16(32));
+    u = _mm_xor_si128(u, bias);
+    v = _mm_xor_si128(v, bias);
+    __m128i r = _mm_adds_epi16(y, _mm_mulhrs_epi16(v, _mm_set1_epi16(COEF_RV)));
+    __m128i g = _mm_subs_epi16(_mm_subs_epi16(y, _mm_mulhrs_epi16(u, _mm_set1_epi16(COEF_GU))),
+                               _mm_mulhrs_epi16(v, _mm_set1_epi16(COEF_GV)));
+    __m128i b = _mm_adds_epi16(y, _mm_mulhrs_epi16(u, _mm_set1_epi16(COEF_BU)));
+    r = _mm_srai_epi16(r, 6);
+    g = _mm_srai_epi16(g, 6);
+    b = _mm_srai_epi16(b, 6);
+    __m128i r8 = _mm_packus_epi16(r, r);
+    __m128i g8 = _mm_packus_epi16(g, g);
+    __m128i b8 = _mm_packus_epi16(b, b);
+    __m128i first_g = _mm_unpacklo_epi8(layout.rgba ? r8 : b8, g8);
+    __m128i third_a = _mm_unpacklo_epi8(layout.rgba ? b8 : r8, _mm_set1_epi8(-1));
+    __m128i lo = _mm_unpacklo_epi16(first_g, third_a);
+    __m128i hi = _mm_unpackhi_epi16(first_g, third_a);
+    if(layout.reverse) {
+        _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi32(hi, 0x1b));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_shuffle_epi32(lo, 0x1b));
+    } else {
+        _mm_storeu_si128((__m128i*)dst, lo);
+        _mm_storeu_si128((__m128i*)(dst + 16), hi);
+    }
+}
+
+static TARGET_SSE4 void convertRowSse4(const uint8_t* luma, const uint8_t* chroma, uint8_t* dst, int width,
+                                       const Layout& layout) {
+    int i = 0;
+    if(layout.semi_planar) {
+        const __m128i y_mask = highByteMask(0, 2, 1);
+        const __m128i u_mask = highByteMask(layout.u_offset, 2, 0);
+        const __m128i v_mask = highByteMask(layout.v_offset, 2, 0);
+        for(; i + 8 <= width; i += 8) {
+            __m128i y = _mm_loadl_epi64((const __m128i*)(luma + i));
+            __m128i uv = _mm_loadl_epi64((const __m128i*)(chroma + i));
+            convert8Sse4(_mm_shuffle_epi8(y, y_mask), _mm_shuffle_epi8(uv, u_mask), _mm_shuffle_epi8(uv, v_mask),
+                         dst + (layout.reverse ? width - i - 8 : i) * 4, layout);
+        }
+    } else {
+        const __m128i y_mask = highByteMask(layout.y_offset, 4, 2);
+        const __m128i u_mask = highByteMask(layout.u_offset, 4, 0);
+        const __m128i v_mask = highByteMask(layout.v_offset, 4, 0);
+        for(; i + 8 <= width; i += 8) {
+            __m128i pairs = _mm_loadu_si128((const __m128i*)(luma + i * 2));
+            convert8Sse4(_mm_shuffle_epi8(pairs, y_mask), _mm_shuffle_epi8(pairs, u_mask),
+                         _mm_shuffle_epi8(pairs, v_mask), dst + (layout.reverse ? width - i - 8 : i) * 4, layout);
+        }
+    }
+    convertRowScalarFrom(luma, chroma, dst, i, width, layout);
+}
+
+// 16 pixels, lane 0 holds pixels 0-7 and lane 1 pixels 8-15
+static inline TARGET_AVX2 void convert16Avx2(__m256i y, __m256i u, __m256i v, uint8_t* dst, const Layout& layout) {
+    const __m256i bias = _mm256_set1_epi16((short)0x8000);
+    y = _mm256_sub_epi16(_mm256_srli_epi16(y, 1), _mm256_set1_epi16(16 << 7));
+    y = _mm256_add_epi16(_mm256_mulhrs_epi16(y, _mm256_set1_epi16(COEF_Y)), _mm256_set1_epi16(32));
+    u = _mm256_xor_si256(u, bias);
+    v = _mm256_xor_si256(v, bias);
+    __m256i r = _mm256_adds_epi16(y, _mm256_mulhrs_epi16(v, _mm256_set1_epi16(COEF_RV)));
+    __m256i g = _mm256_subs_epi16(_mm256_subs_epi16(y, _mm256_mulhrs_epi16(u, _mm256_set1_epi16(COEF_GU))),
+                                  _mm256_mulhrs_epi16(v, _mm256_set1_epi16(COEF_GV)));
+    __m256i b = _mm256_adds_epi16(y, _mm256_mulhrs_epi16(u, _mm256_set1_epi16(COEF_BU)));
+    r = _mm256_srai_epi16(r, 6);
+    g = _mm256_srai_epi16(g, 6);
+    b = _mm256_srai_epi16(b, 6);
+    __m256i r8 = _mm256_packus_epi16(r, r);
+    __m256i g8 = _mm256_packus_epi16(g, g);
+    __m256i b8 = _mm256_packus_epi16(b, b);
+    __m256i first_g = _mm256_unpacklo_epi8(layout.rgba ? r8 : b8, g8);
+    __m256i third_a = _mm256_unpacklo_epi8(layout.rgba ? b8 : r8, _mm256_set1_epi8(-1));
+    // pixels 0-3 | 8-11 and 4-7 | 12-15
+    __m256i lo = _mm256_unpacklo_epi16(first_g, third_a);
+    __m256i hi = _mm256_unpackhi_epi16(first_g, third_a);
+    __m256i first = _mm256_permute2x128_si256(lo, hi, 0x20);
+    __m256i second = _mm256_permute2x128_si256(lo, hi, 0x31);
+    if(layout.reverse) {
+        const __m256i reversed = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permutevar8x32_epi32(second, reversed));
+        _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permutevar8x32_epi32(first, reversed));
+    } else {
+        _mm256_storeu_si256((__m256i*)dst, first);
+        _mm256_storeu_si256((__m256i*)(dst + 32), second);
+    }
+}
+
+static inline TARGET_AVX2 __m256i laneMasks(__m128i lane0, __m128i lane1) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lane0), lane1, 1);
+}
+
+static TARGET_AVX2 void convertRowAvx2(const uint8_t* luma, const uint8_t* chroma, uint8_t* dst, int width,
+                                       const Layout& layout) {
+    int i = 0;
+    if(layout.semi_planar) {
+        // the 16 chroma bytes of 16 pixels go to both lanes, each picks its half
+        const __m256i u_mask = laneMasks(highByteMask(layout.u_offset, 2, 0), highByteMask(layout.u_offset + 8, 2, 0));
+        const __m256i v_mask = laneMasks(highByteMask(layout.v_offset, 2, 0), highByteMask(layout.v_offset + 8, 2, 0));
+        for(; i + 16 <= width; i += 16) {
+            __m256i y = _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(luma + i))), 8);
+            __m256i uv = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(chroma + i)));
+            convert16Avx2(y, _mm256_shuffle_epi8(uv, u_mask), _mm256_shuffle_epi8(uv, v_mask),
+                          dst + (layout.reverse ? width - i - 16 : i) * 4, layout);
+        }
+    } else {
+        const __m256i y_mask = _mm256_broadcastsi128_si256(highByteMask(layout.y_offset, 4, 2));
+        const __m256i u_mask = _mm256_broadcastsi128_si256(highByteMask(layout.u_offset, 4, 0));
+        const __m256i v_mask = _mm256_broadcastsi128_si256(highByteMask(layout.v_offset, 4, 0));
+        for(; i + 16 <= width; i += 16) {
+            __m256i pairs = _mm256_loadu_si256((const __m256i*)(luma + i * 2));
+            convert16Avx2(_mm256_shuffle_epi8(pairs, y_mask), _mm256_shuffle_epi8(pairs, u_mask),
+                          _mm256_shuffle_epi8(pairs, v_mask), dst + (layout.reverse ? width - i - 16 : i) * 4, layout);
+        }
+    }
+    convertRowScalarFrom(luma, chroma, dst, i, width, layout);
+}
+
+// 4x4 blocks of 32 bit pixels, the uneven edges in C++
+static TARGET_SSE4 void transposeSse4(const uint8_t* src, ptrdiff_t src_stride, int rows, int cols,
+                                      uint8_t* dst, ptrdiff_t dst_stride) {
+    int block_rows = rows & ~3;
+    int block_cols = cols & ~3;
+    for(int k = 0; k < block_rows; k += 4) {
+        const uint8_t* in = src + k * src_stride;
+        for(int j = 0; j < block_cols; j += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + j * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + src_stride + j * 4));
+            __m128i c = _mm_loadu_si128((const __m128i*)(in + 2 * src_stride + j * 4));
+            __m128i d = _mm_loadu_si128((const __m128i*)(in + 3 * src_stride + j * 4));
+            __m128i ab01 = _mm_unpacklo_epi32(a, b);
+            __m128i cd01 = _mm_unpacklo_epi32(c, d);
+            __m128i ab23 = _mm_unpackhi_epi32(a, b);
+            __m128i cd23 = _mm_unpackhi_epi32(c, d);
+            uint8_t* out = dst + j * dst_stride + k * 4;
+            _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi64(ab01, cd01));
+            _mm_storeu_si128((__m128i*)(out + dst_stride), _mm_unpackhi_epi64(ab01, cd01));
+            _mm_storeu_si128((__m128i*)(out + 2 * dst_stride), _mm_unpacklo_epi64(ab23, cd23));
+            _mm_storeu_si128((__m128i*)(out + 3 * dst_stride), _mm_unpackhi_epi64(ab23, cd23));
+        }
+    }
+    transposeRange(src, src_stride, block_rows, rows, 0, cols, dst, dst_stride);
+    transposeRange(src, src_stride, 0, block_rows, block_cols, cols, dst, dst_stride);
+}
+
+static TARGET_SSE4 void reverseSse4(const uint8_t* src, uint8_t* dst, int width) {
+    int i = 0;
+    for(; i + 4 <= width; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        _mm_storeu_si128((__m128i*)(dst + (width - i - 4) * 4), _mm_shuffle_epi32(pixels, 0x1b));
+    }
+    reverseScalarFrom(src, dst, i, width);
+}
+#endif
+
+static RowFunc getRowFunc(PixelConvert::SimdLevel level) {
+#ifdef PIXEL_CONVERT_X86
+    if(level == PixelConvert::SimdLevel::Avx2) {
+        return convertRowAvx2;
+    }
+    if(level == PixelConvert::SimdLevel::Sse4) {
+        return convertRowSse4;
+    }
+#endif
+    return convertRowScalar;
+}
+
+static TransposeFunc getTransposeFunc(PixelConvert::SimdLevel level) {
+#ifdef PIXEL_CONVERT_X86
+    if(level != PixelConvert::SimdLevel::Scalar) {
+        return transposeSse4;
+    }
+#endif
+    return transposeScalar;
+}
+
+static ReverseFunc getReverseFunc(PixelConvert::SimdLevel level) {
+#ifdef PIXEL_CONVERT_X86
+    if(level != PixelConvert::SimdLevel::Scalar) {
+        return reverseSse4;
+    }
+#endif
+    return reverseScalar;
+}
+
+bool PixelConvert::isSupported(AVPixelFormat src_fmt, AVPixelFormat dst_fmt, int width) {
+    Layout layout;
+    // pixel pairs share their chroma
+    return getLayout(src_fmt, dst_fmt, layout) && width > 0 && width % 2 == 0;
+}
+
+bool PixelConvert::convert(const AVFrame* src, AVFrame* dst, Orientation orientation) {
+    Layout layout;
+    if(!isSupported((AVPixelFormat)src->format, (AVPixelFormat)dst->format, src->width)
+            || !getLayout((AVPixelFormat)src->format, (AVPixelFormat)dst->format, layout)) {
+        return false;
+    }
+    int width = src->width;
+    int height = src->height;
+    int oriented_width, oriented_height;
+    getOrientedSize(width, height, orientation, oriented_width, oriented_height);
+    if(dst->width != oriented_width || dst->height != oriented_height) {
+        return false;
+    }
+    SimdLevel level = getSimdLevel();
+    RowFunc convertRow = getRowFunc(level);
+    // two luma rows share a chroma row in nv12, packed pixels take 2 bytes
+    int luma_bytes = layout.semi_planar ? 1 : 2;
+    auto lumaRow = [&](int y, int x) {
+        return src->data[0] + (ptrdiff_t)y * src->linesize[0] + x * luma_bytes;
+    };
+    auto chromaRow = [&](int y, int x) -> const uint8_t* {
+        return layout.semi_planar ? src->data[1] + (ptrdiff_t)(y >> 1) * src->linesize[1] + x : NULL;
+    };
+    ptrdiff_t dst_stride = dst->linesize[0];
+
+    if(orientation == Orientation::Rotate90 || orientation == Orientation::Rotate270) {
+        // rows are converted into a tile and written out as its columns
+        TransposeFunc transpose = getTransposeFunc(level);
+        alignas(32) uint8_t tile[TILE_ROWS * TILE_COLS * 4];
+        const ptrdiff_t tile_stride = TILE_COLS * 4;
+        for(int y0 = 0; y0 < height; y0 += TILE_ROWS) {
+            int rows = std::min(+TILE_ROWS, height - y0);
+            for(int x0 = 0; x0 < width; x0 += TILE_COLS) {
+                int cols = std::min(+TILE_COLS, width - x0);
+                for(int k = 0; k < rows; k++) {
+                    convertRow(lumaRow(y0 + k, x0), chromaRow(y0 + k, x0), tile + k * tile_stride, cols, layout);
+                }
+                if(orientation == Orientation::Rotate90) {
+                    // the bottom row ends up leftmost
+                    transpose(tile + (rows - 1) * tile_stride, -tile_stride, rows, cols,
+                              dst->data[0] + x0 * dst_stride + (height - y0 - rows) * 4, dst_stride);
+                } else {
+                    // the right column ends up on top
+                    transpose(tile, tile_stride, rows, cols,
+                              dst->data[0] + (width - 1 - x0) * dst_stride + y0 * 4, -dst_stride);
+                }
+            }
+        }
+        return true;
+    }
+    layout.reverse = orientation == Orientation::Mirror || orientation == Orientation::Rotate180;
+    for(int y = 0; y < height; y++) {
+        int src_y = orientation == Orientation::Rotate180 ? height - 1 - y : y;
+        convertRow(lumaRow(src_y, 0), chromaRow(src_y, 0), dst->data[0] + y * dst_stride, width, layout);
+    }
+    return true;
+}
+
+bool PixelConvert::orient(const AVFrame* src, AVFrame* dst, Orientation orientation) {
+    if(!canOrient((AVPixelFormat)src->format) || dst->format != src->format) {
+        return false;
+    }
+    int width = src->width;
+    int height = src->height;
+    int oriented_width, oriented_height;
+    getOrientedSize(width, height, orientation, oriented_width, oriented_height);
+    if(dst->width != oriented_width || dst->height != oriented_height) {
+        return false;
+    }
+    SimdLevel level = getSimdLevel();
+    ptrdiff_t src_stride = src->linesize[0];
+    ptrdiff_t dst_stride = dst->linesize[0];
+
+    if(orientation == Orientation::Rotate90 || orientation == Orientation::Rotate270) {
+        TransposeFunc transpose = getTransposeFunc(level);
+        for(int y0 = 0; y0 < height; y0 += TILE_ROWS) {
+            int rows = std::min(+TILE_ROWS, height - y0);
+            for(int x0 = 0; x0 < width; x0 += TILE_COLS) {
+                int cols = std::min(+TILE_COLS, width - x0);
+                if(orientation == Orientation::Rotate90) {
+                    transpose(src->data[0] + (y0 + rows - 1) * src_stride + x0 * 4, -src_stride, rows, cols,
+                              dst->data[0] + x0 * dst_stride + (height - y0 - rows) * 4, dst_stride);
+                } else {
+                    transpose(src->data[0] + y0 * src_stride + x0 * 4, src_stride, rows, cols,
+                              dst->data[0] + (width - 1 - x0) * dst_stride + y0 * 4, -dst_stride);
+                }
+            }
+        }
+        return true;
+    }
+    ReverseFunc reverse = getReverseFunc(level);
+    for(int y = 0; y < height; y++) {
+        int src_y = orientation == Orientation::Rotate180 ? height - 1 - y : y;
+        const uint8_t* in = src->data[0] + src_y * src_stride;
+        uint8_t* out = dst->data[0] + y * dst_stride;
+        if(orientation == Orientation::Normal) {
+            memcpy(out, in, width * 4);
+        } else {
+            reverse(in, out, width);
+        }
+    }
+    return true;
+}
+
+bool PixelConvert::canOrient(AVPixelFormat format) {
+    return format == AV_PIX_FMT_RGBA || format == AV_PIX_FMT_BGRA
+            || format == AV_PIX_FMT_ARGB || format == AV_PIX_FMT_ABGR;
+}
+
+void PixelConvert::getOrientedSize(int width, int height, Orientation orientation,
+                                   int& oriented_width, int& oriented_height) {
+    bool swap = orientation == Orientation::Rotate90 || orientation == Orientation::Rotate270;
+    oriented_width = swap ? height : width;
+    oriented_height = swap ? width : height;
+}
+
+PixelConvert::SimdLevel PixelConvert::getSimdLevel() {
+    static const SimdLevel detected = detectSimdLevel();
+    return (SimdLevel)std::min((int)detected, s_max_level.load());
+}
+
+void PixelConvert::setMaxSimdLevel(SimdLevel level) {
+    s_max_level = (int)level;
+}
+
+const char* PixelConvert::getSimdName(SimdLevel level) {
+    switch(level) {
+    case SimdLevel::Avx2:
+        return "avx2";
+    case SimdLevel::Sse4:
+        return "sse4";
+    default:
+        return "scalar";
+    }
+}
+
+PixelConvert::SimdLevel PixelConvert::detectSimdLevel() {
+#ifdef PIXEL_CONVERT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+    if(__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::Sse4;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
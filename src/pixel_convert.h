@@ -0,0 +1,43 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixfmt.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output_format.h"
+
+// Unscaled conversion of the camera formats yuyv422, uyvy422 and nv12 to
+// rgba / bgra, mirrored or rotated in the same pass. BT.601 limited range
+// like swscale's default, chroma shared by each pixel pair and row pair.
+// Kernels are picked at runtime: AVX2, SSE4.1 or plain C++ on other CPUs
+// and compilers, all of them give the same bytes.
+class PixelConvert
+{
+public:
+    enum class SimdLevel { Scalar, Sse4, Avx2 };
+
+    // src_fmt converts to dst_fmt here, for frames of that width
+    static bool isSupported(AVPixelFormat src_fmt, AVPixelFormat dst_fmt, int width);
+    // dst has its planes set, at the size of src turned by orientation
+    static bool convert(const AVFrame* src, AVFrame* dst, Orientation orientation);
+    // turns a frame of 32 bit pixels already converted by swscale
+    static bool orient(const AVFrame* src, AVFrame* dst, Orientation orientation);
+    static bool canOrient(AVPixelFormat format);
+    static void getOrientedSize(int width, int height, Orientation orientation, int& oriented_width, int& oriented_height);
+
+    // the best kernels the CPU runs, no better than setMaxSimdLevel() allows
+    static SimdLevel getSimdLevel();
+    // lets the benchmark compare the kernels, Avx2 by default
+    static void setMaxSimdLevel(SimdLevel level);
+    static const char* getSimdName(SimdLevel level);
+
+private:
+    static SimdLevel detectSimdLevel();
+};
+
+#endif // PIXEL_CONVERT_H
@@ -0,0 +1,158 @@
+#include "shared_frame_ring.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+
+// Rings of the whole process keyed by header address, so a wait() from a
+// worker finds the ring a camera on the main thread writes to.
+struct RingSignal {
+    std::mutex lock;
+    std::condition_variable cv;
+};
+
+static std::mutex s_registry_lock;
+static std::map<const int32_t*, std::shared_ptr<RingSignal>> s_registry;
+
+static std::shared_ptr<RingSignal> findSignal(const int32_t* header) {
+    std::lock_guard<std::mutex> lk(s_registry_lock);
+    auto it = s_registry.find(header);
+    return it != s_registry.end() ? it->second : NULL;
+}
+
+// the header lives in a SharedArrayBuffer, JS reads it with Atomics
+static int32_t loadInt(const int32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void storeInt(int32_t* ptr, int32_t value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+SharedFrameRing::SharedFrameRing(int32_t* header, size_t header_len, uint8_t* data, size_t data_size, int slot_cnt) {
+    m_header = header;
+    m_data = data;
+    m_closed = false;
+    m_seq = 0;
+    m_dropped_cnt = 0;
+    // as many slots as both arrays have room for
+    m_slot_cnt = std::max(0, std::min(slot_cnt, (int)(((int64_t)header_len - HEADER_FIXED) / SLOT_META)));
+    m_slot_size = m_slot_cnt > 0 ? (uint32_t)(data_size / m_slot_cnt) & ~(uint32_t)(SLOT_ALIGN - 1) : 0;
+    if(!isUsable()) {
+        std::cout << TAG << ": ring too small, header:" << header_len << " data:" << data_size << std::endl;
+        return;
+    }
+    for(size_t i = 0; i < headerLength(m_slot_cnt); i++) {
+        storeInt(m_header + i, 0);
+    }
+    storeInt(m_header + 1, m_slot_cnt);
+    storeInt(m_header + 2, m_slot_size);
+
+    m_signal = std::make_shared<RingSignal>();
+    std::lock_guard<std::mutex> lk(s_registry_lock);
+    s_registry[m_header] = m_signal;
+}
+
+SharedFrameRing::~SharedFrameRing() {
+    close();
+}
+
+bool SharedFrameRing::isUsable() {
+    return m_slot_cnt > 0 && m_slot_size > 0;
+}
+
+void SharedFrameRing::close() {
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        if(m_closed) {
+            return;
+        }
+        m_closed = true;
+    }
+    if(m_signal == NULL) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(s_registry_lock);
+        auto it = s_registry.find(m_header);
+        if(it != s_registry.end() && it->second == m_signal) {
+            s_registry.erase(it);
+        }
+    }
+    // waiters return with the last frame number
+    std::lock_guard<std::mutex> lk(m_signal->lock);
+    m_signal->cv.notify_all();
+}
+
+bool SharedFrameRing::publish(const AVFrame* frame) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    if(m_closed || !isUsable()) {
+        return false;
+    }
+    AVPixelFormat pix_fmt = (AVPixelFormat)frame->format;
+    int size = av_image_get_buffer_size(pix_fmt, frame->width, frame->height, 1);
+    if(size <= 0 || (uint32_t)size > m_slot_size) {
+        m_dropped_cnt++;
+        storeInt(m_header + 3, m_dropped_cnt);
+        return false;
+    }
+    int32_t seq = m_seq < MAX_SEQ ? m_seq + 1 : 1;
+    int slot = (seq - 1) % m_slot_cnt;
+    int32_t* meta = m_header + HEADER_FIXED + slot * SLOT_META;
+    uint8_t* pixels = m_data + (size_t)slot * m_slot_size;
+
+    // odd: readers of the frame this slot held so far see it going away;
+    // the fence keeps the pixel writes below from overtaking it
+    storeInt(meta, seq * 2 - 1);
+    std::atomic_thread_fence(std::memory_order_release);
+    av_image_copy_to_buffer(pixels, size, frame->data, frame->linesize, pix_fmt, frame->width, frame->height, 1);
+    uint8_t* planes[4] = {};
+    int linesize[4] = {};
+    av_image_fill_arrays(planes, linesize, pixels, pix_fmt, frame->width, frame->height, 1);
+    storeInt(meta + 1, frame->width);
+    storeInt(meta + 2, frame->height);
+    storeInt(meta + 3, frame->format);
+    storeInt(meta + 4, size);
+    storeInt(meta + 5, av_pix_fmt_count_planes(pix_fmt));
+    for(int i = 0; i < 4; i++) {
+        storeInt(meta + 6 + i, planes[i] != NULL ? planes[i] - pixels : 0);
+        storeInt(meta + 10 + i, linesize[i]);
+    }
+    storeInt(meta + 14, (int32_t)(frame->pts & 0xffffffff));
+    storeInt(meta + 15, (int32_t)(frame->pts >> 32));
+    storeInt(meta, seq * 2);
+    storeInt(m_header, seq);
+    m_seq = seq;
+
+    // empty critical section, see FrameQueue::wake()
+    { std::lock_guard<std::mutex> signal_lk(m_signal->lock); }
+    m_signal->cv.notify_all();
+    return true;
+}
+
+uint32_t SharedFrameRing::getPublishedCount() {
+    return loadInt(m_header);
+}
+
+uint32_t SharedFrameRing::getDroppedCount() {
+    return m_dropped_cnt;
+}
+
+int32_t SharedFrameRing::wait(const int32_t* header, int32_t last_seq, int timeout_ms) {
+    auto signal = findSignal(header);
+    if(signal == NULL) {
+        // no ring writes there (anymore)
+        return loadInt(header);
+    }
+    std::unique_lock<std::mutex> lk(signal->lock);
+    signal->cv.wait_for(lk, std::chrono::milliseconds(std::max(0, timeout_ms)), [&] {
+        return loadInt(header) != last_seq || findSignal(header) != signal;
+    });
+    return loadInt(header);
+}
+
+size_t SharedFrameRing::headerLength(int slot_cnt) {
+    return HEADER_FIXED + (size_t)slot_cnt * SLOT_META;
+}
@@ -0,0 +1,81 @@
+#ifndef SHARED_FRAME_RING_H
+#define SHARED_FRAME_RING_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+struct RingSignal;
+
+// Frames written into memory owned by JS (a SharedArrayBuffer), described
+// by an Int32Array header that JS reads with Atomics.load:
+//
+//   header[0]  number of the newest published frame, 0 before the first
+//   header[1]  slot count
+//   header[2]  slot size in bytes, the data array holds slot count of them
+//   header[3]  frames dropped because they did not fit in a slot
+//   header[8 + slot * 16 + n]  slot metadata, n:
+//       0 seq: odd while written, 2 * frame number once published
+//       1 width, 2 height, 3 AVPixelFormat, 4 size, 5 plane count,
+//       6..9 plane offsets, 10..13 strides, 14/15 pts low/high 32 bits
+//
+// Frame n lives in slot (n - 1) % slot count. A reader that sees the same
+// even seq before and after reading a slot got a consistent frame. Frame
+// numbers wrap back to 1 after MAX_SEQ, about a year at 30 fps.
+// Native code cannot wake Atomics.wait, waiters block in wait() instead.
+class SharedFrameRing
+{
+public:
+    // header needs headerLength(slot_cnt) elements; slots that do not fit
+    // in data_size at a 64 byte aligned size are not used
+    explicit SharedFrameRing(int32_t* header, size_t header_len, uint8_t* data, size_t data_size, int slot_cnt);
+    ~SharedFrameRing();
+
+    bool isUsable();
+    // capture thread, copies the frame into the next slot
+    bool publish(const AVFrame* frame);
+    // waits for a publish in progress; afterwards the JS memory may go away
+    void close();
+
+    uint32_t getPublishedCount();
+    uint32_t getDroppedCount();
+
+    // Blocks until the ring at header publishes a frame other than last_seq,
+    // up to timeout_ms; returns the newest frame number. Works from any
+    // thread of the process, JS workers included.
+    static int32_t wait(const int32_t* header, int32_t last_seq, int timeout_ms);
+    static size_t headerLength(int slot_cnt);
+
+    static constexpr const int HEADER_FIXED = 8;
+    static constexpr const int SLOT_META = 16;
+    // 2 * MAX_SEQ still fits the slot seq
+    static constexpr const int32_t MAX_SEQ = 0x3fffffff;
+
+private:
+    int32_t*    m_header;
+    uint8_t*    m_data;
+    int         m_slot_cnt;
+    uint32_t    m_slot_size;
+    int32_t     m_seq;
+
+    // held while publishing, close() takes it to wait for the writer
+    std::mutex  m_lock;
+    bool        m_closed;
+    // wakes wait(), also reachable through the process-wide registry
+    std::shared_ptr<RingSignal> m_signal;
+
+    std::atomic<uint32_t> m_dropped_cnt;
+
+    static constexpr const size_t SLOT_ALIGN = 64;
+    static constexpr const char* const TAG = "SharedFrameRing";
+};
+
+#endif // SHARED_FRAME_RING_H
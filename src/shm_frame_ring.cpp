@@ -0,0 +1,341 @@
+#include "shm_frame_ring.h"
+
+#ifndef _WIN32
+#include <iostream>
+#include <algorithm>
+#include <new>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t alignUp(size_t size) {
+    return (size + SHM_RING_ALIGN - 1) & ~(SHM_RING_ALIGN - 1);
+}
+
+// shm_open wants one leading slash and no other
+static std::string shmName(const std::string& name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+static uint8_t* slotAt(uint8_t* map, uint32_t stride, uint64_t seq, uint32_t slot_cnt) {
+    return map + alignUp(sizeof(ShmRingHeader)) + ((seq - 1) % slot_cnt) * stride;
+}
+
+ShmFrameWriter::ShmFrameWriter(const std::string& name, int slot_cnt)
+    : m_name(shmName(name)), m_slot_cnt(std::max(2, slot_cnt)) {
+    m_fd = -1;
+    m_map = NULL;
+    m_map_size = 0;
+    m_published_cnt = 0;
+    m_error_cnt = 0;
+}
+
+ShmFrameWriter::~ShmFrameWriter() {
+    close();
+}
+
+bool ShmFrameWriter::create(uint32_t capacity) {
+    close();
+    size_t stride = alignUp(sizeof(ShmSlotHeader)) + alignUp(capacity);
+    size_t size = alignUp(sizeof(ShmRingHeader)) + stride * m_slot_cnt;
+    // a segment left over by a crashed writer is replaced
+    shm_unlink(m_name.c_str());
+    m_fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(m_fd < 0) {
+        std::cout << TAG << ": shm_open " << m_name << " failed, errno:" << errno << std::endl;
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if(ftruncate(m_fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    }
+    if(map == MAP_FAILED) {
+        std::cout << TAG << ": cannot map " << size << " bytes, errno:" << errno << std::endl;
+        ::close(m_fd);
+        m_fd = -1;
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    // ftruncate zero-fills: every slot seq and last_seq start at 0
+    m_map = (uint8_t*)map;
+    m_map_size = size;
+    auto header = new (m_map) ShmRingHeader();
+    header->slot_cnt = m_slot_cnt;
+    header->slot_stride = stride;
+    header->slot_capacity = capacity;
+    header->retired = 0;
+    header->last_seq = m_published_cnt.load();
+    header->version = SHM_RING_VERSION;
+    for(int i = 0; i < m_slot_cnt; i++) {
+        new (m_map + alignUp(sizeof(ShmRingHeader)) + i * stride) ShmSlotHeader();
+    }
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+    std::cout << TAG << ": " << m_name << " created, slots:" << m_slot_cnt << " capacity:" << capacity << std::endl;
+    return true;
+}
+
+void ShmFrameWriter::close() {
+    if(m_map == NULL) {
+        return;
+    }
+    ((ShmRingHeader*)m_map)->retired.store(1, std::memory_order_release);
+    munmap(m_map, m_map_size);
+    ::close(m_fd);
+    // mappings already made stay valid until the readers drop them
+    shm_unlink(m_name.c_str());
+    m_map = NULL;
+    m_map_size = 0;
+    m_fd = -1;
+}
+
+bool ShmFrameWriter::publish(const AVFrame* frame) {
+    AVPixelFormat pix_fmt = (AVPixelFormat)frame->format;
+    int size = av_image_get_buffer_size(pix_fmt, frame->width, frame->height, 1);
+    if(size <= 0) {
+        m_error_cnt++;
+        return false;
+    }
+    if(m_map == NULL || (uint32_t)size > ((ShmRingHeader*)m_map)->slot_capacity) {
+        if(!create(size)) {
+            m_error_cnt++;
+            return false;
+        }
+    }
+    auto header = (ShmRingHeader*)m_map;
+    uint64_t seq = m_published_cnt + 1;
+    auto slot = (ShmSlotHeader*)slotAt(m_map, header->slot_stride, seq, header->slot_cnt);
+    uint8_t* pixels = (uint8_t*)slot + alignUp(sizeof(ShmSlotHeader));
+
+    // odd: readers of the frame this slot held so far see it going away
+    slot->seq.store(seq * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    av_image_copy_to_buffer(pixels, size, frame->data, frame->linesize, pix_fmt, frame->width, frame->height, 1);
+    uint8_t* data[4] = {};
+    int linesize[4] = {};
+    av_image_fill_arrays(data, linesize, pixels, pix_fmt, frame->width, frame->height, 1);
+    slot->width = frame->width;
+    slot->height = frame->height;
+    slot->format = frame->format;
+    slot->plane_cnt = av_pix_fmt_count_planes(pix_fmt);
+    slot->size = size;
+    for(int i = 0; i < 4; i++) {
+        slot->plane_offset[i] = data[i] != NULL ? data[i] - pixels : 0;
+        slot->stride[i] = linesize[i];
+    }
+    slot->pts = frame->pts;
+    slot->seq.store(seq * 2, std::memory_order_release);
+    header->last_seq.store(seq, std::memory_order_release);
+    m_published_cnt = seq;
+    return true;
+}
+
+uint64_t ShmFrameWriter::getPublishedCount() {
+    return m_published_cnt;
+}
+
+uint32_t ShmFrameWriter::getErrorCount() {
+    return m_error_cnt;
+}
+
+ShmFrameReader::ShmFrameReader() {
+    m_writable = false;
+    m_map = NULL;
+    m_map_size = 0;
+}
+
+ShmFrameReader::~ShmFrameReader() {
+    close();
+}
+
+bool ShmFrameReader::open(const std::string& name, bool writable) {
+    close();
+    m_name = shmName(name);
+    m_writable = writable;
+    int fd = shm_open(m_name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= alignUp(sizeof(ShmRingHeader))) {
+        map = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // the mapping keeps the segment alive, the descriptor is not needed
+    ::close(fd);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    m_map = (const uint8_t*)map;
+    m_map_size = st.st_size;
+    size_t map_size = m_map_size;
+    m_mapping = std::shared_ptr<const void>(map, [map_size](const void* data) {
+        munmap((void*)data, map_size);
+    });
+    auto header = (const ShmRingHeader*)m_map;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION
+            || alignUp(sizeof(ShmRingHeader)) + (size_t)header->slot_stride * header->slot_cnt > m_map_size) {
+        std::cout << TAG << ": " << m_name << " is not a frame ring" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ShmFrameReader::close() {
+    m_mapping.reset();
+    m_map = NULL;
+    m_map_size = 0;
+}
+
+bool ShmFrameReader::reopenIfRetired() {
+    if(m_map != NULL && ((const ShmRingHeader*)m_map)->retired.load(std::memory_order_acquire) == 0) {
+        return true;
+    }
+    return !m_name.empty() && open(m_name, m_writable);
+}
+
+const ShmSlotHeader* ShmFrameReader::getSlot(uint64_t seq) {
+    auto header = (const ShmRingHeader*)m_map;
+    return (const ShmSlotHeader*)slotAt((uint8_t*)m_map, header->slot_stride, seq, header->slot_cnt);
+}
+
+bool ShmFrameReader::readLatest(ShmFrame& frame) {
+    if(!reopenIfRetired()) {
+        return false;
+    }
+    auto header = (const ShmRingHeader*)m_map;
+    for(int attempt = 0; attempt < READ_RETRIES; attempt++) {
+        uint64_t seq = header->last_seq.load(std::memory_order_acquire);
+        if(seq == 0) {
+            return false;
+        }
+        auto slot = getSlot(seq);
+        if(slot->seq.load(std::memory_order_acquire) != seq * 2) {
+            // lapped while looking, take the newer one
+            continue;
+        }
+        frame.seq = seq;
+        frame.width = slot->width;
+        frame.height = slot->height;
+        frame.format = slot->format;
+        frame.plane_cnt = std::min(4, std::max(0, (int)slot->plane_cnt));
+        frame.size = std::min(slot->size, header->slot_capacity);
+        for(int i = 0; i < 4; i++) {
+            frame.plane_offset[i] = slot->plane_offset[i];
+            frame.stride[i] = slot->stride[i];
+        }
+        frame.pts = slot->pts;
+        frame.data = (const uint8_t*)slot + alignUp(sizeof(ShmSlotHeader));
+        frame.mapping = m_mapping;
+        if(isValid(frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ShmFrameReader::isValid(const ShmFrame& frame) {
+    if(m_map == NULL || frame.seq == 0 || (frame.mapping != NULL && frame.mapping != m_mapping)) {
+        // read from a segment that was retired since
+        return false;
+    }
+    auto header = (const ShmRingHeader*)m_map;
+    auto slot = getSlot(frame.seq);
+    // orders the caller's reads of the slot before the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->seq.load(std::memory_order_relaxed) == frame.seq * 2
+            && header->retired.load(std::memory_order_relaxed) == 0;
+}
+
+bool ShmFrameReader::copyLatest(ShmFrame& frame, std::vector<uint8_t>& pixels) {
+    for(int attempt = 0; attempt < READ_RETRIES; attempt++) {
+        if(!readLatest(frame)) {
+            return false;
+        }
+        pixels.assign(frame.data, frame.data + frame.size);
+        if(isValid(frame)) {
+            frame.data = pixels.data();
+            frame.mapping.reset();
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t ShmFrameReader::getSlotCount() {
+    return m_map != NULL ? ((const ShmRingHeader*)m_map)->slot_cnt : 0;
+}
+
+#else // _WIN32
+
+// POSIX shared memory only, there is no segment to publish into on Windows
+#include <iostream>
+#include <algorithm>
+
+ShmFrameWriter::ShmFrameWriter(const std::string& name, int slot_cnt)
+    : m_name(name), m_slot_cnt(std::max(2, slot_cnt)) {
+    m_fd = -1;
+    m_map = NULL;
+    m_map_size = 0;
+    m_published_cnt = 0;
+    m_error_cnt = 0;
+}
+
+ShmFrameWriter::~ShmFrameWriter() {
+}
+
+bool ShmFrameWriter::publish(const AVFrame* frame) {
+    m_error_cnt++;
+    return false;
+}
+
+void ShmFrameWriter::close() {
+}
+
+uint64_t ShmFrameWriter::getPublishedCount() {
+    return 0;
+}
+
+uint32_t ShmFrameWriter::getErrorCount() {
+    return m_error_cnt;
+}
+
+ShmFrameReader::ShmFrameReader() {
+    m_writable = false;
+    m_map = NULL;
+    m_map_size = 0;
+}
+
+ShmFrameReader::~ShmFrameReader() {
+}
+
+bool ShmFrameReader::open(const std::string& name, bool writable) {
+    std::cout << TAG << ": shared memory frames are not supported on Windows" << std::endl;
+    return false;
+}
+
+void ShmFrameReader::close() {
+}
+
+bool ShmFrameReader::readLatest(ShmFrame& frame) {
+    return false;
+}
+
+bool ShmFrameReader::isValid(const ShmFrame& frame) {
+    return false;
+}
+
+bool ShmFrameReader::copyLatest(ShmFrame& frame, std::vector<uint8_t>& pixels) {
+    return false;
+}
+
+uint32_t ShmFrameReader::getSlotCount() {
+    return 0;
+}
+#endif // _WIN32
@@ -0,0 +1,140 @@
+#ifndef SHM_FRAME_RING_H
+#define SHM_FRAME_RING_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames published into a named POSIX shared memory segment, so another
+// process (an Electron renderer, a native tool) reads them without a copy
+// through the main process. The segment is laid out as
+//   ShmRingHeader | slot 0 | slot 1 | ... | slot N-1
+// and every slot as ShmSlotHeader followed by the tightly packed planes.
+// Slots are written round robin, each one guarded by a seqlock: its seq is
+// odd while the writer fills it and 2 * frame number once published.
+// POSIX only, on Windows nothing is published and readers never open.
+
+static constexpr const uint32_t SHM_RING_MAGIC = 0x47524357; // "WCRG"
+static constexpr const uint32_t SHM_RING_VERSION = 1;
+static constexpr const size_t SHM_RING_ALIGN = 64;
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_cnt;
+    // bytes from one slot header to the next, pixels start SHM_RING_ALIGN after it
+    uint32_t slot_stride;
+    uint32_t slot_capacity;
+    // set before the writer unlinks the segment (stop, bigger frames); readers reopen by name
+    std::atomic<uint32_t> retired;
+    // number of the newest published frame, 0 before the first one
+    std::atomic<uint64_t> last_seq;
+};
+
+struct ShmSlotHeader {
+    std::atomic<uint64_t> seq;
+    int32_t width;
+    int32_t height;
+    // AVPixelFormat of the writer's libavutil
+    int32_t format;
+    int32_t plane_cnt;
+    uint32_t size;
+    uint32_t plane_offset[4];
+    int32_t stride[4];
+    int64_t pts;
+};
+
+// A frame as seen by a reader, data points into the mapping
+// which stays mapped as long as a frame refers to it
+struct ShmFrame {
+    uint64_t seq;
+    int width;
+    int height;
+    int format;
+    int plane_cnt;
+    uint32_t size;
+    uint32_t plane_offset[4];
+    int stride[4];
+    int64_t pts;
+    const uint8_t* data;
+    std::shared_ptr<const void> mapping;
+};
+
+// Publishing side, called from the capture thread. The segment is created
+// on the first frame with room for frames of that size; a bigger frame
+// retires it and creates a new one under the same name.
+class ShmFrameWriter
+{
+public:
+    explicit ShmFrameWriter(const std::string& name, int slot_cnt);
+    ~ShmFrameWriter();
+
+    bool publish(const AVFrame* frame);
+    // retires and unlinks the segment, readers see it on their next read
+    void close();
+
+    uint64_t getPublishedCount();
+    uint32_t getErrorCount();
+
+private:
+    bool create(uint32_t capacity);
+
+    const std::string   m_name;
+    const int           m_slot_cnt;
+    int                 m_fd;
+    uint8_t*            m_map;
+    size_t              m_map_size;
+
+    std::atomic<uint64_t> m_published_cnt;
+    std::atomic<uint32_t> m_error_cnt;
+
+    static constexpr const char* const TAG = "ShmFrameWriter";
+};
+
+// Reading side, maps the segment read-only. readLatest() hands out a view
+// into the slot; it stays valid until slot_cnt - 1 newer frames have been
+// published, which isValid() tells after the pixels were used.
+class ShmFrameReader
+{
+public:
+    explicit ShmFrameReader();
+    ~ShmFrameReader();
+
+    // writable maps the segment read-write, for callers (JS) that cannot
+    // be kept from writing into the view; the writer ignores such writes
+    bool open(const std::string& name, bool writable = false);
+    void close();
+
+    // false when nothing was published yet or the segment is gone
+    bool readLatest(ShmFrame& frame);
+    bool isValid(const ShmFrame& frame);
+    // copies the newest frame out of the ring, retried until the copy is consistent
+    bool copyLatest(ShmFrame& frame, std::vector<uint8_t>& pixels);
+
+    uint32_t getSlotCount();
+
+private:
+    bool reopenIfRetired();
+    const ShmSlotHeader* getSlot(uint64_t seq);
+
+    std::string         m_name;
+    bool                m_writable;
+    const uint8_t*      m_map;
+    size_t              m_map_size;
+    // unmaps once the reader and every frame handed out let go of it
+    std::shared_ptr<const void> m_mapping;
+
+    static constexpr const int READ_RETRIES = 4;
+    static constexpr const char* const TAG = "ShmFrameReader";
+};
+
+#endif // SHM_FRAME_RING_H
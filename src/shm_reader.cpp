@@ -0,0 +1,111 @@
+#include "shm_reader.h"
+#include <iostream>
+#include <string.h>
+#define NAPI_EXPERIMENTAL
+#include <node_api.h>
+
+static void releaseMapping(napi_env env, void* data, void* hint) {
+    delete (std::shared_ptr<const void>*)hint;
+}
+
+Napi::Function ShmReader::Init(Napi::Env env) {
+    return DefineClass(env, "ShmReader", {
+        InstanceMethod("readLatest", &ShmReader::ReadLatest),
+        InstanceMethod("isValid", &ShmReader::IsValid),
+        InstanceMethod("close", &ShmReader::Close),
+    });
+}
+
+ShmReader::ShmReader(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ShmReader>(info) {
+    if(info.Length() > 0 && info[0].IsString()) {
+        m_name = info[0].As<Napi::String>().Utf8Value();
+    }
+}
+
+Napi::Value ShmReader::ReadLatest(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    bool copy = false;
+    if(info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object options = info[0].As<Napi::Object>();
+        copy = options.Has("copy") && options.Get("copy").ToBoolean().Value();
+    }
+    // the writer may start after the reader, keep trying to map the ring;
+    // mapped read-write so a write into the view cannot fault the process
+    if(m_reader.getSlotCount() == 0 && !m_reader.open(m_name, true)) {
+        return env.Null();
+    }
+
+    ShmFrame frame;
+    napi_value arrayBuffer;
+    if(!copy) {
+        if(!m_reader.readLatest(frame)) {
+            return env.Null();
+        }
+        // the ArrayBuffer keeps the mapping alive, even once the ring is retired
+        auto mapping = new std::shared_ptr<const void>(frame.mapping);
+        napi_status status = napi_create_external_arraybuffer(env,
+                                                              (void*)frame.data,
+                                                              frame.size,
+                                                              releaseMapping,
+                                                              mapping,
+                                                              &arrayBuffer);
+        if(status == napi_ok) {
+            return frameToObject(env, frame, arrayBuffer);
+        }
+        // runtimes with the V8 memory cage (Electron >= 21) refuse external buffers
+        delete mapping;
+    }
+    std::vector<uint8_t> pixels;
+    if(!m_reader.copyLatest(frame, pixels)) {
+        return env.Null();
+    }
+    void* arrayBufferData = NULL;
+    napi_create_arraybuffer(env, pixels.size(), &arrayBufferData, &arrayBuffer);
+    memcpy(arrayBufferData, pixels.data(), pixels.size());
+    return frameToObject(env, frame, arrayBuffer);
+}
+
+Napi::Value ShmReader::IsValid(const Napi::CallbackInfo& info) {
+    if(info.Length() < 1 || !info[0].IsObject()) {
+        return Napi::Boolean::New(info.Env(), false);
+    }
+    Napi::Object obj = info[0].As<Napi::Object>();
+    if(obj.Has("copied") && obj.Get("copied").ToBoolean().Value()) {
+        // a copy can no longer be overwritten
+        return Napi::Boolean::New(info.Env(), true);
+    }
+    ShmFrame frame;
+    frame.seq = (uint64_t)obj.Get("seq").ToNumber().Int64Value();
+    return Napi::Boolean::New(info.Env(), m_reader.isValid(frame));
+}
+
+Napi::Value ShmReader::Close(const Napi::CallbackInfo& info) {
+    m_reader.close();
+    m_name.clear();
+    return info.Env().Undefined();
+}
+
+Napi::Object ShmReader::frameToObject(Napi::Env env, const ShmFrame& frame, napi_value arrayBuffer) {
+    Napi::ArrayBuffer buffer(env, arrayBuffer);
+    Napi::Array planes = Napi::Array::New(env, frame.plane_cnt);
+    Napi::Array strides = Napi::Array::New(env, frame.plane_cnt);
+    for(int i = 0; i < frame.plane_cnt; i++) {
+        uint32_t end = i + 1 < frame.plane_cnt ? frame.plane_offset[i + 1] : frame.size;
+        planes.Set(i, Napi::Uint8Array::New(env, end - frame.plane_offset[i], buffer, frame.plane_offset[i]));
+        strides.Set(i, frame.stride[i]);
+    }
+    const char* format = av_get_pix_fmt_name((AVPixelFormat)frame.format);
+
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("type", std::string("frame"));
+    obj.Set("seq", (double)frame.seq);
+    obj.Set("copied", frame.mapping == NULL);
+    obj.Set("data", arrayBuffer);
+    obj.Set("width", frame.width);
+    obj.Set("height", frame.height);
+    obj.Set("format", std::string(format != NULL ? format : "none"));
+    obj.Set("pts", (double)frame.pts);
+    obj.Set("planes", planes);
+    obj.Set("strides", strides);
+    return obj;
+}
@@ -0,0 +1,31 @@
+#ifndef SHM_READER_H
+#define SHM_READER_H
+
+#include <napi.h>
+
+#include "shm_frame_ring.h"
+
+// JS side of a shared memory frame ring, for a renderer (or any process)
+// loading the addon: `new ShmReader(name)`. readLatest() returns the newest
+// frame as a view into the segment, no copy and no trip through the main
+// process; isValid(frame) tells whether the writer has reused its slot since.
+class ShmReader : public Napi::ObjectWrap<ShmReader>
+{
+public:
+    static Napi::Function Init(Napi::Env env);
+
+    explicit ShmReader(const Napi::CallbackInfo& info);
+
+    // readLatest() / readLatest({copy: true}), null until a frame is published
+    Napi::Value ReadLatest(const Napi::CallbackInfo& info);
+    Napi::Value IsValid(const Napi::CallbackInfo& info);
+    Napi::Value Close(const Napi::CallbackInfo& info);
+
+private:
+    Napi::Object frameToObject(Napi::Env env, const ShmFrame& frame, napi_value arrayBuffer);
+
+    ShmFrameReader m_reader;
+    std::string m_name;
+};
+
+#endif // SHM_READER_H
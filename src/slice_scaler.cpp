@@ -0,0 +1,188 @@
+#include "slice_scaler.h"
+#include <algorithm>
+#include <iostream>
+extern "C" {
+#include "libavutil/opt.h"
+}
+
+SliceScaler::SliceScaler() {
+    m_workers = NULL;
+    m_thread_cnt = 1;
+    m_configured_threads = 0;
+}
+
+SliceScaler::~SliceScaler() {
+    releaseAll();
+    delete m_workers;
+}
+
+void SliceScaler::setThreadCount(int thread_cnt) {
+    m_thread_cnt = thread_cnt < 1 ? 1 : thread_cnt;
+}
+
+bool SliceScaler::scale(const AVFrame* src, AVFrame* dst, int flags) {
+    int thread_cnt = m_thread_cnt;
+    if(thread_cnt != m_configured_threads) {
+        // bands and threaded contexts depend on the thread count
+        releaseAll();
+        m_configured_threads = thread_cnt;
+    }
+    Config* config = findConfig(src, dst, flags);
+    if(config == NULL) {
+        config = configure(src, dst, flags, thread_cnt);
+        if(config == NULL) {
+            return false;
+        }
+    }
+    if(!config->slices.empty()) {
+        m_workers->run(config->slices.size(), [&](int i) {
+            scaleSlice(config->slices[i], src, dst);
+        });
+        return true;
+    }
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+    if(thread_cnt > 1) {
+        // threaded contexts only split the work through the frame API
+        return sws_scale_frame(config->ctx, dst, src) >= 0;
+    }
+#endif
+    return sws_scale(config->ctx, src->data, src->linesize, 0, src->height, dst->data, dst->linesize) > 0;
+}
+
+SliceScaler::Config* SliceScaler::findConfig(const AVFrame* src, const AVFrame* dst, int flags) {
+    for(auto it = m_configs.begin(); it != m_configs.end(); ++it) {
+        Config* config = *it;
+        if(src->width == config->src_w && src->height == config->src_h && src->format == config->src_fmt
+                && dst->width == config->dst_w && dst->height == config->dst_h && dst->format == config->dst_fmt
+                && flags == config->flags) {
+            // move to the front, the last entry is the one evicted
+            m_configs.erase(it);
+            m_configs.insert(m_configs.begin(), config);
+            return config;
+        }
+    }
+    return NULL;
+}
+
+SliceScaler::Config* SliceScaler::configure(const AVFrame* src, const AVFrame* dst, int flags, int thread_cnt) {
+    Config* config = new Config();
+    config->src_w = src->width;
+    config->src_h = src->height;
+    config->src_fmt = src->format;
+    config->dst_w = dst->width;
+    config->dst_h = dst->height;
+    config->dst_fmt = dst->format;
+    config->flags = flags;
+    config->ctx = NULL;
+
+    bool ok = false;
+    int slice_cnt = std::min(thread_cnt, src->height / SLICE_ALIGN);
+    if(slice_cnt > 1 && canSlice(src, dst)) {
+        if(m_workers == NULL || m_workers->getThreadCount() != thread_cnt - 1) {
+            delete m_workers;
+            m_workers = new WorkerPool(thread_cnt - 1);
+        }
+        int slice_h = (src->height + slice_cnt - 1) / slice_cnt;
+        slice_h = (slice_h + SLICE_ALIGN - 1) / SLICE_ALIGN * SLICE_ALIGN;
+        ok = true;
+        for(int y = 0; y < src->height; y += slice_h) {
+            Slice slice;
+            slice.src_y = y;
+            slice.dst_y = y;
+            slice.height = std::min(slice_h, src->height - y);
+            slice.ctx = sws_getContext(src->width, slice.height, (AVPixelFormat)src->format,
+                                       dst->width, slice.height, (AVPixelFormat)dst->format,
+                                       flags, NULL, NULL, NULL);
+            if(slice.ctx == NULL) {
+                std::cout << TAG << ": sws_getContext failed for slice at " << y << std::endl;
+                ok = false;
+                break;
+            }
+            config->slices.push_back(slice);
+        }
+    }
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+    else if(thread_cnt > 1) {
+        config->ctx = sws_alloc_context();
+        av_opt_set_int(config->ctx, "srcw", src->width, 0);
+        av_opt_set_int(config->ctx, "srch", src->height, 0);
+        av_opt_set_int(config->ctx, "src_format", src->format, 0);
+        av_opt_set_int(config->ctx, "dstw", dst->width, 0);
+        av_opt_set_int(config->ctx, "dsth", dst->height, 0);
+        av_opt_set_int(config->ctx, "dst_format", dst->format, 0);
+        av_opt_set_int(config->ctx, "sws_flags", flags, 0);
+        av_opt_set_int(config->ctx, "threads", thread_cnt, 0);
+        ok = sws_init_context(config->ctx, NULL, NULL) >= 0;
+        if(!ok) {
+            std::cout << TAG << ": sws_init_context failed" << std::endl;
+        }
+    }
+#endif
+    else {
+        config->ctx = sws_getContext(src->width, src->height, (AVPixelFormat)src->format,
+                                     dst->width, dst->height, (AVPixelFormat)dst->format,
+                                     flags, NULL, NULL, NULL);
+        ok = config->ctx != NULL;
+        if(!ok) {
+            std::cout << TAG << ": sws_getContext failed" << std::endl;
+        }
+    }
+    if(!ok) {
+        release(config);
+        return NULL;
+    }
+    if(m_configs.size() >= MAX_CONFIGS) {
+        release(m_configs.back());
+        m_configs.pop_back();
+    }
+    m_configs.insert(m_configs.begin(), config);
+    return config;
+}
+
+bool SliceScaler::canSlice(const AVFrame* src, const AVFrame* dst) {
+    // bands are independent only if no output row needs rows of a neighbouring band
+    auto src_desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    auto dst_desc = av_pix_fmt_desc_get((AVPixelFormat)dst->format);
+    if(src_desc == NULL || dst_desc == NULL) {
+        return false;
+    }
+    return src->height == dst->height
+            && src_desc->log2_chroma_h == dst_desc->log2_chroma_h
+            && !(src_desc->flags & AV_PIX_FMT_FLAG_HWACCEL)
+            && !(dst_desc->flags & AV_PIX_FMT_FLAG_BITSTREAM);
+}
+
+void SliceScaler::scaleSlice(const Slice& slice, const AVFrame* src, AVFrame* dst) {
+    const uint8_t* src_planes[4] = { NULL };
+    uint8_t* dst_planes[4] = { NULL };
+    auto src_desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    auto dst_desc = av_pix_fmt_desc_get((AVPixelFormat)dst->format);
+
+    for(int i = 0; i < 4; i++) {
+        // planes 1 and 2 carry chroma and may be subsampled vertically
+        int src_shift = (i == 1 || i == 2) ? src_desc->log2_chroma_h : 0;
+        int dst_shift = (i == 1 || i == 2) ? dst_desc->log2_chroma_h : 0;
+        if(src->data[i] != NULL) {
+            src_planes[i] = src->data[i] + (slice.src_y >> src_shift) * src->linesize[i];
+        }
+        if(dst->data[i] != NULL) {
+            dst_planes[i] = dst->data[i] + (slice.dst_y >> dst_shift) * dst->linesize[i];
+        }
+    }
+    sws_scale(slice.ctx, src_planes, src->linesize, 0, slice.height, dst_planes, dst->linesize);
+}
+
+void SliceScaler::release(Config* config) {
+    for(auto& slice : config->slices) {
+        sws_freeContext(slice.ctx);
+    }
+    sws_freeContext(config->ctx);
+    delete config;
+}
+
+void SliceScaler::releaseAll() {
+    for(auto config : m_configs) {
+        release(config);
+    }
+    m_configs.clear();
+}
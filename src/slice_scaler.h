@@ -0,0 +1,72 @@
+#ifndef SLICE_SCALER_H
+#define SLICE_SCALER_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+#include <vector>
+#include <atomic>
+
+#include "worker_pool.h"
+
+// sws_scale split into horizontal bands run on a persistent WorkerPool.
+// Output is bit-identical to a single sws_scale call:
+//  - without vertical scaling every band gets its own SwsContext, rows do
+//    not depend on their neighbours then;
+//  - with vertical scaling swscale's own slice threading is used when the
+//    library has it (libswscale >= 6), otherwise a single context.
+// Contexts are kept for the last few configurations, so an output that
+// switches back and forth between sizes does not rebuild them.
+class SliceScaler
+{
+public:
+    explicit SliceScaler();
+    ~SliceScaler();
+
+    // Number of threads, the caller's included; applied on the next scale()
+    void setThreadCount(int thread_cnt);
+
+    // Scales the whole src frame into dst, which has its planes, size and format set
+    bool scale(const AVFrame* src, AVFrame* dst, int flags);
+
+private:
+    struct Slice {
+        SwsContext* ctx;
+        int src_y;
+        int dst_y;
+        int height;
+    };
+
+    // contexts built for one (src fmt, src size, dst fmt, dst size, flags)
+    struct Config {
+        int src_w, src_h, src_fmt;
+        int dst_w, dst_h, dst_fmt;
+        int flags;
+        std::vector<Slice>  slices;
+        SwsContext*         ctx;
+    };
+
+    Config* findConfig(const AVFrame* src, const AVFrame* dst, int flags);
+    Config* configure(const AVFrame* src, const AVFrame* dst, int flags, int thread_cnt);
+    bool canSlice(const AVFrame* src, const AVFrame* dst);
+    void scaleSlice(const Slice& slice, const AVFrame* src, AVFrame* dst);
+    static void release(Config* config);
+    void releaseAll();
+
+    // most recently used first
+    std::vector<Config*> m_configs;
+    WorkerPool*         m_workers;
+    std::atomic<int>    m_thread_cnt;
+    // thread count the cached contexts were built for
+    int                 m_configured_threads;
+
+    // band heights stay multiples of this, covers chroma subsampling and dither phase
+    static constexpr const int SLICE_ALIGN = 16;
+    static constexpr const size_t MAX_CONFIGS = 4;
+    static constexpr const char* const TAG = "SliceScaler";
+};
+
+#endif // SLICE_SCALER_H
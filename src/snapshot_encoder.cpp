@@ -0,0 +1,77 @@
+#include "snapshot_encoder.h"
+#include <iostream>
+#include <algorithm>
+
+bool SnapshotEncoder::encode(const AVFrame* frame, SnapshotFormat format, int quality, std::vector<uint8_t>& out) {
+    bool jpeg = format == SnapshotFormat::Jpeg;
+    const AVCodec* codec = avcodec_find_encoder(jpeg ? AV_CODEC_ID_MJPEG : AV_CODEC_ID_PNG);
+    if(codec == NULL) {
+        std::cout << TAG << ": no " << (jpeg ? "JPEG" : "PNG") << " encoder available" << std::endl;
+        return false;
+    }
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    AVFrame* image = av_frame_alloc();
+    bool res = false;
+    if(ctx != NULL && image != NULL) {
+        // yuvj420p is the full range 4:2:0 every JPEG decoder reads
+        image->format = jpeg ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_RGB24;
+        image->width = frame->width;
+        image->height = frame->height;
+        ctx->width = frame->width;
+        ctx->height = frame->height;
+        ctx->pix_fmt = (AVPixelFormat)image->format;
+        ctx->time_base = AVRational{ 1, 1 };
+        if(jpeg) {
+            // 100 -> qscale 2, 1 -> qscale 31
+            int qscale = 2 + (100 - std::min(100, std::max(1, quality))) * 29 / 99;
+            ctx->flags |= AV_CODEC_FLAG_QSCALE;
+            ctx->global_quality = qscale * FF_QP2LAMBDA;
+            image->quality = ctx->global_quality;
+        }
+        int ret = avcodec_open2(ctx, codec, NULL);
+        if(ret < 0) {
+            std::cout << TAG << ": avcodec_open2 " << codec->name << " failed, ret:" << ret << std::endl;
+        } else if(convert(frame, image)) {
+            res = runEncoder(ctx, image, out);
+        }
+    }
+    av_frame_free(&image);
+    avcodec_free_context(&ctx);
+    return res;
+}
+
+bool SnapshotEncoder::convert(const AVFrame* frame, AVFrame* dst) {
+    SwsContext* sws = sws_getContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+                                     dst->width, dst->height, (AVPixelFormat)dst->format,
+                                     SWS_BICUBIC, NULL, NULL, NULL);
+    if(sws == NULL || av_frame_get_buffer(dst, 32) < 0) {
+        std::cout << TAG << ": cannot convert " << av_get_pix_fmt_name((AVPixelFormat)frame->format) << std::endl;
+        sws_freeContext(sws);
+        return false;
+    }
+    sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst->data, dst->linesize);
+    sws_freeContext(sws);
+    return true;
+}
+
+bool SnapshotEncoder::runEncoder(AVCodecContext* ctx, const AVFrame* frame, std::vector<uint8_t>& out) {
+    AVPacket* packet = av_packet_alloc();
+    if(packet == NULL) {
+        return false;
+    }
+    // still image codecs give their one packet once flushed
+    int ret = avcodec_send_frame(ctx, frame);
+    if(ret >= 0) {
+        ret = avcodec_send_frame(ctx, NULL);
+    }
+    while(ret >= 0 && (ret = avcodec_receive_packet(ctx, packet)) == 0) {
+        out.insert(out.end(), packet->data, packet->data + packet->size);
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    if(ret != AVERROR_EOF || out.empty()) {
+        std::cout << TAG << ": " << ctx->codec->name << " encode failed, ret:" << ret << std::endl;
+        return false;
+    }
+    return true;
+}
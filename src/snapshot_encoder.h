@@ -0,0 +1,35 @@
+#ifndef SNAPSHOT_ENCODER_H
+#define SNAPSHOT_ENCODER_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+}
+
+#include <vector>
+#include <stdint.h>
+
+enum class SnapshotFormat { Jpeg, Png };
+
+// Still image of a decoded frame, at its own size: JPEG (4:2:0, full
+// range) or PNG (rgb24) through libavcodec. Runs on the snapshot workers,
+// every call sets up and frees its own converter and encoder.
+class SnapshotEncoder
+{
+public:
+    // quality 1..100, JPEG only; out gets the whole file image
+    static bool encode(const AVFrame* frame, SnapshotFormat format, int quality, std::vector<uint8_t>& out);
+
+    static constexpr const int DEFAULT_QUALITY = 90;
+
+private:
+    // frame converted into dst's format, dst gets its own buffer
+    static bool convert(const AVFrame* frame, AVFrame* dst);
+    static bool runEncoder(AVCodecContext* ctx, const AVFrame* frame, std::vector<uint8_t>& out);
+
+    static constexpr const char* const TAG = "SnapshotEncoder";
+};
+
+#endif // SNAPSHOT_ENCODER_H
@@ -0,0 +1,588 @@
+#ifdef __linux__
+
+#include "v4l2_capture.h"
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <iterator>
+#include <algorithm>
+#include <linux/videodev2.h>
+
+namespace {
+
+struct FormatMap {
+    uint32_t fourcc;
+    AVPixelFormat pix_fmt;
+    AVCodecID codec_id;
+};
+
+// raw formats in order of preference
+const FormatMap RAW_FORMATS[] = {
+    { V4L2_PIX_FMT_YUYV,   AV_PIX_FMT_YUYV422, AV_CODEC_ID_RAWVIDEO },
+    { V4L2_PIX_FMT_UYVY,   AV_PIX_FMT_UYVY422, AV_CODEC_ID_RAWVIDEO },
+    { V4L2_PIX_FMT_NV12,   AV_PIX_FMT_NV12,    AV_CODEC_ID_RAWVIDEO },
+    { V4L2_PIX_FMT_YUV420, AV_PIX_FMT_YUV420P, AV_CODEC_ID_RAWVIDEO },
+};
+
+const FormatMap MJPEG_FORMAT = { V4L2_PIX_FMT_MJPEG, AV_PIX_FMT_NONE, AV_CODEC_ID_MJPEG };
+const FormatMap H264_FORMAT  = { V4L2_PIX_FMT_H264,  AV_PIX_FMT_NONE, AV_CODEC_ID_H264 };
+
+// offered for devices that take any size in a range
+const int COMMON_SIZES[][2] = {
+    { 320, 240 }, { 640, 360 }, { 640, 480 }, { 800, 600 },
+    { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 },
+};
+
+const FormatMap* findFormat(uint32_t fourcc) {
+    for(const FormatMap& map : RAW_FORMATS) {
+        if(map.fourcc == fourcc) {
+            return &map;
+        }
+    }
+    if(fourcc == MJPEG_FORMAT.fourcc) {
+        return &MJPEG_FORMAT;
+    }
+    return fourcc == H264_FORMAT.fourcc ? &H264_FORMAT : NULL;
+}
+
+// the name a CaptureMode carries
+std::string getFormatName(const FormatMap& map) {
+    if(map.codec_id == AV_CODEC_ID_RAWVIDEO) {
+        return av_get_pix_fmt_name(map.pix_fmt);
+    }
+    return avcodec_get_name(map.codec_id);
+}
+
+std::vector<FormatMap> getCandidates(InputFormat preferred, bool large) {
+    std::vector<FormatMap> raw(std::begin(RAW_FORMATS), std::end(RAW_FORMATS));
+    std::vector<FormatMap> res;
+    switch(preferred) {
+    case InputFormat::Raw:
+        res = raw;
+        res.push_back(MJPEG_FORMAT);
+        res.push_back(H264_FORMAT);
+        break;
+    case InputFormat::Mjpeg:
+        res.push_back(MJPEG_FORMAT);
+        res.push_back(H264_FORMAT);
+        res.insert(res.end(), raw.begin(), raw.end());
+        break;
+    case InputFormat::H264:
+        res.push_back(H264_FORMAT);
+        res.push_back(MJPEG_FORMAT);
+        res.insert(res.end(), raw.begin(), raw.end());
+        break;
+    default:
+        if(large) {
+            // MJPEG decodes cheaper than H.264 and has no inter-frame latency
+            res.push_back(MJPEG_FORMAT);
+            res.push_back(H264_FORMAT);
+            res.insert(res.end(), raw.begin(), raw.end());
+        } else {
+            res = raw;
+            res.push_back(MJPEG_FORMAT);
+            res.push_back(H264_FORMAT);
+        }
+        break;
+    }
+    return res;
+}
+
+}
+
+V4l2Capture::V4l2Capture() {
+    m_fd = -1;
+    m_buffers = NULL;
+    m_buffer_cnt = 0;
+    m_dequeued = -1;
+    m_bytes_used = 0;
+    m_streaming = false;
+    m_fourcc = 0;
+    m_bytes_per_line = 0;
+    m_width = 0;
+    m_height = 0;
+    m_pix_fmt = AV_PIX_FMT_NONE;
+    m_codec_id = AV_CODEC_ID_NONE;
+    m_frame = av_frame_alloc();
+    m_taken_cnt = 0;
+}
+
+V4l2Capture::~V4l2Capture() {
+    close();
+    av_frame_free(&m_frame);
+}
+
+bool V4l2Capture::open(const std::string& device, int width, int height, int fps,
+                       InputFormat preferred, const std::string& format) {
+    m_fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(m_fd < 0) {
+        std::cout << TAG << ": open " << device << " failed, errno:" << errno << std::endl;
+        return false;
+    }
+    v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if(xioctl(m_fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        std::cout << TAG << ": VIDIOC_QUERYCAP failed" << std::endl;
+        close();
+        return false;
+    }
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if(!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        std::cout << TAG << ": " << device << " is not a streaming capture device" << std::endl;
+        close();
+        return false;
+    }
+    if(!setFormat(width, height, preferred, format)) {
+        close();
+        return false;
+    }
+    setFrameRate(fps);
+    // releases of an earlier stream do not reach this one
+    m_released = std::make_shared<ReleasedBuffers>();
+    m_taken_cnt = 0;
+    if(!initBuffers()) {
+        close();
+        return false;
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(xioctl(m_fd, VIDIOC_STREAMON, &type) < 0) {
+        std::cout << TAG << ": VIDIOC_STREAMON failed, errno:" << errno << std::endl;
+        close();
+        return false;
+    }
+    m_streaming = true;
+    return true;
+}
+
+void V4l2Capture::close() {
+    if(m_fd < 0) {
+        return;
+    }
+    if(m_streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+        m_streaming = false;
+    }
+    freeBuffers();
+    ::close(m_fd);
+    m_fd = -1;
+    m_dequeued = -1;
+    av_frame_unref(m_frame);
+}
+
+AVFrame* V4l2Capture::readFrame(int timeout_ms) {
+    if(m_fd < 0) {
+        return NULL;
+    }
+    // the caller is done with the previous buffer
+    if(m_dequeued >= 0) {
+        queueBuffer(m_dequeued);
+        m_dequeued = -1;
+    }
+    requeueReleased();
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret <= 0 || !(pfd.revents & POLLIN)) {
+        return NULL;
+    }
+    int index = dequeueBuffer();
+    if(index < 0) {
+        return NULL;
+    }
+    // skip to the newest ready buffer
+    int newer = -1;
+    while((newer = dequeueBuffer()) >= 0) {
+        queueBuffer(index);
+        index = newer;
+    }
+    m_dequeued = index;
+    if(isCompressed()) {
+        return NULL;
+    }
+    fillFrame(index);
+    return m_frame;
+}
+
+void V4l2Capture::discardReady() {
+    if(m_fd < 0) {
+        return;
+    }
+    if(m_dequeued >= 0) {
+        queueBuffer(m_dequeued);
+        m_dequeued = -1;
+    }
+    requeueReleased();
+    int index = -1;
+    while((index = dequeueBuffer()) >= 0) {
+        queueBuffer(index);
+    }
+}
+
+const uint8_t* V4l2Capture::getData() {
+    return m_dequeued >= 0 ? (const uint8_t*)m_buffers[m_dequeued].start : NULL;
+}
+
+uint32_t V4l2Capture::getDataSize() {
+    return m_dequeued >= 0 ? m_bytes_used : 0;
+}
+
+AVBufferRef* V4l2Capture::takeData() {
+    // two stay with the driver whatever it granted, so capture never starves
+    if(m_dequeued < 0 || m_taken_cnt >= std::min(+DECODER_BUFFERS, m_buffer_cnt - 2)) {
+        return NULL;
+    }
+    // refcounted packets are expected to come padded, zeroed so that no
+    // stale bytes of an older frame look like a marker to the parser
+    MappedBuffer& buffer = m_buffers[m_dequeued];
+    if(m_bytes_used + AV_INPUT_BUFFER_PADDING_SIZE > buffer.length) {
+        return NULL;
+    }
+    memset((uint8_t*)buffer.start + m_bytes_used, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    TakenBuffer* taken = new TakenBuffer{ m_released, m_dequeued };
+    AVBufferRef* ref = av_buffer_create((uint8_t*)buffer.start, m_bytes_used,
+                                        releaseData, taken, AV_BUFFER_FLAG_READONLY);
+    if(ref == NULL) {
+        delete taken;
+        return NULL;
+    }
+    m_taken_cnt++;
+    m_dequeued = -1;
+    return ref;
+}
+
+void V4l2Capture::releaseData(void* opaque, uint8_t* data) {
+    // decoder threads drop their packets too, the capture thread requeues
+    TakenBuffer* taken = (TakenBuffer*)opaque;
+    {
+        std::lock_guard<std::mutex> lk(taken->released->lock);
+        taken->released->indices.push_back(taken->index);
+    }
+    delete taken;
+}
+
+void V4l2Capture::requeueReleased() {
+    std::vector<int> indices;
+    {
+        std::lock_guard<std::mutex> lk(m_released->lock);
+        indices.swap(m_released->indices);
+    }
+    for(int index : indices) {
+        m_taken_cnt--;
+        queueBuffer(index);
+    }
+}
+
+int64_t V4l2Capture::getTimestampUs() {
+    return m_dequeued >= 0 ? m_frame->pts : AV_NOPTS_VALUE;
+}
+
+int V4l2Capture::getWidth() {
+    return m_width;
+}
+
+int V4l2Capture::getHeight() {
+    return m_height;
+}
+
+AVPixelFormat V4l2Capture::getPixFmt() {
+    return m_pix_fmt;
+}
+
+AVCodecID V4l2Capture::getCodecId() {
+    return m_codec_id;
+}
+
+bool V4l2Capture::isCompressed() {
+    return m_codec_id != AV_CODEC_ID_RAWVIDEO;
+}
+
+bool V4l2Capture::setFormat(int width, int height, InputFormat preferred, const std::string& format) {
+    auto candidates = getCandidates(preferred, width * height > RAW_MAX_PIXELS);
+    for(auto it = candidates.begin(); it != candidates.end(); ++it) {
+        if(getFormatName(*it) == format) {
+            // the native mode picked for this size goes first
+            std::rotate(candidates.begin(), it, it + 1);
+            break;
+        }
+    }
+    for(const FormatMap& map : candidates) {
+        v4l2_format fmt;
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = map.fourcc;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if(xioctl(m_fd, VIDIOC_S_FMT, &fmt) < 0) {
+            continue;
+        }
+        // the driver answers with the closest format it supports
+        if(fmt.fmt.pix.pixelformat != map.fourcc) {
+            continue;
+        }
+        m_fourcc = map.fourcc;
+        m_pix_fmt = map.pix_fmt;
+        m_codec_id = map.codec_id;
+        m_width = fmt.fmt.pix.width;
+        m_height = fmt.fmt.pix.height;
+        m_bytes_per_line = fmt.fmt.pix.bytesperline;
+        std::cout << TAG << ": format " << m_width << "x" << m_height
+                  << ", fourcc:" << std::string((const char*)&m_fourcc, 4) << std::endl;
+        return true;
+    }
+    std::cout << TAG << ": no supported pixel format" << std::endl;
+    return false;
+}
+
+void V4l2Capture::setFrameRate(int fps) {
+    v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(xioctl(m_fd, VIDIOC_G_PARM, &parm) < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+        return;
+    }
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = fps;
+    xioctl(m_fd, VIDIOC_S_PARM, &parm);
+}
+
+bool V4l2Capture::initBuffers() {
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = isCompressed() ? BUFFER_COUNT + DECODER_BUFFERS : BUFFER_COUNT;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if(xioctl(m_fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        std::cout << TAG << ": VIDIOC_REQBUFS failed, errno:" << errno << std::endl;
+        return false;
+    }
+    m_buffers = new MappedBuffer[req.count];
+    memset(m_buffers, 0, sizeof(MappedBuffer) * req.count);
+    for(uint32_t i = 0; i < req.count; i++) {
+        v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if(xioctl(m_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            std::cout << TAG << ": VIDIOC_QUERYBUF failed" << std::endl;
+            return false;
+        }
+        void* start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+        if(start == MAP_FAILED) {
+            std::cout << TAG << ": mmap failed, errno:" << errno << std::endl;
+            return false;
+        }
+        m_buffers[i].start = start;
+        m_buffers[i].length = buf.length;
+        m_buffer_cnt++;
+        if(!queueBuffer(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void V4l2Capture::freeBuffers() {
+    if(m_buffers == NULL) {
+        return;
+    }
+    for(uint32_t i = 0; i < m_buffer_cnt; i++) {
+        munmap(m_buffers[i].start, m_buffers[i].length);
+    }
+    delete[] m_buffers;
+    m_buffers = NULL;
+    m_buffer_cnt = 0;
+
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(m_fd, VIDIOC_REQBUFS, &req);
+}
+
+bool V4l2Capture::queueBuffer(int index) {
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if(xioctl(m_fd, VIDIOC_QBUF, &buf) < 0) {
+        std::cout << TAG << ": VIDIOC_QBUF failed, errno:" << errno << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int V4l2Capture::dequeueBuffer() {
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if(xioctl(m_fd, VIDIOC_DQBUF, &buf) < 0) {
+        if(errno != EAGAIN) {
+            std::cout << TAG << ": VIDIOC_DQBUF failed, errno:" << errno << std::endl;
+        }
+        return -1;
+    }
+    if(buf.flags & V4L2_BUF_FLAG_ERROR) {
+        queueBuffer(buf.index);
+        return -1;
+    }
+    m_bytes_used = buf.bytesused;
+    m_frame->pts = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    return buf.index;
+}
+
+void V4l2Capture::fillFrame(int index) {
+    uint8_t* base = (uint8_t*)m_buffers[index].start;
+    int stride = m_bytes_per_line;
+
+    memset(m_frame->data, 0, sizeof(m_frame->data));
+    memset(m_frame->linesize, 0, sizeof(m_frame->linesize));
+    m_frame->data[0] = base;
+    m_frame->linesize[0] = stride;
+    switch(m_pix_fmt) {
+    case AV_PIX_FMT_NV12:
+        m_frame->data[1] = base + stride * m_height;
+        m_frame->linesize[1] = stride;
+        break;
+    case AV_PIX_FMT_YUV420P:
+        m_frame->data[1] = base + stride * m_height;
+        m_frame->linesize[1] = stride / 2;
+        m_frame->data[2] = m_frame->data[1] + (stride / 2) * (m_height / 2);
+        m_frame->linesize[2] = stride / 2;
+        break;
+    default:
+        break;
+    }
+    m_frame->width = m_width;
+    m_frame->height = m_height;
+    m_frame->format = m_pix_fmt;
+}
+
+bool V4l2Capture::enumModes(const std::string& device, std::vector<CaptureMode>& modes) {
+    int fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0) {
+        std::cout << TAG << ": open " << device << " failed, errno:" << errno << std::endl;
+        return false;
+    }
+    for(uint32_t i = 0; ; i++) {
+        v4l2_fmtdesc desc;
+        memset(&desc, 0, sizeof(desc));
+        desc.index = i;
+        desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if(xioctl(fd, VIDIOC_ENUM_FMT, &desc) < 0) {
+            break;
+        }
+        const FormatMap* map = findFormat(desc.pixelformat);
+        if(map == NULL) {
+            // nothing here could capture it
+            continue;
+        }
+        enumSizes(fd, map->fourcc, getFormatName(*map), map->codec_id != AV_CODEC_ID_RAWVIDEO, modes);
+    }
+    ::close(fd);
+    return !modes.empty();
+}
+
+void V4l2Capture::enumSizes(int fd, uint32_t fourcc, const std::string& format, bool compressed,
+                            std::vector<CaptureMode>& modes) {
+    auto addMode = [&](int width, int height) {
+        CaptureMode mode;
+        mode.format = format;
+        mode.compressed = compressed;
+        mode.width = width;
+        mode.height = height;
+        enumFrameRates(fd, fourcc, mode);
+        modes.push_back(mode);
+    };
+    for(uint32_t i = 0; ; i++) {
+        v4l2_frmsizeenum size;
+        memset(&size, 0, sizeof(size));
+        size.index = i;
+        size.pixel_format = fourcc;
+        if(xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) < 0) {
+            break;
+        }
+        if(size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            addMode(size.discrete.width, size.discrete.height);
+            continue;
+        }
+        // stepwise and continuous come as a single range
+        const v4l2_frmsize_stepwise& range = size.stepwise;
+        for(auto& common : COMMON_SIZES) {
+            if((uint32_t)common[0] >= range.min_width && (uint32_t)common[0] < range.max_width
+                    && (uint32_t)common[1] >= range.min_height && (uint32_t)common[1] < range.max_height) {
+                addMode(common[0], common[1]);
+            }
+        }
+        addMode(range.max_width, range.max_height);
+        break;
+    }
+}
+
+void V4l2Capture::enumFrameRates(int fd, uint32_t fourcc, CaptureMode& mode) {
+    mode.min_fps = 0;
+    mode.max_fps = 0;
+    auto addInterval = [&](const v4l2_fract& interval) {
+        if(interval.numerator == 0) {
+            return;
+        }
+        double fps = (double)interval.denominator / interval.numerator;
+        mode.min_fps = mode.min_fps > 0 ? std::min(mode.min_fps, fps) : fps;
+        mode.max_fps = std::max(mode.max_fps, fps);
+    };
+    for(uint32_t i = 0; ; i++) {
+        v4l2_frmivalenum ival;
+        memset(&ival, 0, sizeof(ival));
+        ival.index = i;
+        ival.pixel_format = fourcc;
+        ival.width = mode.width;
+        ival.height = mode.height;
+        if(xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0) {
+            break;
+        }
+        if(ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            addInterval(ival.discrete);
+            continue;
+        }
+        addInterval(ival.stepwise.min);
+        addInterval(ival.stepwise.max);
+        break;
+    }
+}
+
+std::string V4l2Capture::getDeviceId(const std::string& device) {
+    int fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0) {
+        return "v4l2:" + device;
+    }
+    v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    std::string id = "v4l2:" + device;
+    if(xioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+        id = std::string("v4l2:") + (const char*)cap.card + "@" + (const char*)cap.bus_info;
+    }
+    ::close(fd);
+    return id;
+}
+
+int V4l2Capture::xioctl(int fd, unsigned long request, void* arg) {
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while(ret < 0 && errno == EINTR);
+    return ret;
+}
+
+#endif // __linux__
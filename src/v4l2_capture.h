@@ -0,0 +1,134 @@
+#ifndef V4L2_CAPTURE_H
+#define V4L2_CAPTURE_H
+
+#ifdef __linux__
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/frame.h"
+#include "libavcodec/avcodec.h"
+}
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include "device_caps.h"
+#include "input_format.h"
+
+// Streams a V4L2 device through mmap'd kernel buffers.
+// Raw frames are handed out as AVFrames whose planes point straight into
+// the mapped buffer, so nothing is copied between the driver and the scaler.
+// The dequeued buffer is given back to the driver on the next readFrame()
+// or on close(), so at most one buffer is ever held by the caller, unless
+// its payload was taken with takeData(): compressed buffers then go to the
+// decoder by reference and return to the driver once it drops them.
+class V4l2Capture
+{
+public:
+    explicit V4l2Capture();
+    ~V4l2Capture();
+
+    // format names a native format (CaptureMode::format) tried before the preferred ones
+    bool open(const std::string& device, int width, int height, int fps,
+              InputFormat preferred = InputFormat::Auto, const std::string& format = "");
+    void close();
+
+    // Every format, size and frame rate range of device that can be captured
+    static bool enumModes(const std::string& device, std::vector<CaptureMode>& modes);
+    // card name and bus, stable across reboots unlike the node number
+    static std::string getDeviceId(const std::string& device);
+
+    // Waits up to timeout_ms for a filled buffer; returns NULL on timeout or error.
+    // When several buffers are ready only the newest is kept, older ones go
+    // straight back to the driver.
+    AVFrame* readFrame(int timeout_ms);
+    // requeues every filled buffer without waiting, the driver refills them with newer frames
+    void discardReady();
+
+    // Payload of the last dequeued buffer, for compressed formats
+    const uint8_t* getData();
+    uint32_t getDataSize();
+    // The last dequeued buffer as a reference on the mapping, nothing is
+    // copied; the buffer is requeued after the last reference is dropped,
+    // from any thread, and getData() no longer returns it. NULL when
+    // DECODER_BUFFERS are out already, the caller copies getData() then.
+    // Every reference has to be dropped before close().
+    AVBufferRef* takeData();
+    // driver timestamp of that buffer in microseconds, CLOCK_MONOTONIC for most drivers
+    int64_t getTimestampUs();
+
+    int getWidth();
+    int getHeight();
+    AVPixelFormat getPixFmt();
+    AVCodecID getCodecId();
+    bool isCompressed();
+
+private:
+    bool setFormat(int width, int height, InputFormat preferred, const std::string& format);
+    void setFrameRate(int fps);
+    bool initBuffers();
+    void freeBuffers();
+    bool queueBuffer(int index);
+    int dequeueBuffer();
+    void fillFrame(int index);
+    // requeues the buffers whose last reference was dropped
+    void requeueReleased();
+    static void releaseData(void* opaque, uint8_t* data);
+
+    static int xioctl(int fd, unsigned long request, void* arg);
+    static void enumSizes(int fd, uint32_t fourcc, const std::string& format, bool compressed,
+                          std::vector<CaptureMode>& modes);
+    static void enumFrameRates(int fd, uint32_t fourcc, CaptureMode& mode);
+
+    struct MappedBuffer {
+        void* start;
+        size_t length;
+    };
+
+    // indices of taken buffers whose last reference was dropped; shared
+    // with the references so a late release after close() is harmless
+    struct ReleasedBuffers {
+        std::mutex lock;
+        std::vector<int> indices;
+    };
+    // opaque of a takeData() reference
+    struct TakenBuffer {
+        std::shared_ptr<ReleasedBuffers> released;
+        int index;
+    };
+
+    int m_fd;
+    MappedBuffer* m_buffers;
+    uint32_t m_buffer_cnt;
+    int m_dequeued;
+    uint32_t m_bytes_used;
+    bool m_streaming;
+
+    uint32_t m_fourcc;
+    uint32_t m_bytes_per_line;
+    int m_width;
+    int m_height;
+    AVPixelFormat m_pix_fmt;
+    AVCodecID m_codec_id;
+    AVFrame* m_frame;
+    std::shared_ptr<ReleasedBuffers> m_released;
+    // taken and not requeued yet, capture thread only
+    uint32_t m_taken_cnt;
+
+    // small and fixed, so the driver never sits on a backlog of stale frames
+    static constexpr const uint32_t BUFFER_COUNT = 4;
+    // added for compressed formats: a frame threaded decoder keeps the
+    // packets of the frames in flight, one per thread
+    static constexpr const uint32_t DECODER_BUFFERS = 4;
+    // above this many pixels Auto asks for compressed formats first
+    static constexpr const int RAW_MAX_PIXELS = 640 * 480;
+    static constexpr const char* const TAG = "V4l2Capture";
+};
+
+#endif // __linux__
+
+#endif // V4L2_CAPTURE_H
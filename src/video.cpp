@@ -1,4 +1,5 @@
 #include "video.h"
+#include <algorithm>
 #include <chrono>
 
 Video::Video() {
@@ -8,50 +9,440 @@ Video::Video() {
 
     m_video_cap_thread = NULL;
     m_video_dispather_thread = NULL;
-    m_video_cap_tr_run = false;
-    m_video_dispather_tr_run = false;
-    m_dimention_height = DEFAULT_HEIGHT;
-    m_dimention_width = DEFAULT_WIDTH;
-    m_outFrameBusSize = 0;
     m_errors = 0;
     m_frames_cnt = 0;
+    m_metrics = std::make_shared<PipelineMetrics>();
+    m_capture_fps = 0;
+    m_delivered_fps = 0;
+    m_decode_avg_us = 0;
+    m_last_frames_cnt = 0;
+    m_last_delivered_cnt = 0;
+    m_last_record_bytes = 0;
+    m_record_throughput = 0;
+    m_input_format = InputFormat::Auto;
+    m_has_capture_mode = false;
+    m_next_output_id = DEFAULT_OUTPUT_ID + 1;
+    m_scale_threads = 0;
+    m_snapshot_pending = false;
+    m_snapshot_workers = NULL;
+    m_snapshot_width = 0;
+    m_snapshot_height = 0;
+    m_outputs.push_back(std::make_shared<VideoOutput>(+DEFAULT_OUTPUT_ID, +DEFAULT_WIDTH, +DEFAULT_HEIGHT,
+                                                      OutputFormat::Rgb32, +DEFAULT_TARGET_FPS));
+    setScaleThreads(0);
+    m_start_latency_ms = 0;
+    m_stop_latency_ms = 0;
+    m_input_format_name = "none";
+    m_decode_time_us = 0;
+    m_decode_cnt = 0;
+    m_encode_packet_cnt = 0;
+    m_encode_err_cnt = 0;
+    m_encode_bytes = 0;
+    m_encode_bitrate = 0;
+    m_last_stats_time = std::chrono::steady_clock::now();
     // start dispatcher
     m_video_dispather_thread = procDispatcherThread();
-    m_video_dispather_thread->detach();
 }
 
 Video::~Video() {
-    m_state = VideoState::Destruction;
-    waitToStop();
+    pushCommand(CommandType::Exit);
+    // the dispatcher joins the capture thread before it returns
+    m_video_dispather_thread->join();
+    delete m_video_dispather_thread;
+    // snapshots already taken are encoded and handed out first
+    delete m_snapshot_workers;
 }
 
 void Video::startVideoCamera() {
-    Command command;
-    command.type = CommandType::Stop;
-    m_command_queue.push(command);
-    command.type = CommandType::StartCamera;
-    m_command_queue.push(command);
+    // a running capture is restarted by the dispatcher
+    pushCommand(CommandType::StartCamera);
+}
+
+void Video::prewarm() {
+    pushCommand(CommandType::Prewarm);
 }
 
 void Video::stopVideo() {
-    Command command;
-    command.type = CommandType::Stop;
-    m_command_queue.push(command);
+    pushCommand(CommandType::Stop);
 }
 
 void Video::setResolution(int width, int height) {
-    Command command;
-    command.type = CommandType::Stop;
-    m_command_queue.push(command);
-    //
-    m_dimention_width = width;
-    m_dimention_height = height;
-    //
-    command.type = CommandType::StartCamera;
-    m_command_queue.push(command);
+    setOutputResolution(DEFAULT_OUTPUT_ID, width, height);
+}
+
+void Video::setOutputFormat(OutputFormat format) {
+    setOutputFormat(DEFAULT_OUTPUT_ID, format);
+}
+
+void Video::setDevice(const std::string& device) {
+    std::lock_guard<std::mutex> lk(m_device_lock);
+    m_device = device;
+}
+
+void Video::setInput(const std::string& format, const std::string& url) {
+    std::lock_guard<std::mutex> lk(m_device_lock);
+    m_input_format_override = format;
+    m_input_url = url;
+}
+
+void Video::setInputFormat(InputFormat format) {
+    m_input_format = format;
+    if(isStarted()) {
+        pushCommand(CommandType::StartCamera);
+    }
+}
+
+void Video::setTargetFps(int fps) {
+    setOutputFps(DEFAULT_OUTPUT_ID, fps);
+}
+
+void Video::setScaleThreads(int thread_cnt) {
+    if(thread_cnt <= 0) {
+        // half of the cores, the other half decodes and feeds the renderer
+        thread_cnt = std::min(MAX_SCALE_THREADS, std::max(1, av_cpu_count() / 2));
+    }
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    m_scale_threads = thread_cnt;
+    for(auto& output : m_outputs) {
+        output->setScaleThreads(thread_cnt);
+    }
+}
+
+uint32_t Video::addOutput(int width, int height, OutputFormat format, int fps) {
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    auto output = std::make_shared<VideoOutput>(m_next_output_id++, width, height, format, fps);
+    output->setScaleThreads(m_scale_threads);
+    m_outputs.push_back(output);
+    return output->getId();
+}
+
+bool Video::removeOutput(uint32_t id) {
+    if(id == DEFAULT_OUTPUT_ID) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    for(auto it = m_outputs.begin(); it != m_outputs.end(); ++it) {
+        if((*it)->getId() == id) {
+            // the capture thread may still be converting into it, it goes with the last reference
+            m_outputs.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Video::setOutputResolution(uint32_t id, int width, int height) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    // the running capture picks the size up with the next frame
+    output->setResolution(width, height);
+    if(isStarted() && needsOtherMode()) {
+        pushCommand(CommandType::StartCamera);
+    }
+    return true;
+}
+
+void Video::takeSnapshot(SnapshotFormat format, int quality,
+                         std::function<void(bool,std::vector<uint8_t>&,const char*)> done) {
+    {
+        std::lock_guard<std::mutex> lk(m_snapshot_lock);
+        // a stop that comes after this check fails the request, see failSnapshots()
+        if(isStarted()) {
+            if(m_snapshot_workers == NULL) {
+                m_snapshot_workers = new WorkerPool(+SNAPSHOT_THREADS);
+            }
+            SnapshotRequest request;
+            request.format = format;
+            request.quality = quality;
+            request.done = done;
+            m_snapshots.push_back(request);
+            m_snapshot_pending = true;
+            return;
+        }
+    }
+    std::vector<uint8_t> none;
+    done(false, none, "camera not started");
+}
+
+void Video::setSnapshotResolution(int width, int height) {
+    m_snapshot_width = std::max(0, width);
+    m_snapshot_height = std::max(0, height);
+    if(isStarted() && needsOtherMode()) {
+        pushCommand(CommandType::StartCamera);
+    }
 }
 
-void Video::setFrameCallBack(std::function<void(AVFrame*,uint32_t)> cb) {
+void Video::takeSnapshots(const AVFrame* frame) {
+    std::vector<SnapshotRequest> requests;
+    WorkerPool* workers = NULL;
+    {
+        std::lock_guard<std::mutex> lk(m_snapshot_lock);
+        requests.swap(m_snapshots);
+        m_snapshot_pending = false;
+        workers = m_snapshot_workers;
+    }
+    if(requests.empty()) {
+        return;
+    }
+    AVFrame* ref = holdSnapshotFrame(frame);
+    if(ref == NULL) {
+        std::vector<uint8_t> none;
+        for(auto& request : requests) {
+            request.done(false, none, "out of memory");
+        }
+        return;
+    }
+    workers->post([ref, requests]() mutable {
+        for(auto& request : requests) {
+            std::vector<uint8_t> data;
+            bool res = SnapshotEncoder::encode(ref, request.format, request.quality, data);
+            request.done(res, data, res ? NULL : "encoding failed");
+        }
+        av_frame_free(&ref);
+    });
+}
+
+AVFrame* Video::holdSnapshotFrame(const AVFrame* frame) {
+    if(frame->buf[0] != NULL) {
+        // shares the decoded buffer, the capture thread copies nothing
+        return av_frame_clone(frame);
+    }
+    // V4L2 raw frames have no buf[0], av_frame_clone() would allocate and
+    // copy here; the slabs of the pool are reused from the second snapshot on
+    AVPixelFormat format = (AVPixelFormat)frame->format;
+    AVFrame* copy = av_frame_alloc();
+    if(copy == NULL) {
+        return NULL;
+    }
+    copy->buf[0] = m_snapshot_pool.get(av_image_get_buffer_size(format, frame->width, frame->height, 1));
+    if(copy->buf[0] == NULL) {
+        av_frame_free(&copy);
+        return NULL;
+    }
+    av_image_fill_arrays(copy->data, copy->linesize, copy->buf[0]->data, format, frame->width, frame->height, 1);
+    av_image_copy(copy->data, copy->linesize, (const uint8_t**)frame->data, frame->linesize,
+                  format, frame->width, frame->height);
+    copy->width = frame->width;
+    copy->height = frame->height;
+    copy->format = format;
+    copy->pts = frame->pts;
+    return copy;
+}
+
+void Video::failSnapshots(const char* error) {
+    std::vector<SnapshotRequest> requests;
+    {
+        std::lock_guard<std::mutex> lk(m_snapshot_lock);
+        requests.swap(m_snapshots);
+        m_snapshot_pending = false;
+    }
+    std::vector<uint8_t> none;
+    for(auto& request : requests) {
+        request.done(false, none, error);
+    }
+}
+
+void Video::setChangeDetection(const ChangeConfig* config) {
+    m_change_detector.setConfig(config);
+}
+
+bool Video::getCapabilities(std::vector<CaptureMode>& modes, bool refresh) {
+    {
+        std::lock_guard<std::mutex> lk(m_device_lock);
+        if(!m_input_url.empty()) {
+            return false;
+        }
+    }
+    return DeviceCaps::get(getDeviceName(), modes, refresh);
+}
+
+bool Video::getCachedCapabilities(std::vector<CaptureMode>& modes) {
+    {
+        std::lock_guard<std::mutex> lk(m_device_lock);
+        if(!m_input_url.empty()) {
+            return false;
+        }
+    }
+    return DeviceCaps::getCached(getDeviceName(), modes);
+}
+
+bool Video::getCaptureMode(CaptureMode& mode) {
+    std::lock_guard<std::mutex> lk(m_device_lock);
+    if(m_has_capture_mode) {
+        mode = m_capture_mode;
+    }
+    return m_has_capture_mode;
+}
+
+void Video::getRequestedMode(int& width, int& height, int& fps) {
+    width = m_snapshot_width;
+    height = m_snapshot_height;
+    fps = 0;
+    for(auto& output : getOutputs()) {
+        int output_width, output_height;
+        output->getResolution(output_width, output_height);
+        width = std::max(width, output_width);
+        height = std::max(height, output_height);
+        fps = std::max(fps, output->getTargetFps());
+    }
+}
+
+bool Video::needsOtherMode() {
+    CaptureMode current;
+    if(!getCaptureMode(current)) {
+        // default mode or not a device, nothing to pick from
+        return false;
+    }
+    int width, height, fps;
+    getRequestedMode(width, height, fps);
+    std::vector<CaptureMode> modes;
+    CaptureMode mode;
+    // only what the open already probed, never touches the device
+    if(!DeviceCaps::getCached(getDeviceName(), modes)
+            || !DeviceCaps::pickMode(modes, width, height, fps > 0 ? fps : +DEFAULT_TARGET_FPS, m_input_format, mode)) {
+        return false;
+    }
+    return mode.format != current.format || mode.width != current.width || mode.height != current.height;
+}
+
+std::string Video::getDeviceName() {
+    std::lock_guard<std::mutex> lk(m_device_lock);
+    return !m_device.empty() ? m_device : DeviceCaps::getDefaultDevice();
+}
+
+bool Video::setOutputFormat(uint32_t id, OutputFormat format) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->setFormat(format);
+    return true;
+}
+
+bool Video::setOutputFps(uint32_t id, int fps) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->setTargetFps(fps);
+    return true;
+}
+
+bool Video::startRecording(uint32_t id, const std::string& path, RecordFormat format) {
+    auto output = findOutput(id);
+    if(output == NULL || output->getRecorder() != NULL) {
+        return false;
+    }
+    int fps = output->getTargetFps();
+    auto recorder = std::make_shared<FrameRecorder>();
+    if(!recorder->start(path, format, fps > 0 ? fps : +DEFAULT_TARGET_FPS)) {
+        return false;
+    }
+    output->setRecorder(recorder);
+    return true;
+}
+
+std::shared_ptr<FrameRecorder> Video::detachRecorder(uint32_t id) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return NULL;
+    }
+    auto recorder = output->getRecorder();
+    output->setRecorder(NULL);
+    return recorder;
+}
+
+bool Video::startSharedMemory(uint32_t id, const std::string& name, int slot_cnt) {
+    auto output = findOutput(id);
+    if(output == NULL || name.empty()) {
+        return false;
+    }
+    // the segment itself is created with the first frame, sized for it
+    output->setShmWriter(std::make_shared<ShmFrameWriter>(name, slot_cnt));
+    return true;
+}
+
+bool Video::stopSharedMemory(uint32_t id) {
+    auto output = findOutput(id);
+    if(output == NULL || output->getShmWriter() == NULL) {
+        return false;
+    }
+    // unlinked once the capture thread drops its snapshot
+    output->setShmWriter(NULL);
+    return true;
+}
+
+bool Video::setOutputScaleFlags(uint32_t id, int flags) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->setScaleFlags(flags);
+    return true;
+}
+
+bool Video::setOutputCrop(uint32_t id, int x, int y, int width, int height) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->setCrop(x, y, width, height);
+    return true;
+}
+
+bool Video::setOutputOrientation(uint32_t id, Orientation orientation) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->setOrientation(orientation);
+    return true;
+}
+
+bool Video::setOutputEncoder(uint32_t id, const EncoderConfig* config) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    return output->setEncoder(config);
+}
+
+bool Video::requestKeyframe(uint32_t id) {
+    auto output = findOutput(id);
+    if(output == NULL) {
+        return false;
+    }
+    output->requestKeyframe();
+    return true;
+}
+
+std::vector<uint32_t> Video::getOutputIds() {
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    std::vector<uint32_t> ids;
+    for(auto& output : m_outputs) {
+        ids.push_back(output->getId());
+    }
+    return ids;
+}
+
+std::shared_ptr<VideoOutput> Video::findOutput(uint32_t id) {
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    for(auto& output : m_outputs) {
+        if(output->getId() == id) {
+            return output;
+        }
+    }
+    return NULL;
+}
+
+std::vector<std::shared_ptr<VideoOutput>> Video::getOutputs() {
+    std::lock_guard<std::mutex> lk(m_outputs_lock);
+    return m_outputs;
+}
+
+void Video::setFrameCallBack(std::function<void(uint32_t,AVFrame*,uint32_t,const FrameTiming&,const ChangeMap*)> cb) {
     m_frame_callback = cb;
 }
 
@@ -59,8 +450,17 @@ void Video::setStatusCallBack(std::function<void(VideStats)> cb) {
     m_status_callback = cb;
 }
 
+void Video::setPacketCallBack(std::function<void(uint32_t,AVPacket*)> cb) {
+    m_packet_callback = cb;
+}
+
+void Video::setOpenCallBack(std::function<void(bool)> cb) {
+    m_open_callback = cb;
+}
+
 bool Video::isStarted() {
-    return m_state != VideoState::Stopped && m_state != VideoState::Destruction;
+    // a prewarmed device is open but not started
+    return m_state == VideoState::Active;
 }
 
 uint32_t Video::getPacketCount() {
@@ -68,177 +468,391 @@ uint32_t Video::getPacketCount() {
 }
 
 uint32_t Video::getErrorCount() {
-    return m_errors;
+    uint32_t errors = m_errors;
+    for(auto& output : getOutputs()) {
+        errors += output->getErrorCount();
+    }
+    return errors;
+}
+
+std::shared_ptr<PipelineMetrics> Video::getMetrics() {
+    return m_metrics;
+}
+
+void Video::pushCommand(CommandType type) {
+    Command command;
+    command.type = type;
+    command.issued = std::chrono::steady_clock::now();
+    m_commands.push(command);
+}
+
+void Video::setState(VideoState state) {
+    std::lock_guard<std::mutex> lk(m_state_lock);
+    m_state = state;
+    m_state_cv.notify_all();
+}
+
+bool Video::activatePrewarmed(std::chrono::steady_clock::time_point issued) {
+    std::lock_guard<std::mutex> lk(m_state_lock);
+    // the prewarmed open may have failed meanwhile
+    if(m_state != VideoState::Prewarmed) {
+        return false;
+    }
+    m_start_issued = issued;
+    m_state = VideoState::Active;
+    m_state_cv.notify_all();
+    return true;
+}
+
+void Video::resetStats() {
+    m_errors = 0;
+    m_frames_cnt = 0;
+    m_last_frames_cnt = 0;
+    m_last_delivered_cnt = 0;
+    m_encode_packet_cnt = 0;
+    m_encode_err_cnt = 0;
+    for(auto& output : getOutputs()) {
+        output->resetCounters();
+    }
+    m_change_detector.resetCounters();
+    m_metrics->reset();
+}
+
+void Video::joinCaptureThread() {
+    if(m_video_cap_thread != NULL) {
+        m_video_cap_thread->join();
+        delete m_video_cap_thread;
+        m_video_cap_thread = NULL;
+    }
 }
 
 std::thread* Video::procDispatcherThread() {
     return new std::thread([&] {
-        m_video_dispather_tr_run = true;
-        AVCodecContext* rxDecodeCtx = NULL;
-        SwsContext* scaleToScreenCtx = NULL;
-        AVFrame* rxRawFrame = NULL;
-        AVFrame* outToScreenFrame = NULL;
-        uint8_t* outToScreenFrameBuf = NULL;
-
-        auto clearBeforeExit([&] {
-            if(rxRawFrame != NULL) {
-                av_frame_free(&rxRawFrame);
-            }
-            if(outToScreenFrame != NULL) {
-                av_frame_free(&outToScreenFrame);
-            }
-            if(outToScreenFrameBuf != NULL) {
-                av_free(outToScreenFrameBuf);
-            }
-            if(rxDecodeCtx != NULL) {
-                avcodec_free_context(&rxDecodeCtx);
-            }
-            sws_freeContext(scaleToScreenCtx);
-            m_video_dispather_tr_run = false;
-        });
+        auto next_stats_time = std::chrono::steady_clock::now();
 
         while(m_state != VideoState::Destruction) {
             //
-            // gather statistic, handle commands
+            // handle commands as soon as they arrive, gather statistic in between
             //
-            if(!m_command_queue.empty()) {
-                Command command = m_command_queue.front();
-                m_command_queue.pop();
+            Command command;
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        next_stats_time - std::chrono::steady_clock::now());
+            if(m_commands.waitPop(command, std::max(timeout, std::chrono::milliseconds(0)))) {
                 if(command.type == CommandType::StartCamera) {
-                    m_state = VideoState::Active;
-                    // reset stats
-                    m_errors = 0;
-                    m_frames_cnt = 0;
-                    // start video capture thread
-                    m_video_cap_thread = procVideoCaptureThread();
-                    m_video_cap_thread->detach();
-                } else if(command.type == CommandType::Stop) {
-                    m_state = VideoState::Stopped;
-                    // notify and wait the treads to finish
-                    m_cvNotEmpty.notify_all();
-                    m_cvDone.notify_all();
-                    while(m_video_cap_tr_run && m_state != VideoState::Destruction) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_KILL_THREAD));
+                    // a prewarmed device is open (or opening) already, its capture thread goes on
+                    bool prewarmed = m_state == VideoState::Prewarmed && !needsOtherMode();
+                    if(prewarmed) {
+                        resetStats();
+                    }
+                    if(!prewarmed || !activatePrewarmed(command.issued)) {
+                        // a running capture has to be stopped first
+                        setState(VideoState::Stopped);
+                        joinCaptureThread();
+                        resetStats();
+                        m_start_issued = command.issued;
+                        setState(VideoState::Active);
+                        // start video capture thread, it reports the latency once the device is open
+                        m_video_cap_thread = procVideoCaptureThread();
                     }
+                } else if(command.type == CommandType::Prewarm) {
+                    if(m_state == VideoState::Stopped) {
+                        // a capture thread that failed to open is still to be joined
+                        joinCaptureThread();
+                        m_start_issued = command.issued;
+                        setState(VideoState::Prewarmed);
+                        m_video_cap_thread = procVideoCaptureThread();
+                    }
+                } else if(command.type == CommandType::Stop) {
+                    setState(VideoState::Stopped);
+                    joinCaptureThread();
+                    m_stop_latency_ms = elapsedMs(command.issued);
+                    failSnapshots("camera stopped");
+                } else if(command.type == CommandType::Exit) {
+                    setState(VideoState::Destruction);
+                    joinCaptureThread();
+                    failSnapshots("camera closed");
                 }
             }
-            updateStats();
-            std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_DISPATCHER_THREAD));
+            if(std::chrono::steady_clock::now() >= next_stats_time) {
+                updateStats();
+                next_stats_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(DELAY_DISPATCHER_THREAD);
+            }
         }
-        clearBeforeExit();
     });
 }
 
 std::thread* Video::procVideoCaptureThread() {
     return new std::thread([&] {
-        int ret = -1;
-        AVFrame* newFrame = NULL;
         AVFrame* outToScreenMirFrame = NULL;
-        SwsContext* swsToScreenMirrorCtx = NULL;
-        uint8_t* newFrameBuf = NULL;
-        uint8_t* outToScreenMirFrameBuf = NULL;
         VideoSource* video_src = NULL;
-        m_video_cap_tr_run = true;
 
         auto clearBeforeExit([&] {
-            av_free(newFrameBuf);
-            av_frame_free(&newFrame);
             av_frame_free(&outToScreenMirFrame);
-            av_free(outToScreenMirFrameBuf);
-            sws_freeContext(swsToScreenMirrorCtx);
             if(video_src != NULL) {
                 video_src->close();
                 delete video_src;
             }
-            m_video_cap_tr_run = false;
         });
-        m_outFrameBusSize = av_image_get_buffer_size(AV_PIX_FMT_RGB32,
-                                                        m_dimention_width,
-                                                        m_dimention_height, 1);
-        outToScreenMirFrameBuf = (uint8_t *)av_malloc(m_outFrameBusSize);
         outToScreenMirFrame = av_frame_alloc();
 
-        ret = av_image_alloc(outToScreenMirFrame->data,
-                             outToScreenMirFrame->linesize,
-                             m_dimention_width,
-                             m_dimention_height,
-                             AV_PIX_FMT_RGB32, 1);
-        if (ret < 0) {
-             memset(outToScreenMirFrame, 0, m_outFrameBusSize);
-         }
-
-        av_image_fill_arrays(outToScreenMirFrame->data, outToScreenMirFrame->linesize,
-                            outToScreenMirFrameBuf, AV_PIX_FMT_RGB32,
-                            m_dimention_width, m_dimention_height, 1);
-
         video_src = new VideoSource();
+        video_src->setInputFormat(m_input_format);
+        int req_width, req_height, req_fps;
+        getRequestedMode(req_width, req_height, req_fps);
+        video_src->setRequestedMode(req_width, req_height, req_fps);
+        {
+            std::lock_guard<std::mutex> lk(m_device_lock);
+            m_has_capture_mode = false;
+            if(!m_device.empty()) {
+                video_src->setDevice(m_device);
+            }
+            if(!m_input_url.empty()) {
+                video_src->setInput(m_input_format_override, m_input_url);
+            }
+        }
         if(!video_src->open()) {
-            m_state = VideoState::Stopped;
+            setState(VideoState::Stopped);
+            failSnapshots("camera open failed");
+            if(m_open_callback) {
+                m_open_callback(false);
+            }
             clearBeforeExit();
             return;
         }
-        swsToScreenMirrorCtx = sws_getContext(video_src->getDecodeWidth(),
-                                              video_src->getDecodeHeight(),
-                                              video_src->getDeocdePixFmt(),
-                                              m_dimention_width,
-                                              m_dimention_height,
-                                              AV_PIX_FMT_RGB32,
-                                              SWS_BICUBIC, NULL, NULL, NULL);
-        
-        auto last_frame_time = std::chrono::steady_clock::now();
-        auto next_frame_time = last_frame_time;
+        m_input_format_name = video_src->getInputFormatName();
+        {
+            std::lock_guard<std::mutex> lk(m_device_lock);
+            m_has_capture_mode = video_src->getCaptureMode(m_capture_mode);
+        }
+        if(m_open_callback) {
+            m_open_callback(true);
+        }
+        {
+            // prewarmed: open and idle until started or stopped
+            std::unique_lock<std::mutex> lk(m_state_lock);
+            while(m_state == VideoState::Prewarmed) {
+                m_state_cv.wait_for(lk, std::chrono::milliseconds(+PREWARM_DISCARD_MS));
+                // the first frame after the start is a fresh one, not a buffered one
+                video_src->discardPending();
+            }
+            // from the start command, which comes after the open when prewarmed
+            m_start_latency_ms = elapsedMs(m_start_issued);
+        }
+
+        int read_backoff_ms = 0;
+        uint32_t src_errors = 0;
+        uint64_t capture_seq = 0;
+        // the first frame is compared with nothing, not with the last capture
+        m_change_detector.reset();
+        ChangeMap change_map;
 
         while(m_state != VideoState::Stopped && m_state != VideoState::Destruction) {
+            auto read_start = std::chrono::steady_clock::now();
             auto oldFrame = video_src->readFrame();
+            if(video_src->getErrorCount() != src_errors) {
+                src_errors = video_src->getErrorCount();
+                incStatsDecodeErrPacket();
+            }
             if(oldFrame == NULL)  {
+                // sources without a blocking read return at once, do not spin on them;
+                // V4L2 already waited in poll(), sleeping would only delay the next frame
+                if(!video_src->hasBlockingRead()) {
+                    read_backoff_ms = std::min(std::max(1, read_backoff_ms * 2), +READ_BACKOFF_MAX_MS);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(read_backoff_ms));
+                }
                 continue;
             }
-            // out this frame on the screen
-            sws_scale(swsToScreenMirrorCtx,
-                      oldFrame->data,
-                      oldFrame->linesize,
-                      0,
-                      video_src->getDecodeHeight(),
-                      outToScreenMirFrame->data,
-                      outToScreenMirFrame->linesize);
-            outToScreenMirFrame->width = m_dimention_width;
-            outToScreenMirFrame->height = m_dimention_height;
-            outToScreenMirFrame->format = AV_PIX_FMT_RGB32;
-            m_frames_cnt++;
-            
-            if(std::chrono::steady_clock::now() >= next_frame_time) {
-                if(m_frame_callback != NULL) {
-                    m_frame_callback(outToScreenMirFrame, m_outFrameBusSize);
+            read_backoff_ms = 0;
+            incStatsDecodePacket();
+            // the decoder runs inside readFrame(), the rest is waiting on the device
+            uint32_t read_us = elapsedUs(read_start);
+            uint32_t decode_us = video_src->getLastDecodeUs();
+            uint32_t wait_us = read_us - std::min(read_us, decode_us);
+            // the device handed the data over, before the decoder and the change detector ran
+            auto read_done = read_start + std::chrono::microseconds(wait_us);
+            m_metrics->record(Stage::Read, wait_us);
+            if(video_src->isDecoding()) {
+                m_metrics->record(Stage::Decode, decode_us);
+            }
+            m_decode_time_us += decode_us;
+            m_decode_cnt++;
+
+            // the whole decoded frame, whether or not it changed
+            if(m_snapshot_pending) {
+                takeSnapshots(oldFrame);
+            }
+
+            // decoded once, every output converts from the same frame
+            auto now = std::chrono::steady_clock::now();
+            FrameTiming timing = FrameTiming();
+            timing.seq = ++capture_seq;
+            timing.pts_us = oldFrame->pts;
+            timing.capture_us = FrameTiming::toUs(read_done);
+            // an unchanged frame costs no conversion nor delivery, its seq is skipped
+            const ChangeMap* change = NULL;
+            if(m_change_detector.isEnabled()) {
+                auto detect_start = std::chrono::steady_clock::now();
+                bool changed = m_change_detector.process(oldFrame, change_map);
+                m_metrics->record(Stage::Detect, elapsedUs(detect_start));
+                if(!changed) {
+                    continue;
+                }
+                change = &change_map;
+            }
+            for(auto& output : getOutputs()) {
+                auto scale_start = std::chrono::steady_clock::now();
+                if(!output->convert(oldFrame, outToScreenMirFrame, now)) {
+                    continue;
                 }
-                last_frame_time = std::chrono::steady_clock::now();
-                next_frame_time = last_frame_time + std::chrono::milliseconds(30);
+                m_metrics->record(Stage::Scale, elapsedUs(scale_start));
+                timing.convert_us = FrameTiming::nowUs();
+                output->record(outToScreenMirFrame);
+                output->publishShared(outToScreenMirFrame);
+                uint32_t output_id = output->getId();
+                if(output->isEncoding()) {
+                    auto encode_start = std::chrono::steady_clock::now();
+                    uint32_t enqueue_us = 0;
+                    bool res = output->encode(outToScreenMirFrame, [&](AVPacket* packet) {
+                        incStatsEncodePacket(packet->size);
+                        if(m_packet_callback != NULL) {
+                            auto enqueue_start = std::chrono::steady_clock::now();
+                            m_packet_callback(output_id, packet);
+                            uint32_t us = elapsedUs(enqueue_start);
+                            m_metrics->record(Stage::Enqueue, us);
+                            enqueue_us += us;
+                        }
+                    });
+                    uint32_t encode_us = elapsedUs(encode_start);
+                    m_metrics->record(Stage::Encode, encode_us - std::min(encode_us, enqueue_us));
+                    if(!res) {
+                        incStatsEncodeErrPacket();
+                    }
+                } else if(m_frame_callback != NULL) {
+                    auto enqueue_start = std::chrono::steady_clock::now();
+                    m_frame_callback(output_id, outToScreenMirFrame, outToScreenMirFrame->buf[0]->size, timing, change);
+                    m_metrics->record(Stage::Enqueue, elapsedUs(enqueue_start));
+                }
+                // drop our reference, the slab goes back to the pool unless the callback kept it
+                av_frame_unref(outToScreenMirFrame);
             }
         }
         clearBeforeExit();
     });
 }
 
+void Video::incStatsDecodePacket() {
+    m_frames_cnt++;
+}
+
+void Video::incStatsDecodeErrPacket() {
+    m_errors++;
+}
+
+void Video::incStatsEncodePacket(uint32_t size) {
+    m_encode_packet_cnt++;
+    m_encode_bytes += size;
+}
+
+void Video::incStatsEncodeErrPacket() {
+    m_encode_err_cnt++;
+    m_errors++;
+}
+
+void Video::setStatsBitrate(uint64_t bitrate) {
+    m_encode_bitrate = bitrate;
+}
+
 void Video::updateStats() {
+    auto now = std::chrono::steady_clock::now();
+    auto period_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_last_stats_time).count();
+    m_last_stats_time = now;
+
+    // rates over the period that just ended
+    uint64_t encode_bytes = m_encode_bytes.exchange(0);
+    setStatsBitrate(period_ms > 0 ? encode_bytes * 8 * 1000 / period_ms : 0);
+    uint32_t decode_cnt = m_decode_cnt.exchange(0);
+    uint64_t decode_time_us = m_decode_time_us.exchange(0);
+    m_decode_avg_us = decode_cnt > 0 ? decode_time_us / decode_cnt : 0;
+    uint32_t frames_cnt = m_frames_cnt;
+    uint32_t delivered_cnt = 0;
+    for(auto& output : getOutputs()) {
+        delivered_cnt += output->getDeliveredCount();
+    }
+    if(period_ms > 0) {
+        m_capture_fps = (frames_cnt - m_last_frames_cnt) * 1000.0 / period_ms;
+        m_delivered_fps = (delivered_cnt - m_last_delivered_cnt) * 1000.0 / period_ms;
+    }
+    m_last_frames_cnt = frames_cnt;
+    m_last_delivered_cnt = delivered_cnt;
+
+    uint64_t record_bytes = 0;
+    for(auto& output : getOutputs()) {
+        auto recorder = output->getRecorder();
+        if(recorder != NULL) {
+            record_bytes += recorder->getWrittenBytes();
+        }
+    }
+    // a recording started or stopped meanwhile resets the baseline
+    m_record_throughput = period_ms > 0 && record_bytes >= m_last_record_bytes
+            ? (record_bytes - m_last_record_bytes) * 1000 / period_ms : 0;
+    m_last_record_bytes = record_bytes;
+
     if(m_status_callback != NULL) {
-        VideStats stats;
-        stats.err_cnt = getErrorCount();
-        stats.packet_cnt = getPacketCount();
-        stats.is_active = m_state == VideoState::Active;
-        m_status_callback(stats);
+        m_status_callback(getStats());
     }
 }
 
-void Video::waitToStop() {
-    // notify and wait the treads to finish
-    m_cvNotEmpty.notify_all();
-    m_cvDone.notify_all();
-    // wait until the threads finish
-    while(m_video_cap_tr_run) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_KILL_THREAD));
-    }
-    if(m_state == VideoState::Destruction) {
-        while(m_video_dispather_tr_run) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_KILL_THREAD));
+VideStats Video::getStats() {
+    VideStats stats;
+    stats.err_cnt = getErrorCount();
+    stats.packet_cnt = getPacketCount();
+    stats.delivered_cnt = 0;
+    stats.rate_dropped_cnt = 0;
+    stats.unchanged_cnt = m_change_detector.getSkippedCount();
+    stats.pool_alloc_cnt = 0;
+    stats.pool_reuse_cnt = 0;
+    stats.record_frame_cnt = 0;
+    stats.record_dropped_cnt = 0;
+    stats.record_bytes = 0;
+    stats.shm_frame_cnt = 0;
+    for(auto& output : getOutputs()) {
+        stats.delivered_cnt += output->getDeliveredCount();
+        stats.rate_dropped_cnt += output->getRateDroppedCount();
+        stats.pool_alloc_cnt += output->getPoolAllocCount();
+        stats.pool_reuse_cnt += output->getPoolReuseCount();
+        auto recorder = output->getRecorder();
+        if(recorder != NULL) {
+            stats.record_frame_cnt += recorder->getFrameCount();
+            stats.record_dropped_cnt += recorder->getDroppedCount();
+            stats.record_bytes += recorder->getWrittenBytes();
+        }
+        auto shm_writer = output->getShmWriter();
+        if(shm_writer != NULL) {
+            stats.shm_frame_cnt += shm_writer->getPublishedCount();
         }
     }
-}
\ No newline at end of file
+    stats.record_throughput = m_record_throughput;
+    stats.is_active = m_state == VideoState::Active;
+    stats.start_latency_ms = m_start_latency_ms;
+    stats.stop_latency_ms = m_stop_latency_ms;
+    stats.input_format = m_input_format_name;
+    stats.decode_avg_us = m_decode_avg_us;
+    stats.encode_packet_cnt = m_encode_packet_cnt;
+    stats.encode_err_cnt = m_encode_err_cnt;
+    stats.encode_bitrate = m_encode_bitrate;
+    stats.capture_fps = m_capture_fps;
+    stats.delivered_fps = m_delivered_fps;
+    for(int i = 0; i < (int)Stage::Count; i++) {
+        stats.stages[i] = m_metrics->stages[i].summary();
+    }
+    return stats;
+}
+
+uint32_t Video::elapsedUs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+uint32_t Video::elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
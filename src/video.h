@@ -16,21 +16,36 @@ extern "C" {
 #include "libavdevice/avdevice.h"
 #include "libavutil/dict.h"
 #include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
 #include "libswscale/swscale.h"
 #include <unistd.h>
 }
 
 #include <fstream>
 #include <iostream>
-#include <queue>
-#include <mutex>
 #include <atomic>
+#include <chrono>
 #include <thread>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <condition_variable>
+#include <vector>
 
+#include "change_detector.h"
+#include "command_channel.h"
+#include "device_caps.h"
+#include "frame_pool.h"
+#include "frame_timing.h"
+#include "input_format.h"
+#include "output_format.h"
 #include "video_source.h"
 #include "video_state.h"
 #include "video_stats.h"
+#include "video_output.h"
+#include "pipeline_metrics.h"
+#include "snapshot_encoder.h"
+#include "worker_pool.h"
 
 class Video
 {
@@ -39,66 +54,235 @@ public:
     ~Video();
 
     void startVideoCamera();
+    // Opens the device ahead of time and keeps it idle, a later
+    // startVideoCamera() then only has to wait for the next frame
+    void prewarm();
     void stopVideo();
+    // size, layout and rate of the default output, the one that always exists;
+    // all of them apply to a running capture without reopening the device
     void setResolution(int width, int height);
+    // applied on the next frame, frames already in the requested
+    // layout and size are passed through without swscale
+    void setOutputFormat(OutputFormat format);
+    // frames above this rate are dropped before any conversion, 0 delivers all of them
+    void setTargetFps(int fps);
+    // device node or index, applied on the next start
+    void setDevice(const std::string& device);
+    // libavformat input (lavfi graph, file) used instead of the device, see VideoSource::setInput
+    void setInput(const std::string& format, const std::string& url);
+    // capture format asked from the camera, a running capture is restarted
+    void setInputFormat(InputFormat format);
+    // Modes the device can capture in, probed once and cached on disk;
+    // refresh probes again. False for setInput() sources. A probe opens the
+    // device (avfoundation for up to a second), keep it off the JS thread.
+    bool getCapabilities(std::vector<CaptureMode>& modes, bool refresh);
+    // only what is cached, never touches the device
+    bool getCachedCapabilities(std::vector<CaptureMode>& modes);
+    // the native mode the running capture was opened in, if one was picked
+    bool getCaptureMode(CaptureMode& mode);
+    // threads used to scale a frame, per output, 0 picks one from the core count
+    void setScaleThreads(int thread_cnt);
+    // Encodes the next decoded frame, at the size the device captures in,
+    // on a snapshot worker; the capture thread only takes a reference, or
+    // copies the frame into a pooled buffer when it is not refcounted.
+    // done is called from the worker with the file image, or with false
+    // and the reason when the capture is not started or stops first.
+    void takeSnapshot(SnapshotFormat format, int quality,
+                      std::function<void(bool,std::vector<uint8_t>&,const char*)> done);
+    // counts as an output size when the capture mode is picked, so the device
+    // runs at it while smaller outputs are scaled down; 0 x 0 for none
+    void setSnapshotResolution(int width, int height);
+    // compares every decoded frame with the last changed one before the
+    // outputs see it, see ChangeDetector; NULL turns it off
+    void setChangeDetection(const ChangeConfig* config);
+
+    // Extra outputs fed from the same capture, applied from the next frame.
+    // Ids are never reused; the default output cannot be removed.
+    uint32_t addOutput(int width, int height, OutputFormat format, int fps);
+    bool removeOutput(uint32_t id);
+    // applied live; the device is only reopened when another native
+    // mode suits the outputs better than the one it runs in
+    bool setOutputResolution(uint32_t id, int width, int height);
+    bool setOutputFormat(uint32_t id, OutputFormat format);
+    bool setOutputFps(uint32_t id, int fps);
+    bool setOutputScaleFlags(uint32_t id, int flags);
+    // region of the captured frame the output shows, width 0 for all of it
+    bool setOutputCrop(uint32_t id, int x, int y, int width, int height);
+    bool setOutputOrientation(uint32_t id, Orientation orientation);
+    std::vector<uint32_t> getOutputIds();
+    // config NULL switches the output back to frames
+    bool setOutputEncoder(uint32_t id, const EncoderConfig* config);
+    bool requestKeyframe(uint32_t id);
+    // Writes the output's converted frames to a file from a writer thread,
+    // Y4M needs an i420 output.
+    bool startRecording(uint32_t id, const std::string& path, RecordFormat format);
+    // Detaches the output's recorder, NULL when it has none. Its stop()
+    // joins the writer and flushes the backlog, the caller runs it off the
+    // JS and capture threads.
+    std::shared_ptr<FrameRecorder> detachRecorder(uint32_t id);
+    // Publishes the output's frames into the named shared memory ring of
+    // slot_cnt slots, for readers in other processes (see ShmFrameReader)
+    bool startSharedMemory(uint32_t id, const std::string& name, int slot_cnt);
+    bool stopSharedMemory(uint32_t id);
 
-    void setFrameCallBack(std::function<void(AVFrame*,uint32_t)> cb);
+    // Called once per output and frame with the output id. All planes of the
+    // frame live in frame->buf[0] (a pooled slab or the decoder's buffer); the
+    // callback takes its own av_buffer_ref() to keep the pixels beyond the
+    // call. The size is the one of frame->buf[0]. frame->pts is the device
+    // timestamp in microseconds; timing has it with the capture sequence
+    // number and the capture and conversion times, the rest is left 0.
+    // change holds the changed tiles while change detection is on, else NULL.
+    void setFrameCallBack(std::function<void(uint32_t,AVFrame*,uint32_t,const FrameTiming&,const ChangeMap*)> cb);
     void setStatusCallBack(std::function<void(VideStats)> cb);
+    // Encoded outputs get packets instead of frames, the callback takes
+    // its own av_packet_ref() to keep the packet beyond the call.
+    void setPacketCallBack(std::function<void(uint32_t,AVPacket*)> cb);
+    // capture thread, once per start or prewarm: whether the device opened
+    void setOpenCallBack(std::function<void(bool)> cb);
 
-    std::function<void(AVFrame*,uint32_t)> m_frame_callback;
+    static constexpr const uint32_t DEFAULT_OUTPUT_ID = 0;
+
+    std::function<void(uint32_t,AVFrame*,uint32_t,const FrameTiming&,const ChangeMap*)> m_frame_callback;
     std::function<void(VideStats)> m_status_callback;
+    std::function<void(uint32_t,AVPacket*)> m_packet_callback;
+    std::function<void(bool)> m_open_callback;
 
     bool isStarted();
 
     uint32_t getPacketCount();
     uint32_t getErrorCount();
+    // current counters, rates and latencies, safe from any thread
+    VideStats getStats();
+    // shared so that frames still on their way to JS can record their delivery
+    std::shared_ptr<PipelineMetrics> getMetrics();
     
 private:
-    void waitToStop();
+    enum class CommandType { StartCamera, Prewarm, Stop, Exit };
+
+    typedef struct Command {
+        CommandType type;
+        std::chrono::steady_clock::time_point issued;
+    }Command;
+
+    typedef struct SnapshotRequest {
+        SnapshotFormat format;
+        int quality;
+        std::function<void(bool,std::vector<uint8_t>&,const char*)> done;
+    }SnapshotRequest;
+
+    void pushCommand(CommandType type);
+    // largest size and rate asked by the outputs, the capture mode is picked for it
+    void getRequestedMode(int& width, int& height, int& fps);
+    bool needsOtherMode();
+    std::string getDeviceName();
+    void joinCaptureThread();
+    // wakes a prewarmed capture thread, m_start_issued is set along
+    void setState(VideoState state);
+    bool activatePrewarmed(std::chrono::steady_clock::time_point issued);
+    void resetStats();
+    static uint32_t elapsedMs(std::chrono::steady_clock::time_point since);
+    std::shared_ptr<VideoOutput> findOutput(uint32_t id);
+    // capture thread, hands frame to the snapshot workers
+    void takeSnapshots(const AVFrame* frame);
+    // a reference on refcounted frames, a copy into a pooled slab otherwise
+    AVFrame* holdSnapshotFrame(const AVFrame* frame);
+    void failSnapshots(const char* error);
+    // snapshot, an output removed meanwhile lives until the snapshot is gone
+    std::vector<std::shared_ptr<VideoOutput>> getOutputs();
 
     void setStatsError(std::string error);
     void clearStatsError();
-    void incStatsEncodePacket();
+    void incStatsEncodePacket(uint32_t size);
     void incStatsEncodeErrPacket();
     void setStatsBitrate(uint64_t bitrate);
 
     void incStatsDecodePacket();
     void incStatsDecodeErrPacket();
+    static uint32_t elapsedUs(std::chrono::steady_clock::time_point since);
 
     void updateStats();
 
     std::thread* procVideoCaptureThread();
     std::thread* procDispatcherThread();
 
+    // the capture thread is owned by the dispatcher, the dispatcher by Video; both are joined
     std::thread* m_video_cap_thread;
     std::thread* m_video_dispather_thread;
 
-    std::atomic_bool m_video_cap_tr_run;
-    std::atomic_bool m_video_dispather_tr_run;
+    CommandChannel<Command> m_commands;
+    std::chrono::steady_clock::time_point m_start_issued;
 
-    enum class CommandType { StartCamera, Stop };
+    std::atomic<VideoState> m_state;
+    // a prewarmed capture thread waits on it to be started or stopped
+    std::mutex m_state_lock;
+    std::condition_variable m_state_cv;
+    std::atomic<InputFormat> m_input_format;
+    std::mutex m_device_lock;
+    std::string m_device;
+    std::string m_input_format_override;
+    std::string m_input_url;
+    // set by the capture thread once the device is open
+    bool m_has_capture_mode;
+    CaptureMode m_capture_mode;
 
-    typedef struct Command {
-        CommandType type;
-    }Command;
+    std::mutex m_outputs_lock;
+    std::vector<std::shared_ptr<VideoOutput>> m_outputs;
+    uint32_t m_next_output_id;
+    int m_scale_threads;
+    ChangeDetector m_change_detector;
 
-    std::queue<Command> m_command_queue;
+    // waiting for the next frame; the flag spares the capture thread the lock
+    std::mutex m_snapshot_lock;
+    std::vector<SnapshotRequest> m_snapshots;
+    std::atomic_bool m_snapshot_pending;
+    // created with the first snapshot, encodes never run on the capture thread
+    WorkerPool* m_snapshot_workers;
+    // V4L2 raw frames point into driver buffers that go back to the device
+    FramePool m_snapshot_pool;
+    std::atomic<int> m_snapshot_width;
+    std::atomic<int> m_snapshot_height;
 
-    int               m_dimention_height;
-    int               m_dimention_width;
-    int m_outFrameBusSize;
+    std::atomic<uint32_t> m_frames_cnt;
+    std::atomic<uint32_t> m_errors;
 
-    std::condition_variable m_cvNotEmpty;
-    std::condition_variable m_cvDone;
-    std::mutex				m_mtx;
+    std::shared_ptr<PipelineMetrics> m_metrics;
+    // rates of the last statistic period
+    std::atomic<double> m_capture_fps;
+    std::atomic<double> m_delivered_fps;
+    std::atomic<uint32_t> m_decode_avg_us;
+    uint32_t m_last_frames_cnt;
+    uint32_t m_last_delivered_cnt;
 
-    std::atomic<VideoState> m_state;
+    // from the command being issued until the device is open / the capture thread is joined
+    std::atomic<uint32_t> m_start_latency_ms;
+    std::atomic<uint32_t> m_stop_latency_ms;
+
+    // decode cost, summed by the capture thread and reset on every stats update
+    std::atomic<const char*> m_input_format_name;
+    std::atomic<uint64_t> m_decode_time_us;
+    std::atomic<uint32_t> m_decode_cnt;
+
+    // encoded outputs, the byte count is turned into a bitrate on every stats update
+    std::atomic<uint32_t> m_encode_packet_cnt;
+    std::atomic<uint32_t> m_encode_err_cnt;
+    std::atomic<uint64_t> m_encode_bytes;
+    std::atomic<uint64_t> m_encode_bitrate;
+    std::chrono::steady_clock::time_point m_last_stats_time;
 
-    uint32_t m_frames_cnt;
-    uint32_t m_errors;
+    // recorded bytes are turned into a throughput on every stats update
+    uint64_t m_last_record_bytes;
+    std::atomic<uint64_t> m_record_throughput;
 
-    static constexpr const int DELAY_KILL_THREAD            = 50;
+    // statistic period, commands are handled immediately
     static constexpr const int DELAY_DISPATCHER_THREAD      = 500;
+    static constexpr const int MAX_SCALE_THREADS            = 4;
+    static constexpr const int DEFAULT_TARGET_FPS           = 30;
+    // back-off while the source has nothing to read
+    static constexpr const int READ_BACKOFF_MAX_MS          = 8;
+    // a prewarmed device gives back what it buffered this often
+    static constexpr const int PREWARM_DISCARD_MS           = 50;
+    // a PNG being compressed does not hold up the next JPEG
+    static constexpr const int SNAPSHOT_THREADS             = 2;
     static constexpr const int DEFAULT_HEIGHT               = 1280;
     static constexpr const int DEFAULT_WIDTH                = 1024;
     static constexpr const char* const TAG  = "Video";
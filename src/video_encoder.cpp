@@ -0,0 +1,153 @@
+#include "video_encoder.h"
+#include <iostream>
+#include <chrono>
+
+namespace {
+
+// in order of preference
+const char* const ENCODER_NAMES[] = { "libx264", "libopenh264" };
+
+const AVCodec* findEncoder() {
+    for(const char* name : ENCODER_NAMES) {
+        const AVCodec* codec = avcodec_find_encoder_by_name(name);
+        if(codec != NULL) {
+            return codec;
+        }
+    }
+    return avcodec_find_encoder(AV_CODEC_ID_H264);
+}
+
+}
+
+VideoEncoder::VideoEncoder() {
+    m_ctx = NULL;
+    m_frame = av_frame_alloc();
+    m_packet = av_packet_alloc();
+    m_config.bitrate_kbps = 0;
+    m_config.gop = 0;
+    m_config.fps = 0;
+    m_failed = false;
+    m_failed_width = 0;
+    m_failed_height = 0;
+    m_start_us = 0;
+    m_force_keyframe = false;
+}
+
+VideoEncoder::~VideoEncoder() {
+    close();
+    av_frame_free(&m_frame);
+    av_packet_free(&m_packet);
+}
+
+bool VideoEncoder::encode(const AVFrame* frame, const EncoderConfig& config,
+                          const std::function<void(AVPacket*)>& on_packet) {
+    if(m_ctx == NULL || frame->width != m_ctx->width || frame->height != m_ctx->height
+            || !isSameConfig(config, m_config)) {
+        close();
+        if(m_failed && frame->width == m_failed_width && frame->height == m_failed_height
+                && isSameConfig(config, m_failed_config)) {
+            return true;
+        }
+        m_failed = !open(frame->width, frame->height, config);
+        if(m_failed) {
+            m_failed_width = frame->width;
+            m_failed_height = frame->height;
+            m_failed_config = config;
+            return false;
+        }
+    }
+    // pts in microseconds of the stream's own clock, the encoder's time base
+    if(av_frame_ref(m_frame, frame) < 0) {
+        return false;
+    }
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(m_start_us == 0) {
+        m_start_us = now_us;
+    }
+    m_frame->pts = now_us - m_start_us;
+    m_frame->pict_type = m_force_keyframe.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    int ret = avcodec_send_frame(m_ctx, m_frame);
+    av_frame_unref(m_frame);
+    if(ret < 0) {
+        std::cout << TAG << ": avcodec_send_frame failed, ret:" << ret << std::endl;
+        return false;
+    }
+    while((ret = avcodec_receive_packet(m_ctx, m_packet)) == 0) {
+        on_packet(m_packet);
+        av_packet_unref(m_packet);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+void VideoEncoder::requestKeyframe() {
+    m_force_keyframe = true;
+}
+
+const char* VideoEncoder::getCodecName() {
+    return m_ctx != NULL ? m_ctx->codec->name : "none";
+}
+
+bool VideoEncoder::isAvailable() {
+    return findEncoder() != NULL;
+}
+
+bool VideoEncoder::isValidSize(int width, int height) {
+    return width > 0 && height > 0 && width % 2 == 0 && height % 2 == 0;
+}
+
+bool VideoEncoder::open(int width, int height, const EncoderConfig& config) {
+    const AVCodec* codec = findEncoder();
+    if(codec == NULL) {
+        std::cout << TAG << ": no H.264 encoder available" << std::endl;
+        return false;
+    }
+    if(!isValidSize(width, height)) {
+        std::cout << TAG << ": " << width << "x" << height << " is not an even size, yuv420p cannot take it" << std::endl;
+        return false;
+    }
+    m_ctx = avcodec_alloc_context3(codec);
+    if(m_ctx == NULL) {
+        return false;
+    }
+    int fps = config.fps > 0 ? config.fps : 30;
+    m_ctx->width = width;
+    m_ctx->height = height;
+    m_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    m_ctx->time_base = AVRational{ 1, 1000000 };
+    m_ctx->framerate = AVRational{ fps, 1 };
+    m_ctx->bit_rate = (int64_t)config.bitrate_kbps * 1000;
+    // capped rate with a one second buffer, so a scene change cannot burst the link
+    m_ctx->rc_max_rate = m_ctx->bit_rate;
+    m_ctx->rc_buffer_size = m_ctx->bit_rate;
+    m_ctx->gop_size = config.gop;
+    m_ctx->max_b_frames = 0;
+    m_ctx->thread_count = 0;
+    // every option is best effort, encoders ignore the ones they do not have
+    if(!config.preset.empty()) {
+        av_opt_set(m_ctx->priv_data, "preset", config.preset.c_str(), 0);
+    }
+    av_opt_set(m_ctx->priv_data, "tune", "zerolatency", 0);
+    av_opt_set(m_ctx->priv_data, "profile", "baseline", 0);
+    int ret = avcodec_open2(m_ctx, codec, NULL);
+    if(ret < 0) {
+        std::cout << TAG << ": avcodec_open2 " << codec->name << " failed, ret:" << ret << std::endl;
+        avcodec_free_context(&m_ctx);
+        return false;
+    }
+    m_config = config;
+    m_start_us = 0;
+    // a new stream starts with a keyframe anyway
+    m_force_keyframe = false;
+    std::cout << TAG << ": " << codec->name << " " << width << "x" << height
+              << ", " << config.bitrate_kbps << " kbit/s, gop:" << config.gop << std::endl;
+    return true;
+}
+
+void VideoEncoder::close() {
+    avcodec_free_context(&m_ctx);
+}
+
+bool VideoEncoder::isSameConfig(const EncoderConfig& a, const EncoderConfig& b) {
+    return a.bitrate_kbps == b.bitrate_kbps && a.gop == b.gop && a.preset == b.preset && a.fps == b.fps;
+}
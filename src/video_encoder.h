@@ -0,0 +1,71 @@
+#ifndef VIDEO_ENCODER_H
+#define VIDEO_ENCODER_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/opt.h"
+#include "libavcodec/avcodec.h"
+}
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+struct EncoderConfig {
+    int bitrate_kbps;
+    // frames between keyframes
+    int gop;
+    // x264 preset name, ignored by encoders without presets
+    std::string preset;
+    int fps;
+};
+
+// H.264 encode stage of an output, driven by the capture thread.
+// Picks libx264, then libopenh264, then whatever H.264 encoder libavcodec
+// has, tuned for latency: no B-frames, packets come out for every frame.
+class VideoEncoder
+{
+public:
+    explicit VideoEncoder();
+    ~VideoEncoder();
+
+    // The frame has to be yuv420p. The encoder is (re)opened when the frame
+    // size or the config changes. Every packet produced is passed to
+    // on_packet, which takes its own reference to keep it. A size and
+    // config that failed to open are not retried until one of them changes,
+    // their frames are dropped quietly: the failure counted once.
+    bool encode(const AVFrame* frame, const EncoderConfig& config,
+                const std::function<void(AVPacket*)>& on_packet);
+
+    // the next frame is encoded as a keyframe
+    void requestKeyframe();
+
+    const char* getCodecName();
+
+    // some H.264 encoder is built into libavcodec
+    static bool isAvailable();
+    // yuv420p needs even sizes
+    static bool isValidSize(int width, int height);
+
+private:
+    bool open(int width, int height, const EncoderConfig& config);
+    void close();
+    static bool isSameConfig(const EncoderConfig& a, const EncoderConfig& b);
+
+    AVCodecContext* m_ctx;
+    AVFrame*        m_frame;
+    AVPacket*       m_packet;
+    EncoderConfig   m_config;
+    // the last open that failed, so that it is not retried every frame
+    bool            m_failed;
+    int             m_failed_width;
+    int             m_failed_height;
+    EncoderConfig   m_failed_config;
+    int64_t         m_start_us;
+    std::atomic_bool m_force_keyframe;
+
+    static constexpr const char* const TAG = "VideoEncoder";
+};
+
+#endif // VIDEO_ENCODER_H
@@ -0,0 +1,360 @@
+#include "video_output.h"
+#include <iostream>
+#include <algorithm>
+
+VideoOutput::VideoOutput(uint32_t id, int width, int height, OutputFormat format, int fps)
+    : m_id(id) {
+    m_width = width;
+    m_height = height;
+    m_format = format;
+    m_target_fps = std::max(0, fps);
+    m_scale_flags = SWS_BICUBIC;
+    m_crop_x = 0;
+    m_crop_y = 0;
+    m_crop_width = 0;
+    m_crop_height = 0;
+    m_crop_view = av_frame_alloc();
+    m_orientation = Orientation::Normal;
+    m_upright = av_frame_alloc();
+    m_encode = false;
+    m_next_frame_time = std::chrono::steady_clock::now();
+    m_delivered_cnt = 0;
+    m_rate_dropped_cnt = 0;
+}
+
+VideoOutput::~VideoOutput() {
+    av_frame_free(&m_crop_view);
+    av_frame_free(&m_upright);
+}
+
+uint32_t VideoOutput::getId() {
+    return m_id;
+}
+
+void VideoOutput::setResolution(int width, int height) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_width = width;
+    m_height = height;
+}
+
+void VideoOutput::getResolution(int& width, int& height) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    width = m_width;
+    height = m_height;
+}
+
+void VideoOutput::setFormat(OutputFormat format) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_format = format;
+}
+
+void VideoOutput::setTargetFps(int fps) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_target_fps = std::max(0, fps);
+}
+
+void VideoOutput::setScaleThreads(int thread_cnt) {
+    m_scaler.setThreadCount(thread_cnt);
+}
+
+void VideoOutput::setScaleFlags(int flags) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_scale_flags = flags;
+}
+
+void VideoOutput::setCrop(int x, int y, int width, int height) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_crop_x = x;
+    m_crop_y = y;
+    m_crop_width = width;
+    m_crop_height = height;
+}
+
+void VideoOutput::setOrientation(Orientation orientation) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_orientation = orientation;
+}
+
+bool VideoOutput::setEncoder(const EncoderConfig* config) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    if(config != NULL && !VideoEncoder::isAvailable()) {
+        std::cout << TAG << ": output " << m_id << " no H.264 encoder available" << std::endl;
+        return false;
+    }
+    // 0 follows the source, its size is checked when the encoder opens
+    if(config != NULL && (m_width > 0 || m_height > 0) && !VideoEncoder::isValidSize(m_width, m_height)) {
+        std::cout << TAG << ": output " << m_id << " " << m_width << "x" << m_height
+                  << " cannot be encoded, the size has to be even" << std::endl;
+        return false;
+    }
+    m_encode = config != NULL;
+    if(config != NULL) {
+        m_encode_config = *config;
+    }
+    return true;
+}
+
+bool VideoOutput::isEncoding() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_encode;
+}
+
+void VideoOutput::requestKeyframe() {
+    m_encoder.requestKeyframe();
+}
+
+int VideoOutput::getTargetFps() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_target_fps;
+}
+
+void VideoOutput::setRecorder(std::shared_ptr<FrameRecorder> recorder) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_recorder = recorder;
+}
+
+std::shared_ptr<FrameRecorder> VideoOutput::getRecorder() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_recorder;
+}
+
+void VideoOutput::setShmWriter(std::shared_ptr<ShmFrameWriter> writer) {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_shm_writer = writer;
+}
+
+std::shared_ptr<ShmFrameWriter> VideoOutput::getShmWriter() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_shm_writer;
+}
+
+void VideoOutput::publishShared(const AVFrame* frame) {
+    auto writer = getShmWriter();
+    if(writer != NULL) {
+        writer->publish(frame);
+    }
+}
+
+void VideoOutput::record(const AVFrame* frame) {
+    // pushed outside the lock, a recorder detached meanwhile ignores it
+    auto recorder = getRecorder();
+    if(recorder != NULL) {
+        recorder->push(frame);
+    }
+}
+
+bool VideoOutput::encode(const AVFrame* frame, const std::function<void(AVPacket*)>& on_packet) {
+    EncoderConfig config;
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        config = m_encode_config;
+        if(config.fps <= 0) {
+            config.fps = m_target_fps;
+        }
+    }
+    return m_encoder.encode(frame, config, on_packet);
+}
+
+bool VideoOutput::convert(const AVFrame* src, AVFrame* dst, std::chrono::steady_clock::time_point now) {
+    int width, height, fps, scale_flags;
+    Orientation orientation;
+    int crop_x, crop_y, crop_width, crop_height;
+    OutputFormat format;
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        width = m_width;
+        height = m_height;
+        crop_x = m_crop_x;
+        crop_y = m_crop_y;
+        crop_width = m_crop_width;
+        crop_height = m_crop_height;
+        // the encoder takes yuv420p
+        format = m_encode ? OutputFormat::I420 : m_format;
+        fps = m_target_fps;
+        scale_flags = m_scale_flags;
+        orientation = m_orientation;
+    }
+    // decide before converting, a dropped frame costs nothing more
+    if(!acceptFrame(fps, now)) {
+        m_rate_dropped_cnt++;
+        return false;
+    }
+    // the scaler only reads the rectangle, its cost follows the crop size
+    bool cropped = crop_width > 0 && crop_height > 0
+            && cropFrame(src, crop_x, crop_y, crop_width, crop_height, m_crop_view);
+    if(cropped) {
+        src = m_crop_view;
+    }
+    AVPixelFormat srcPixFmt = (AVPixelFormat)src->format;
+    AVPixelFormat outPixFmt = getOutputPixFmt(format, srcPixFmt);
+    bool passthrough = outPixFmt == srcPixFmt && src->width == width && src->height == height;
+    // only rgb pictures are turned
+    if(!PixelConvert::canOrient(outPixFmt)) {
+        orientation = Orientation::Normal;
+    }
+    // a crop shares no buffer JS could take as a whole
+    if(passthrough && orientation == Orientation::Normal && !cropped && isSingleBuffer(src)) {
+        // decoded frame already has the requested layout, share it by reference
+        if(av_frame_ref(dst, src) < 0) {
+            m_error_cnt++;
+            return false;
+        }
+        m_delivered_cnt++;
+        return true;
+    }
+    // every frame gets its own pooled slab, so the one handed out
+    // with the previous callback can stay alive on the JS side
+    int out_width, out_height;
+    PixelConvert::getOrientedSize(width, height, orientation, out_width, out_height);
+    if(!allocFrame(dst, outPixFmt, out_width, out_height)) {
+        m_error_cnt++;
+        return false;
+    }
+    dst->pts = src->pts;
+    bool ok;
+    if(src->width == width && src->height == height && PixelConvert::isSupported(srcPixFmt, outPixFmt, width)) {
+        // camera format to rgb without resizing: SIMD kernels, turned in the same pass
+        ok = PixelConvert::convert(src, dst, orientation);
+    } else if(passthrough && orientation != Orientation::Normal) {
+        ok = PixelConvert::orient(src, dst, orientation);
+    } else if(orientation != Orientation::Normal) {
+        // swscale resizes upright, the pixels are turned afterwards
+        ok = allocFrame(m_upright, outPixFmt, width, height)
+                && m_scaler.scale(src, m_upright, scale_flags)
+                && PixelConvert::orient(m_upright, dst, orientation);
+        av_frame_unref(m_upright);
+    } else if(passthrough) {
+        // driver buffers have to go back to the device, plain copy without swscale
+        av_image_copy(dst->data, dst->linesize, (const uint8_t**)src->data, src->linesize,
+                      outPixFmt, width, height);
+        ok = true;
+    } else {
+        ok = m_scaler.scale(src, dst, scale_flags);
+    }
+    if(!ok) {
+        av_frame_unref(dst);
+        m_error_cnt++;
+        return false;
+    }
+    m_delivered_cnt++;
+    return true;
+}
+
+uint32_t VideoOutput::getDeliveredCount() {
+    return m_delivered_cnt;
+}
+
+uint32_t VideoOutput::getRateDroppedCount() {
+    return m_rate_dropped_cnt;
+}
+
+uint32_t VideoOutput::getErrorCount() {
+    return m_error_cnt;
+}
+
+uint32_t VideoOutput::getPoolAllocCount() {
+    return m_frame_pool.getAllocCount();
+}
+
+uint32_t VideoOutput::getPoolReuseCount() {
+    return m_frame_pool.getReuseCount();
+}
+
+void VideoOutput::resetCounters() {
+    m_delivered_cnt = 0;
+    m_rate_dropped_cnt = 0;
+    m_error_cnt = 0;
+}
+
+bool VideoOutput::acceptFrame(int fps, std::chrono::steady_clock::time_point now) {
+    if(fps <= 0) {
+        return true;
+    }
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::microseconds(1000000 / fps));
+    // a quarter interval of slack so camera jitter does not halve the rate
+    if(now < m_next_frame_time - interval / 4) {
+        return false;
+    }
+    m_next_frame_time += interval;
+    if(m_next_frame_time < now) {
+        // late by more than a frame, do not burst to catch up
+        m_next_frame_time = now + interval;
+    }
+    return true;
+}
+
+AVPixelFormat VideoOutput::getOutputPixFmt(OutputFormat format, AVPixelFormat srcPixFmt) {
+    switch(format) {
+    case OutputFormat::I420:
+        return AV_PIX_FMT_YUV420P;
+    case OutputFormat::Nv12:
+        return AV_PIX_FMT_NV12;
+    case OutputFormat::Native:
+        return srcPixFmt;
+    case OutputFormat::Rgba:
+        return AV_PIX_FMT_RGBA;
+    default:
+        return AV_PIX_FMT_RGB32;
+    }
+}
+
+bool VideoOutput::cropFrame(const AVFrame* src, int x, int y, int width, int height, AVFrame* view) {
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    if(desc == NULL || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))) {
+        return false;
+    }
+    // corner and size on the chroma grid, every plane then starts on a whole
+    // sample (an even pixel for 4:2:x and packed 4:2:2, an even row for 4:2:0)
+    int align_w = 1 << desc->log2_chroma_w;
+    int align_h = 1 << desc->log2_chroma_h;
+    x = std::max(0, std::min(x, src->width)) / align_w * align_w;
+    y = std::max(0, std::min(y, src->height)) / align_h * align_h;
+    width = std::min(width, src->width - x) / align_w * align_w;
+    height = std::min(height, src->height - y) / align_h * align_h;
+    if(width <= 0 || height <= 0 || (width == src->width && height == src->height)) {
+        return false;
+    }
+    av_frame_unref(view);
+    for(int i = 0; i < AV_NUM_DATA_POINTERS && src->data[i] != NULL; i++) {
+        int shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+        int x_bytes = av_image_get_linesize((AVPixelFormat)src->format, x, i);
+        if(x_bytes < 0) {
+            return false;
+        }
+        view->data[i] = src->data[i] + (y >> shift) * src->linesize[i] + x_bytes;
+        view->linesize[i] = src->linesize[i];
+    }
+    view->width = width;
+    view->height = height;
+    view->format = src->format;
+    view->pts = src->pts;
+    return true;
+}
+
+bool VideoOutput::allocFrame(AVFrame* frame, AVPixelFormat format, int width, int height) {
+    frame->buf[0] = m_frame_pool.get(av_image_get_buffer_size(format, width, height, 1));
+    if(frame->buf[0] == NULL) {
+        return false;
+    }
+    av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, format, width, height, 1);
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    return true;
+}
+
+bool VideoOutput::isSingleBuffer(const AVFrame* frame) {
+    // JS gets one ArrayBuffer per frame, all planes have to live in buf[0]
+    if(frame->buf[0] == NULL || frame->buf[1] != NULL) {
+        return false;
+    }
+    const uint8_t* begin = frame->buf[0]->data;
+    const uint8_t* end = begin + frame->buf[0]->size;
+    for(int i = 0; i < AV_NUM_DATA_POINTERS && frame->data[i] != NULL; i++) {
+        if(frame->data[i] < begin || frame->data[i] >= end) {
+            return false;
+        }
+    }
+    return true;
+}
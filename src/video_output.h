@@ -0,0 +1,132 @@
+#ifndef VIDEO_OUTPUT_H
+#define VIDEO_OUTPUT_H
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+
+#include "frame_pool.h"
+#include "frame_recorder.h"
+#include "shm_frame_ring.h"
+#include "output_format.h"
+#include "pixel_convert.h"
+#include "slice_scaler.h"
+#include "video_encoder.h"
+
+// One consumer of the captured frames: its own size, pixel layout and
+// frame rate, with its own scaler and slab pool. Several outputs share a
+// single decoded frame, each one only pays for its own conversion.
+// Setters are called from the JS thread, convert() from the capture thread.
+class VideoOutput
+{
+public:
+    explicit VideoOutput(uint32_t id, int width, int height, OutputFormat format, int fps);
+    ~VideoOutput();
+
+    uint32_t getId();
+
+    void setResolution(int width, int height);
+    void getResolution(int& width, int& height);
+    // frames already in the requested layout and size are passed through without swscale
+    void setFormat(OutputFormat format);
+    // frames above this rate are dropped before any conversion, 0 takes all of them
+    void setTargetFps(int fps);
+    void setScaleThreads(int thread_cnt);
+    // SWS_* interpolation, SWS_BICUBIC by default
+    void setScaleFlags(int flags);
+    // Converts only this rectangle of the decoded frame, in its pixels;
+    // clipped to the frame and moved onto the chroma grid. A width or
+    // height of 0 converts the whole frame again.
+    void setCrop(int x, int y, int width, int height);
+    // Turns rgb frames; width and height stay the upright size, rotated
+    // frames come out height x width
+    void setOrientation(Orientation orientation);
+    // H.264 packets instead of frames, the output is converted to yuv420p;
+    // NULL goes back to frames. False, and nothing changes, without an
+    // H.264 encoder or when the output size is odd.
+    bool setEncoder(const EncoderConfig* config);
+    bool isEncoding();
+    void requestKeyframe();
+    int getTargetFps();
+    // converted frames are also handed to the recorder, NULL detaches it
+    void setRecorder(std::shared_ptr<FrameRecorder> recorder);
+    std::shared_ptr<FrameRecorder> getRecorder();
+    // converted frames are also published to a shared memory ring, NULL detaches it
+    void setShmWriter(std::shared_ptr<ShmFrameWriter> writer);
+    std::shared_ptr<ShmFrameWriter> getShmWriter();
+
+    // Converts src into this output's size and layout. Returns false when the
+    // frame is skipped by the fps gate or could not be converted; otherwise
+    // dst holds a reference (all planes in dst->buf[0]) the caller unrefs.
+    bool convert(const AVFrame* src, AVFrame* dst, std::chrono::steady_clock::time_point now);
+    // Queues a frame returned by convert() to the recorder, if any
+    void record(const AVFrame* frame);
+    // Copies a frame returned by convert() into the shared memory ring, if any
+    void publishShared(const AVFrame* frame);
+    // Encodes a frame returned by convert(), packets go to on_packet
+    bool encode(const AVFrame* frame, const std::function<void(AVPacket*)>& on_packet);
+
+    uint32_t getDeliveredCount();
+    uint32_t getRateDroppedCount();
+    // frames that could not be converted
+    uint32_t getErrorCount();
+    // slabs allocated / handed out again by the pool
+    uint32_t getPoolAllocCount();
+    uint32_t getPoolReuseCount();
+    void resetCounters();
+
+private:
+    bool acceptFrame(int fps, std::chrono::steady_clock::time_point now);
+    // gives frame a pooled slab of that layout
+    bool allocFrame(AVFrame* frame, AVPixelFormat format, int width, int height);
+    // points view's planes at the rectangle of src, nothing is copied
+    static bool cropFrame(const AVFrame* src, int x, int y, int width, int height, AVFrame* view);
+    static AVPixelFormat getOutputPixFmt(OutputFormat format, AVPixelFormat srcPixFmt);
+    static bool isSingleBuffer(const AVFrame* frame);
+
+    const uint32_t m_id;
+
+    std::mutex      m_lock;
+    int             m_width;
+    int             m_height;
+    OutputFormat    m_format;
+    int             m_target_fps;
+    int             m_scale_flags;
+    int             m_crop_x;
+    int             m_crop_y;
+    int             m_crop_width;
+    int             m_crop_height;
+    Orientation     m_orientation;
+    bool            m_encode;
+    EncoderConfig   m_encode_config;
+    std::shared_ptr<FrameRecorder> m_recorder;
+    std::shared_ptr<ShmFrameWriter> m_shm_writer;
+
+    FramePool   m_frame_pool;
+    SliceScaler m_scaler;
+    // capture thread only
+    VideoEncoder m_encoder;
+    // the cropped frame handed to the scaler, planes point into the decoded frame
+    AVFrame*     m_crop_view;
+    // resized frame waiting to be turned
+    AVFrame*     m_upright;
+    std::chrono::steady_clock::time_point m_next_frame_time;
+
+    std::atomic<uint32_t> m_delivered_cnt;
+    std::atomic<uint32_t> m_rate_dropped_cnt;
+    std::atomic<uint32_t> m_error_cnt;
+
+    static constexpr const char* const TAG = "VideoOutput";
+};
+
+#endif // VIDEO_OUTPUT_H
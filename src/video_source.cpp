@@ -1,11 +1,29 @@
 #include "video_source.h"
 #include <iostream>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
 
 #define USE_SCREEN_CAPTURE 0
 
 VideoSource::VideoSource() {
+#ifdef __linux__
+    m_v4l2 = NULL;
+#endif
     m_srcDecodeCtx = NULL;
     m_srcFmtDecCtx = NULL;
+    m_stream_index = -1;
+    m_raw_passthrough = false;
+    m_input_format = InputFormat::Auto;
+    m_last_decode_us = 0;
+    m_error_cnt = 0;
+    m_req_width = 0;
+    m_req_height = 0;
+    m_req_fps = 0;
+    m_has_mode = false;
+    m_capture_width = CAPTURE_WIDTH;
+    m_capture_height = CAPTURE_HEIGHT;
+    m_capture_fps = CAPTURE_FPS;
     oldFrame = av_frame_alloc();
     av_init_packet(&pkt);
 }
@@ -17,11 +35,66 @@ VideoSource::~VideoSource() {
         avformat_close_input(&m_srcFmtDecCtx);
         m_srcFmtDecCtx = NULL;
     }
+#ifdef __linux__
+    delete m_v4l2;
+#endif
     av_frame_free(&oldFrame);
 }
 
+void VideoSource::setDevice(const std::string& device) {
+    m_device = device;
+}
+
+void VideoSource::setInput(const std::string& format, const std::string& url) {
+    m_input_format_override = format;
+    m_input_url = url;
+}
+
+void VideoSource::setInputFormat(InputFormat format) {
+    m_input_format = format;
+}
+
+void VideoSource::setRequestedMode(int width, int height, int fps) {
+    m_req_width = width;
+    m_req_height = height;
+    m_req_fps = fps;
+}
+
+bool VideoSource::getCaptureMode(CaptureMode& mode) {
+    if(m_has_mode) {
+        mode = m_mode;
+    }
+    return m_has_mode;
+}
+
+void VideoSource::selectCaptureMode() {
+    m_has_mode = false;
+    m_capture_width = CAPTURE_WIDTH;
+    m_capture_height = CAPTURE_HEIGHT;
+    m_capture_fps = CAPTURE_FPS;
+    int fps = m_req_fps > 0 ? m_req_fps : CAPTURE_FPS;
+    std::vector<CaptureMode> modes;
+    if(m_req_width <= 0 || m_req_height <= 0 || !DeviceCaps::get(getDevice(), modes)
+            || !DeviceCaps::pickMode(modes, m_req_width, m_req_height, fps, m_input_format, m_mode)) {
+        return;
+    }
+    m_has_mode = true;
+    m_capture_width = m_mode.width;
+    m_capture_height = m_mode.height;
+    // devices refuse rates outside the range of the mode
+    m_capture_fps = fps;
+    if(m_mode.max_fps > 0) {
+        m_capture_fps = std::max(m_mode.min_fps, std::min(m_capture_fps, m_mode.max_fps));
+    }
+    std::cout << TAG << ": native mode " << m_mode.format << " " << m_capture_width << "x" << m_capture_height
+              << "@" << m_capture_fps << " for " << m_req_width << "x" << m_req_height << std::endl;
+}
+
 bool VideoSource::open() {
     bool res = false;
+    if(!m_input_url.empty()) {
+        return openGeneric();
+    }
 #ifdef _WIN32
     res = openWin();
 #elif __APPLE__
@@ -33,6 +106,11 @@ bool VideoSource::open() {
 }
 
 void VideoSource::close() {
+    if(!m_input_url.empty()) {
+        // a libavformat context, torn down like the avfoundation one
+        closeMacos();
+        return;
+    }
 #ifdef _WIN32
     closeWin();
 #elif __APPLE__
@@ -43,96 +121,357 @@ void VideoSource::close() {
 }
 
 AVFrame* VideoSource::readFrame() {
-    int ret = 0;
+    m_last_decode_us = 0;
+#ifdef __linux__
+    if(m_v4l2 != NULL && !m_v4l2->isCompressed()) {
+        // raw formats come straight out of the mapped buffer, stamped in microseconds
+        return m_v4l2->readFrame(READ_TIMEOUT_MS);
+    }
+#endif
+    AVFrame* frame = m_raw_passthrough ? (readPacket() ? wrapRawPacket() : NULL) : decodeFrame();
+    if (frame != NULL) {
+        frame->pts = getPtsUs(frame);
+    }
+    return frame;
+}
+
+int64_t VideoSource::getPtsUs(const AVFrame* frame) {
+    // decoders that reorder may only fill the best effort timestamp
+    int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE || m_srcFmtDecCtx == NULL || m_stream_index < 0) {
+        // v4l2 packets carry the buffer timestamp in microseconds already
+        return pts;
+    }
+    return av_rescale_q(pts, m_srcFmtDecCtx->streams[m_stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+void VideoSource::discardPending() {
+#ifdef __linux__
+    if(m_v4l2 != NULL) {
+        m_v4l2->discardReady();
+    }
+#endif
+    // avfoundation only keeps its newest frame, generated inputs have no backlog
+}
+
+bool VideoSource::readPacket() {
     av_init_packet(&pkt);
+#ifdef __linux__
+    if(m_v4l2 != NULL) {
+        m_v4l2->readFrame(READ_TIMEOUT_MS);
+        if(m_v4l2->getDataSize() == 0) {
+            return false;
+        }
+        pkt.data = (uint8_t*)m_v4l2->getData();
+        pkt.size = m_v4l2->getDataSize();
+        // the decoder hands it on to the frame
+        pkt.pts = m_v4l2->getTimestampUs();
+        pkt.dts = pkt.pts;
+        // decoded straight out of the mapped buffer, which goes back to the
+        // driver when the decoder drops the packet; without a spare buffer
+        // it stays unreferenced and avcodec_send_packet copies it
+        pkt.buf = m_v4l2->takeData();
+        return true;
+    }
+#endif
+    int ret = av_read_frame(m_srcFmtDecCtx, &pkt);
+    if (ret == AVERROR_EOF && !m_input_url.empty()) {
+        // files loop, so a short clip can drive a long run
+        av_seek_frame(m_srcFmtDecCtx, -1, 0, AVSEEK_FLAG_BACKWARD);
+        ret = av_read_frame(m_srcFmtDecCtx, &pkt);
+    }
+    if (ret < 0) {
+        av_packet_unref(&pkt);
+        return false;
+    }
+    return true;
+}
+
+AVFrame* VideoSource::decodeFrame() {
+    // frames already decoded by the codec threads are returned first,
+    // a new packet is only fed when the decoder asks for more input
+    auto decode_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration decode_time(0);
+    AVFrame* res = NULL;
+    for(;;) {
+        int ret = avcodec_receive_frame(m_srcDecodeCtx, oldFrame);
+        if (ret == 0) {
+            res = oldFrame;
+            break;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            std::cout << "avcodec_receive_frame failed, ret:" << ret;
+            m_error_cnt++;
+            break;
+        }
+        decode_time += std::chrono::steady_clock::now() - decode_start;
+        if (!readPacket()) {
+            break;
+        }
+        decode_start = std::chrono::steady_clock::now();
+        ret = avcodec_send_packet(m_srcDecodeCtx, &pkt);
+        av_packet_unref(&pkt);
+        if (ret != 0) {
+            std::cout << "avcodec_send_packet failed, ret:" << ret;
+            m_error_cnt++;
+            break;
+        }
+    }
+    if (res != NULL) {
+        decode_time += std::chrono::steady_clock::now() - decode_start;
+        m_last_decode_us = std::chrono::duration_cast<std::chrono::microseconds>(decode_time).count();
+    }
+    return res;
+}
 
-    if (av_read_frame(m_srcFmtDecCtx, &pkt) < 0) {
+AVFrame* VideoSource::wrapRawPacket() {
+    // the rawvideo decoder would only copy the bytes, point the frame
+    // planes into the packet and keep its buffer alive by reference instead
+    int width = m_srcDecodeCtx->width;
+    int height = m_srcDecodeCtx->height;
+    AVPixelFormat pix_fmt = m_srcDecodeCtx->pix_fmt;
+    int frame_size = av_image_get_buffer_size(pix_fmt, width, height, 1);
+    if (frame_size <= 0 || pkt.size < frame_size) {
+        std::cout << TAG << ": short raw packet, size:" << pkt.size << " expected:" << frame_size << std::endl;
+        m_error_cnt++;
         av_packet_unref(&pkt);
         return NULL;
     }
-    ret = avcodec_send_packet(m_srcDecodeCtx, &pkt);
-    if (ret != 0) {
-        std::cout << "avcodec_send_packet failed, ret:" << ret;
+    if (av_packet_make_refcounted(&pkt) < 0) {
+        m_error_cnt++;
         av_packet_unref(&pkt);
         return NULL;
     }
-    ret = avcodec_receive_frame(m_srcDecodeCtx, oldFrame);
-    if (ret != 0) {
-        std::cout << "avcodec_receive_frame failed, ret:" << ret;
+    av_frame_unref(oldFrame);
+    oldFrame->buf[0] = av_buffer_ref(pkt.buf);
+    if (oldFrame->buf[0] == NULL) {
+        m_error_cnt++;
         av_packet_unref(&pkt);
         return NULL;
     }
+    av_image_fill_arrays(oldFrame->data, oldFrame->linesize, pkt.data, pix_fmt, width, height, 1);
+    oldFrame->width = width;
+    oldFrame->height = height;
+    oldFrame->format = pix_fmt;
+    oldFrame->pts = pkt.pts;
+    oldFrame->pkt_dts = pkt.dts;
+    oldFrame->key_frame = 1;
+    oldFrame->pict_type = AV_PICTURE_TYPE_I;
     av_packet_unref(&pkt);
     return oldFrame;
 }
 
+bool VideoSource::isRawPassthrough(const AVCodecParameters* codecpar) {
+    if (codecpar->codec_id != AV_CODEC_ID_RAWVIDEO || codecpar->format == AV_PIX_FMT_NONE) {
+        return false;
+    }
+    // palettized and sub-byte formats still need the decoder to unpack them
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)codecpar->format);
+    return desc != NULL && !(desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM));
+}
+
 int VideoSource::getDecodeHeight() {
+#ifdef __linux__
+    if(m_v4l2 != NULL && !m_v4l2->isCompressed()) {
+        return m_v4l2->getHeight();
+    }
+#endif
     return m_srcDecodeCtx ? m_srcDecodeCtx->height : 0;
 }
 
 int VideoSource::getDecodeWidth() {
+#ifdef __linux__
+    if(m_v4l2 != NULL && !m_v4l2->isCompressed()) {
+        return m_v4l2->getWidth();
+    }
+#endif
     return m_srcDecodeCtx ? m_srcDecodeCtx->width : 0;
 }
 
+uint32_t VideoSource::getLastDecodeUs() {
+    return m_last_decode_us;
+}
+
+bool VideoSource::hasBlockingRead() {
+#ifdef __linux__
+    return m_v4l2 != NULL;
+#else
+    return false;
+#endif
+}
+
+bool VideoSource::isDecoding() {
+#ifdef __linux__
+    if(m_v4l2 != NULL) {
+        return m_v4l2->isCompressed();
+    }
+#endif
+    return m_srcDecodeCtx != NULL && !m_raw_passthrough;
+}
+
+uint32_t VideoSource::getErrorCount() {
+    return m_error_cnt;
+}
+
+const char* VideoSource::getInputFormatName() {
+    if (m_srcDecodeCtx != NULL && m_srcDecodeCtx->codec_id != AV_CODEC_ID_RAWVIDEO) {
+        return avcodec_get_name(m_srcDecodeCtx->codec_id);
+    }
+    const char* name = av_get_pix_fmt_name(getDeocdePixFmt());
+    return name != NULL ? name : "none";
+}
+
 AVPixelFormat VideoSource::getDeocdePixFmt() {
+#ifdef __linux__
+    if(m_v4l2 != NULL && !m_v4l2->isCompressed()) {
+        return m_v4l2->getPixFmt();
+    }
+#endif
     return m_srcDecodeCtx ? m_srcDecodeCtx->pix_fmt: AV_PIX_FMT_NONE;
 }
 
 bool VideoSource::openMacos() {
-    int err = 0;
-    const AVCodec* decoder = NULL;
-    AVDictionary* options = NULL;
-
+    selectCaptureMode();
     auto devFamily = getDeviceFamily();
     const AVInputFormat *iformat = av_find_input_format(devFamily);
     if(iformat == NULL) {
         std::cout << "getDeviceFamily == NULL";
         return false;
     }
-    av_dict_set(&options, "video_size","1280x720", 0);
-    av_dict_set(&options, "pixel_format","uyvy422",0);
-    av_dict_set(&options, "framerate","30",0);
+    // the first capture format the device accepts wins
+    bool opened = false;
+    for(const std::string& pixel_format : getPixelFormatCandidates()) {
+        if(openInput(iformat, pixel_format)) {
+            opened = true;
+            break;
+        }
+    }
+    if(!opened) {
+        std::cout << "avformat_open_input returned <0";
+        return false;
+    }
+    return openStream();
+}
 
+bool VideoSource::openGeneric() {
+    // NULL lets libavformat probe the url, files need no format name
+    const AVInputFormat* iformat = NULL;
+    if(!m_input_format_override.empty()) {
+        iformat = av_find_input_format(m_input_format_override.c_str());
+        if(iformat == NULL) {
+            std::cout << TAG << ": unknown input format " << m_input_format_override << std::endl;
+            return false;
+        }
+    }
     m_srcFmtDecCtx = avformat_alloc_context();
+    int err = avformat_open_input((AVFormatContext**)&m_srcFmtDecCtx, m_input_url.c_str(), (AVInputFormat*)iformat, NULL);
+    if(err < 0) {
+        std::cout << TAG << ": " << m_input_url << " refused, err:" << err << std::endl;
+        return false;
+    }
+    return openStream();
+}
 
+bool VideoSource::openStream() {
+    const AVCodec* decoder = NULL;
+    // probing a live device only waits for frames to arrive, skip it when
+    // opening already told size and format; files are always probed
+    if (isStreamKnown()) {
+        std::cout << TAG << ": stream known, not probed" << std::endl;
+    } else if (avformat_find_stream_info(m_srcFmtDecCtx, NULL) < 0) {
+        std::cout << "couldn't find stream information";
+        return false;
+    }
+    const AVCodecParameters* codecpar = NULL;
+    for(unsigned int i=0; i < m_srcFmtDecCtx->nb_streams; ++i) {
+        auto stream = m_srcFmtDecCtx->streams[i];
+        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            codecpar = stream->codecpar;
+            m_stream_index = i;
+            break;
+        }
+    }
+    if (codecpar == NULL) {
+        std::cout << "couldn't find video stream";
+        return false;
+    }
+    decoder = avcodec_find_decoder(codecpar->codec_id);
+    if (decoder == NULL) {
+        std::cout << "couldn't find stream information";
+        return false;
+    }
+    m_srcDecodeCtx = avcodec_alloc_context3(decoder);
+    if (avcodec_parameters_to_context(m_srcDecodeCtx, codecpar) < 0) {
+        std::cout << "Video avcodec_parameters_to_context failed,error code";
+        return false;
+    }
+    m_raw_passthrough = isRawPassthrough(codecpar);
+    if (m_raw_passthrough) {
+        // the context only describes the stream, it is never opened
+        return true;
+    }
+    return openDecoder(decoder);
+}
+
+bool VideoSource::isStreamKnown() {
+    if (m_srcFmtDecCtx->iformat == NULL || !(m_srcFmtDecCtx->iformat->flags & AVFMT_NOFILE)) {
+        return false;
+    }
+    for(unsigned int i=0; i < m_srcFmtDecCtx->nb_streams; ++i) {
+        const AVCodecParameters* codecpar = m_srcFmtDecCtx->streams[i]->codecpar;
+        if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            return codecpar->codec_id != AV_CODEC_ID_NONE && codecpar->width > 0 && codecpar->height > 0
+                    && (codecpar->codec_id != AV_CODEC_ID_RAWVIDEO || codecpar->format != AV_PIX_FMT_NONE);
+        }
+    }
+    return false;
+}
+
+bool VideoSource::openInput(const AVInputFormat* iformat, const std::string& pixel_format) {
+    AVDictionary* options = NULL;
+    std::string video_size = std::to_string(m_capture_width) + "x" + std::to_string(m_capture_height);
+    av_dict_set(&options, "video_size", video_size.c_str(), 0);
+    av_dict_set(&options, "pixel_format", pixel_format.c_str(), 0);
+    // fractional, avfoundation wants the rate of the mode to a few ppm (30.000030)
+    av_dict_set(&options, "framerate", std::to_string(m_capture_fps).c_str(), 0);
+
+    m_srcFmtDecCtx = avformat_alloc_context();
 #if USE_SCREEN_CAPTURE == 1
     av_dict_set(&options, "capture_cursor","1",0);
     av_dict_set(&options, "capture_mouse_clicks","1",0);
-    err = avformat_open_input((AVFormatContext**)&m_srcFmtDecCtx,"1", (AVInputFormat*)iformat, &options);
+    int err = avformat_open_input((AVFormatContext**)&m_srcFmtDecCtx,"1", (AVInputFormat*)iformat, &options);
 #else
-    err = avformat_open_input((AVFormatContext**)&m_srcFmtDecCtx,"0", (AVInputFormat*)iformat, &options);
+    int err = avformat_open_input((AVFormatContext**)&m_srcFmtDecCtx, getDevice().c_str(), (AVInputFormat*)iformat, &options);
 #endif
+    av_dict_free(&options);
     if(err < 0) {
-        std::cout << "avformat_open_input returned <0";
+        // avformat_open_input frees the context on failure
+        std::cout << TAG << ": " << pixel_format << " refused, err:" << err << std::endl;
         return false;
     }
-    if (avformat_find_stream_info(m_srcFmtDecCtx, NULL) < 0) {
-        std::cout << "couldn't find stream information";
-        return false;
-    }
-    if (m_srcFmtDecCtx->streams[0]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-        for(unsigned int i=0; i < m_srcFmtDecCtx->nb_streams; ++i) {
-            auto stream = m_srcFmtDecCtx->streams[i];
-            if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                decoder = avcodec_find_decoder(stream->codecpar->codec_id);
-                if (decoder == NULL) {
-                    std::cout << "couldn't find stream information";
-                    return false;
-                }
-                m_srcDecodeCtx = avcodec_alloc_context3(decoder);
-                if ((err = avcodec_parameters_to_context(m_srcDecodeCtx, stream->codecpar)) < 0) {
-                    std::cout << "Video avcodec_parameters_to_context failed,error code";
-                    return false;
-                }
-                break;
-            }
-        }
+    std::cout << TAG << ": capture format " << pixel_format << std::endl;
+    return true;
+}
+
+std::vector<std::string> VideoSource::getPixelFormatCandidates() {
+    // avfoundation only delivers raw formats, the camera compresses over USB
+    // and the OS decodes, so compressed requests fall back to raw ones
+    if(m_input_format == InputFormat::Mjpeg || m_input_format == InputFormat::H264) {
+        std::cout << TAG << ": compressed capture is not available, using raw" << std::endl;
     }
-    if (avcodec_open2(m_srcDecodeCtx, decoder, &options) < 0) {
+    return { "uyvy422", "nv12", "yuyv422" };
+}
+
+bool VideoSource::openDecoder(const AVCodec* decoder) {
+    // frame threading hides the per-packet decode cost, the thread count is kept
+    // small since each extra frame thread delays the output by one frame
+    m_srcDecodeCtx->thread_count = std::min(av_cpu_count(), +MAX_DECODE_THREADS);
+    m_srcDecodeCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (avcodec_open2(m_srcDecodeCtx, decoder, NULL) < 0) {
         std::cout << "avcodec_open2 failed";
         return false;
     }
-    av_dict_free(&options);
+    std::cout << TAG << ": decoding " << decoder->name << ", threads:" << m_srcDecodeCtx->thread_count << std::endl;
     return true;
 }
 
@@ -142,8 +481,32 @@ bool VideoSource::openWin() {
 }
 
 bool VideoSource::openLinux() {
-    // TODO:
+#ifdef __linux__
+    selectCaptureMode();
+    auto device = getDevice();
+    m_v4l2 = new V4l2Capture();
+    std::string format = m_has_mode ? m_mode.format : "";
+    if(!m_v4l2->open(device, m_capture_width, m_capture_height, (int)(m_capture_fps + 0.5), m_input_format, format)) {
+        std::cout << "v4l2 open failed, device:" << device << std::endl;
+        delete m_v4l2;
+        m_v4l2 = NULL;
+        return false;
+    }
+    if(!m_v4l2->isCompressed()) {
+        return true;
+    }
+    const AVCodec* decoder = avcodec_find_decoder(m_v4l2->getCodecId());
+    if (decoder == NULL) {
+        std::cout << "couldn't find decoder for v4l2 format";
+        return false;
+    }
+    m_srcDecodeCtx = avcodec_alloc_context3(decoder);
+    m_srcDecodeCtx->width = m_v4l2->getWidth();
+    m_srcDecodeCtx->height = m_v4l2->getHeight();
+    return openDecoder(decoder);
+#else
     return false;
+#endif
 }
 
 bool VideoSource::closeMacos() {
@@ -152,6 +515,9 @@ bool VideoSource::closeMacos() {
         avformat_close_input(&m_srcFmtDecCtx);
         m_srcFmtDecCtx = NULL;
     }
+    m_stream_index = -1;
+    avcodec_free_context(&m_srcDecodeCtx);
+    m_raw_passthrough = false;
     return true;
 }
 
@@ -161,7 +527,15 @@ bool VideoSource::closeWin() {
 }
 
 bool VideoSource::closeLinux() {
-    // TODO:
+#ifdef __linux__
+    // the decoder drops the capture buffers it holds before they are unmapped
+    avcodec_free_context(&m_srcDecodeCtx);
+    if(m_v4l2 != NULL) {
+        m_v4l2->close();
+        delete m_v4l2;
+        m_v4l2 = NULL;
+    }
+#endif
     return true;
 }
 
@@ -175,3 +549,7 @@ const char* VideoSource::getDeviceFamily() {
 #endif
   return device_family;
 }
+
+std::string VideoSource::getDevice() {
+    return !m_device.empty() ? m_device : DeviceCaps::getDefaultDevice();
+}
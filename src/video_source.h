@@ -16,20 +16,64 @@ extern "C" {
 #include "libavdevice/avdevice.h"
 #include "libavutil/dict.h"
 #include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
 #include "libswscale/swscale.h"
 #include <unistd.h>
 }
 
+#include <string>
+#include <vector>
+
+#include "device_caps.h"
+#include "input_format.h"
+
+#ifdef __linux__
+#include "v4l2_capture.h"
+#endif
+
 class VideoSource
 {
 public:
     explicit VideoSource();
     ~VideoSource();
 
+    void setDevice(const std::string& device);
+    // Any libavformat input instead of the camera: a lavfi graph
+    // ("lavfi", "testsrc2=size=1280x720:rate=30,format=uyvy422") or a
+    // file (empty format, probed). Files loop at the end.
+    void setInput(const std::string& format, const std::string& url);
+    // applied by the next open()
+    void setInputFormat(InputFormat format);
+    // Output size and rate the capture should suit, applied by the next
+    // open(): the device's native mode closest to it is picked, 0 keeps
+    // the fixed default mode
+    void setRequestedMode(int width, int height, int fps);
+    // the native mode open() picked, false when the default one was used
+    bool getCaptureMode(CaptureMode& mode);
+
     bool open();
     void close();
 
+    // Returns the next frame, or NULL when nothing arrived in time.
+    // Compressed input is decoded on the codec's own threads: frames already
+    // decoded are returned before another packet is read. pts is the
+    // device timestamp in microseconds, AV_NOPTS_VALUE when there is none.
     AVFrame* readFrame();
+    // Gives back what the device buffered while nobody read, so the next
+    // readFrame() returns a fresh frame; for an open device kept idle
+    void discardPending();
+
+    // time spent in the decoder for the frame last returned, 0 for raw input
+    uint32_t getLastDecodeUs();
+    // frames go through a decoder, as opposed to raw passthrough
+    bool isDecoding();
+    // readFrame() waits for the device (V4L2 polls up to READ_TIMEOUT_MS),
+    // a NULL read needs no back-off
+    bool hasBlockingRead();
+    // packets that failed to decode or to wrap
+    uint32_t getErrorCount();
+    // codec name for compressed input, pixel format name for raw input
+    const char* getInputFormatName();
 
     int getDecodeHeight();
     int getDecodeWidth();
@@ -44,13 +88,57 @@ private:
     bool closeWin();
     bool closeLinux();
 
+    void selectCaptureMode();
+    bool openGeneric();
+    bool openInput(const AVInputFormat* iformat, const std::string& pixel_format);
+    // stream lookup and decoder setup once m_srcFmtDecCtx is open
+    bool openStream();
+    // live input whose stream is fully described once open, no probing needed
+    bool isStreamKnown();
+    std::vector<std::string> getPixelFormatCandidates();
+    bool openDecoder(const AVCodec* decoder);
+
+    bool readPacket();
+    AVFrame* decodeFrame();
+    AVFrame* wrapRawPacket();
+    // frame pts from the stream's time base to microseconds
+    int64_t getPtsUs(const AVFrame* frame);
+    static bool isRawPassthrough(const AVCodecParameters* codecpar);
+
     const char* getDeviceFamily();
+    std::string getDevice();
 
+#ifdef __linux__
+    V4l2Capture*        m_v4l2;
+#endif
+    std::string         m_device;
+    std::string         m_input_format_override;
+    std::string         m_input_url;
     AVCodecContext*     m_srcDecodeCtx;
     AVFormatContext*    m_srcFmtDecCtx;
+    // video stream of m_srcFmtDecCtx, -1 before it is found
+    int                 m_stream_index;
+    bool                m_raw_passthrough;
+    InputFormat         m_input_format;
+    uint32_t            m_last_decode_us;
+    uint32_t            m_error_cnt;
+    int                 m_req_width;
+    int                 m_req_height;
+    int                 m_req_fps;
+    // what open() asks the device for
+    bool                m_has_mode;
+    CaptureMode         m_mode;
+    int                 m_capture_width;
+    int                 m_capture_height;
+    double              m_capture_fps;
     AVPacket pkt;
     AVFrame* oldFrame;
 
+    static constexpr const int CAPTURE_WIDTH            = 1280;
+    static constexpr const int CAPTURE_HEIGHT           = 720;
+    static constexpr const int CAPTURE_FPS              = 30;
+    static constexpr const int READ_TIMEOUT_MS          = 200;
+    static constexpr const int MAX_DECODE_THREADS       = 4;
     static constexpr const char* const TAG = "VideoSource";
 };
 
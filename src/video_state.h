@@ -1,6 +1,7 @@
 #ifndef VIDE_STATE_H
 #define VIDE_STATE_H
 
-enum class VideoState { Active, Stopped, Destruction };
+// Prewarmed: the device is open and idle, starting it skips the open
+enum class VideoState { Active, Prewarmed, Stopped, Destruction };
 
 #endif // VIDE_STATE_H
@@ -2,12 +2,42 @@
 #define VIDEO_STATS_H
 
 #include <stdint.h>
+#include "pipeline_metrics.h"
 
 struct VideStats
 {
     bool is_active;
     uint32_t packet_cnt;
     uint32_t err_cnt;
+    uint32_t delivered_cnt;
+    uint32_t rate_dropped_cnt;
+    // frames change detection found unchanged and dropped before any output
+    uint32_t unchanged_cnt;
+    uint32_t start_latency_ms;
+    uint32_t stop_latency_ms;
+    // capture format (codec or pixel format name) and its average
+    // decode time per frame over the last statistic period
+    const char* input_format;
+    uint32_t decode_avg_us;
+    // encoded outputs together, bitrate in bit/s over the last period
+    uint32_t encode_packet_cnt;
+    uint32_t encode_err_cnt;
+    uint64_t encode_bitrate;
+    // over the last statistic period: frames read from the device / handed to outputs' callbacks
+    double capture_fps;
+    double delivered_fps;
+    // frame slabs allocated / reused by the outputs' pools, reuse is the normal case
+    uint32_t pool_alloc_cnt;
+    uint32_t pool_reuse_cnt;
+    // recordings of all outputs; throughput over the last statistic period, bytes/s
+    uint32_t record_frame_cnt;
+    uint32_t record_dropped_cnt;
+    uint64_t record_bytes;
+    uint64_t record_throughput;
+    // frames published to shared memory rings
+    uint32_t shm_frame_cnt;
+    // since the capture started, per pipeline stage
+    LatencySummary stages[(int)Stage::Count];
 };
 
 #endif // VIDEO_STATS_H
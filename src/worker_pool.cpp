@@ -0,0 +1,70 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(int thread_cnt) {
+    m_exit = false;
+    for(int i = 0; i < thread_cnt; i++) {
+        m_threads.push_back(new std::thread([this] { procWorkerThread(); }));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_exit = true;
+    }
+    m_cv.notify_all();
+    // queued tasks are finished first
+    for(auto thread : m_threads) {
+        thread->join();
+        delete thread;
+    }
+}
+
+void WorkerPool::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cv.notify_one();
+}
+
+void WorkerPool::run(int count, const std::function<void(int)>& job) {
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+    int remaining = count - 1;
+
+    for(int i = 1; i < count; i++) {
+        post([&, i] {
+            job(i);
+            std::lock_guard<std::mutex> lk(done_lock);
+            if(--remaining == 0) {
+                done_cv.notify_one();
+            }
+        });
+    }
+    if(count > 0) {
+        job(0);
+    }
+    std::unique_lock<std::mutex> lk(done_lock);
+    done_cv.wait(lk, [&] { return remaining <= 0; });
+}
+
+int WorkerPool::getThreadCount() {
+    return m_threads.size();
+}
+
+void WorkerPool::procWorkerThread() {
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(m_lock);
+            m_cv.wait(lk, [&] { return m_exit || !m_tasks.empty(); });
+            if(m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Small set of persistent threads for work that must not run
+// on the capture thread or must be split across cores.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int thread_cnt);
+    ~WorkerPool();
+
+    // Queues a task, returns immediately
+    void post(std::function<void()> task);
+
+    // Runs job(0) .. job(count - 1) in parallel, the calling thread takes
+    // part as well; returns once all of them are done
+    void run(int count, const std::function<void(int)>& job);
+
+    int getThreadCount();
+
+private:
+    void procWorkerThread();
+
+    std::vector<std::thread*>           m_threads;
+    std::deque<std::function<void()>>   m_tasks;
+    std::mutex                          m_lock;
+    std::condition_variable             m_cv;
+    bool                                m_exit;
+};
+
+#endif // WORKER_POOL_H